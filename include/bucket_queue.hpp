@@ -0,0 +1,314 @@
+/* welcome to bucket_queue.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_BUCKET_QUEUE_HPP
+#define GHS_BUCKET_QUEUE_HPP
+
+#include <vector>                      // vector
+#include <cstddef>                     // size_t
+#include <utility>                     // move, forward
+#include <boost/noncopyable.hpp>       // noncopyable
+
+namespace GHS
+{
+namespace project
+{
+//╔═════════════════════════        RingFifo        ═══════════════════════════╗
+/******************************************************************************
+ * growable circular FIFO. storage only ever grows (by doubling), so once it
+ * has seen its peak load, push and pop never allocate.
+ ******************************************************************************/
+template <typename T>
+class RingFifo
+{
+public:
+    explicit RingFifo(size_t initialCapacity = 0);
+
+    T &front();
+    const T &front() const;
+    void push_back(const T &value);
+    void push_back(T &&value);
+    void pop_front();
+    bool empty() const;
+    size_t size() const;
+    void reserve(size_t capacity);
+
+private:
+    std::vector<T> m_items;
+    size_t m_head;
+    size_t m_size;
+};
+
+template <typename T>
+RingFifo<T>::RingFifo(size_t initialCapacity) : m_head(0), m_size(0)
+{
+    reserve(initialCapacity);
+}
+
+template <typename T>
+T &RingFifo<T>::front()
+{
+    return m_items[m_head];
+}
+
+template <typename T>
+const T &RingFifo<T>::front() const
+{
+    return m_items[m_head];
+}
+
+template <typename T>
+void RingFifo<T>::push_back(const T &value)
+{
+    T copy(value);
+    push_back(std::move(copy));
+}
+
+template <typename T>
+void RingFifo<T>::push_back(T &&value)
+{
+    if (m_size == m_items.size())
+    {
+        reserve(m_size ? m_size * 2 : 8);
+    }
+
+    m_items[(m_head + m_size) % m_items.size()] = std::move(value);
+    ++m_size;
+}
+
+template <typename T>
+void RingFifo<T>::pop_front()
+{
+    m_items[m_head] = T(); // release what the slot holds right away
+    m_head = (m_head + 1) % m_items.size();
+    --m_size;
+}
+
+template <typename T>
+bool RingFifo<T>::empty() const
+{
+    return (0 == m_size);
+}
+
+template <typename T>
+size_t RingFifo<T>::size() const
+{
+    return m_size;
+}
+
+template <typename T>
+void RingFifo<T>::reserve(size_t capacity)
+{
+    if (capacity <= m_items.size())
+    {
+        return;
+    }
+
+    std::vector<T> items(capacity);
+    for (size_t i = 0; i < m_size; ++i)
+    {
+        items[i] = std::move(m_items[(m_head + i) % m_items.size()]);
+    }
+    m_items.swap(items);
+    m_head = 0;
+}
+//╚═════════════════════════        RingFifo        ═══════════════════════════╝
+
+//╔═════════════════════════      BucketQueue       ═══════════════════════════╗
+/******************************************************************************
+ * priority queue over a small, fixed set of levels: one FIFO per level and a
+ * bitmap of the non-empty levels, so push and pop are O(1) and items of the
+ * same level come out in the order they went in.
+ *
+ * LevelTraits must provide:
+ *      NUM_LEVELS          - number of levels (at most 32)
+ *      FIRST_AGING_LEVEL   - levels below it never age (sentinel levels)
+ *      static size_t Level(const T &) - level of an item, < NUM_LEVELS
+ *
+ * aging: once a non-empty level (>= FIRST_AGING_LEVEL) has been passed over
+ * by agingLimit pops served from higher levels, the next pop serves it.
+ * an agingLimit of 0 disables aging.
+ *
+ * every level preallocates room for initialCapacity items.
+ ******************************************************************************/
+template <typename T, typename LevelTraits>
+class BucketQueue : private boost::noncopyable
+{
+public:
+    explicit BucketQueue(size_t agingLimit = 0, size_t initialCapacity = 0);
+    ~BucketQueue() = default;
+
+    T &front();
+    const T &front() const;
+    void pop();
+    void push(const T &value);
+    void push(T &&value);
+    template <class... Args>
+    void emplace(Args&&... args);
+    bool empty() const;
+    size_t size() const;
+
+private:
+    enum { NUM_LEVELS = LevelTraits::NUM_LEVELS };
+
+    static unsigned HighestBit(unsigned bitmap);
+    static unsigned LowestBit(unsigned bitmap);
+
+    size_t PickLevel() const;
+    void AgeLevelsBelow(size_t servedLevel);
+
+    RingFifo<T> m_levels[NUM_LEVELS];
+    size_t m_passedOver[NUM_LEVELS];
+    unsigned m_nonEmpty;    // bit per level holding items
+    unsigned m_starved;     // bit per level that reached the aging limit
+    size_t m_agingLimit;
+    size_t m_size;
+};
+
+template <typename T, typename LevelTraits>
+BucketQueue<T, LevelTraits>::BucketQueue(size_t agingLimit,
+                                         size_t initialCapacity)
+    : m_nonEmpty(0), m_starved(0), m_agingLimit(agingLimit), m_size(0)
+{
+    for (size_t i = 0; i < NUM_LEVELS; ++i)
+    {
+        m_passedOver[i] = 0;
+        m_levels[i].reserve(initialCapacity);
+    }
+}
+
+template <typename T, typename LevelTraits>
+T &BucketQueue<T, LevelTraits>::front()
+{
+    return m_levels[PickLevel()].front();
+}
+
+template <typename T, typename LevelTraits>
+const T &BucketQueue<T, LevelTraits>::front() const
+{
+    return m_levels[PickLevel()].front();
+}
+
+template <typename T, typename LevelTraits>
+void BucketQueue<T, LevelTraits>::pop()
+{
+    size_t level = PickLevel();
+
+    m_levels[level].pop_front();
+    --m_size;
+
+    m_passedOver[level] = 0;
+    m_starved &= ~(1u << level);
+    if (m_levels[level].empty())
+    {
+        m_nonEmpty &= ~(1u << level);
+    }
+
+    AgeLevelsBelow(level);
+}
+
+template <typename T, typename LevelTraits>
+void BucketQueue<T, LevelTraits>::push(const T &value)
+{
+    T copy(value);
+    push(std::move(copy));
+}
+
+template <typename T, typename LevelTraits>
+void BucketQueue<T, LevelTraits>::push(T &&value)
+{
+    size_t level = LevelTraits::Level(value);
+
+    m_levels[level].push_back(std::move(value));
+    m_nonEmpty |= (1u << level);
+    ++m_size;
+}
+
+template <typename T, typename LevelTraits>
+template <class... Args>
+void BucketQueue<T, LevelTraits>::emplace(Args&&... args)
+{
+    // the level is only known once the item exists
+    push(T(std::forward<Args>(args)...));
+}
+
+template <typename T, typename LevelTraits>
+bool BucketQueue<T, LevelTraits>::empty() const
+{
+    return (0 == m_size);
+}
+
+template <typename T, typename LevelTraits>
+size_t BucketQueue<T, LevelTraits>::size() const
+{
+    return m_size;
+}
+
+template <typename T, typename LevelTraits>
+size_t BucketQueue<T, LevelTraits>::PickLevel() const
+{
+    // the lowest starved level first, everything above it passes it over
+    return (m_starved ? LowestBit(m_starved) : HighestBit(m_nonEmpty));
+}
+
+template <typename T, typename LevelTraits>
+void BucketQueue<T, LevelTraits>::AgeLevelsBelow(size_t servedLevel)
+{
+    if (0 == m_agingLimit)
+    {
+        return;
+    }
+
+    unsigned waiting = m_nonEmpty & ((1u << servedLevel) - 1) &
+                       ~((1u << LevelTraits::FIRST_AGING_LEVEL) - 1);
+    while (waiting)
+    {
+        unsigned level = LowestBit(waiting);
+        waiting &= ~(1u << level);
+
+        if (++m_passedOver[level] >= m_agingLimit)
+        {
+            m_starved |= (1u << level);
+        }
+    }
+}
+
+template <typename T, typename LevelTraits>
+unsigned BucketQueue<T, LevelTraits>::HighestBit(unsigned bitmap)
+{
+#ifdef __GNUC__
+    return (31 - __builtin_clz(bitmap));
+#else
+    unsigned bit = 0;
+    while (bitmap >>= 1)
+    {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+template <typename T, typename LevelTraits>
+unsigned BucketQueue<T, LevelTraits>::LowestBit(unsigned bitmap)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(bitmap);
+#else
+    unsigned bit = 0;
+    while (!(bitmap & 1u))
+    {
+        bitmap >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+//╚═════════════════════════      BucketQueue       ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_BUCKET_QUEUE_HPP
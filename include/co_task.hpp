@@ -0,0 +1,254 @@
+/* welcome to co_task.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_CO_TASK_HPP
+#define GHS_CO_TASK_HPP
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>                   // coroutine_handle, suspend_always
+#include <exception>                   // exception_ptr
+#include <optional>                    // optional
+#include <utility>                     // move, exchange
+
+namespace GHS
+{
+namespace project
+{
+template <class T> class CoTask;
+
+namespace detail
+{
+// return_value or return_void, as a promise may declare only one of them
+template <class T>
+class CoTaskResult
+{
+public:
+    template <class U>
+    void return_value(U &&value)
+    {
+        m_value.emplace(std::forward<U>(value));
+    }
+    T Take()
+    {
+        return std::move(*m_value);
+    }
+
+private:
+    std::optional<T> m_value;
+};
+
+template <>
+class CoTaskResult<void>
+{
+public:
+    void return_void()
+    {
+        // empty
+    }
+    void Take()
+    {
+        // empty
+    }
+};
+} // namespace detail
+
+//╔═════════════════════════         CoTask         ═══════════════════════════╗
+/******************************************************************************
+ * a lazy coroutine returning T. it starts when first awaited, on the thread
+ * that awaits it, and resumes its awaiter (on the thread it finished on)
+ * once done. no thread ever blocks: a CoTask that waits on something
+ * suspends, and its awaiter with it. pair with ThreadPool::Schedule to move
+ * onto a worker, and ThreadPool::Spawn to start one from plain code.
+ * move-only; destroying it destroys the coroutine, which must not be running.
+ ******************************************************************************/
+template <class T = void>
+class CoTask
+{
+public:
+    class promise_type : public detail::CoTaskResult<T>
+    {
+    public:
+        CoTask get_return_object()
+        {
+            return CoTask(handle_type::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept
+        {
+            return std::suspend_always();
+        }
+        // hands the thread over to the awaiter, if any
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(
+                                    std::coroutine_handle<promise_type> self)
+                                                                    noexcept
+            {
+                std::coroutine_handle<> awaiter = self.promise().m_awaiter;
+                return awaiter ? awaiter : std::noop_coroutine();
+            }
+            void await_resume() noexcept
+            {
+                // empty
+            }
+        };
+        FinalAwaiter final_suspend() noexcept
+        {
+            return FinalAwaiter();
+        }
+        void unhandled_exception()
+        {
+            m_exception = std::current_exception();
+        }
+
+    private:
+        friend class CoTask;
+
+        std::coroutine_handle<> m_awaiter;
+        std::exception_ptr m_exception;
+    };
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    CoTask(CoTask &&other) noexcept;
+    CoTask &operator=(CoTask &&other) noexcept;
+    ~CoTask();
+
+    bool IsDone() const;
+
+    // starts the coroutine and suspends the awaiter until it is done.
+    // resumes the awaiter with the result, or rethrows the exception
+    class ResultAwaiter;
+    ResultAwaiter operator co_await();
+    // the same, but resumes without touching the result (see TakeResult)
+    class ReadyAwaiter;
+    ReadyAwaiter WhenReady();
+    // moves the result out of a done coroutine, or rethrows its exception
+    T TakeResult();
+
+private:
+    explicit CoTask(handle_type handle);
+
+    handle_type m_handle;
+};
+
+template <class T>
+class CoTask<T>::ReadyAwaiter
+{
+public:
+    explicit ReadyAwaiter(handle_type handle) : m_handle(handle) {}
+
+    bool await_ready() const noexcept
+    {
+        return m_handle.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter)
+                                                                    noexcept
+    {
+        m_handle.promise().m_awaiter = awaiter;
+        return m_handle; // symmetric transfer, so chains do not grow the stack
+    }
+    void await_resume() noexcept
+    {
+        // empty
+    }
+
+protected:
+    handle_type m_handle;
+};
+
+template <class T>
+class CoTask<T>::ResultAwaiter : public ReadyAwaiter
+{
+public:
+    explicit ResultAwaiter(CoTask &task) : ReadyAwaiter(task.m_handle),
+                                           m_task(task) {}
+
+    T await_resume()
+    {
+        return m_task.TakeResult();
+    }
+
+private:
+    CoTask &m_task;
+};
+
+template <class T>
+CoTask<T>::CoTask(handle_type handle) : m_handle(handle)
+{
+    // empty
+}
+
+template <class T>
+CoTask<T>::CoTask(CoTask &&other) noexcept
+                                : m_handle(std::exchange(other.m_handle, {}))
+{
+    // empty
+}
+
+template <class T>
+CoTask<T> &CoTask<T>::operator=(CoTask &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+        m_handle = std::exchange(other.m_handle, {});
+    }
+
+    return *this;
+}
+
+template <class T>
+CoTask<T>::~CoTask()
+{
+    if (m_handle)
+    {
+        m_handle.destroy();
+    }
+}
+
+template <class T>
+bool CoTask<T>::IsDone() const
+{
+    return m_handle.done();
+}
+
+template <class T>
+typename CoTask<T>::ResultAwaiter CoTask<T>::operator co_await()
+{
+    return ResultAwaiter(*this);
+}
+
+template <class T>
+typename CoTask<T>::ReadyAwaiter CoTask<T>::WhenReady()
+{
+    return ReadyAwaiter(m_handle);
+}
+
+template <class T>
+T CoTask<T>::TakeResult()
+{
+    if (m_handle.promise().m_exception)
+    {
+        std::rethrow_exception(m_handle.promise().m_exception);
+    }
+
+    return m_handle.promise().Take();
+}
+//╚═════════════════════════         CoTask         ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+
+#endif // __cpp_impl_coroutine
+#endif // GHS_CO_TASK_HPP
@@ -0,0 +1,54 @@
+/* welcome to cpu_topology.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_CPU_TOPOLOGY_HPP
+#define GHS_CPU_TOPOLOGY_HPP
+
+#include <cstddef>                     // size_t
+#include <string>                      // string
+#include <vector>                      // vector
+
+namespace GHS
+{
+namespace project
+{
+//╔═════════════════════════      CpuTopology       ═══════════════════════════╗
+/******************************************************************************
+ * the online CPUs of the machine, grouped by NUMA node, as read from sysfs
+ * (/sys/devices/system/node/node<N>/cpulist). a machine (or kernel) that
+ * shows no nodes is taken as a single node holding every online CPU.
+ ******************************************************************************/
+class CpuTopology
+{
+public:
+    typedef std::vector<int> cpu_list;
+
+    static CpuTopology Detect();
+    // a topology of the given nodes, for tests and for callers that know
+    // better than sysfs
+    explicit CpuTopology(const std::vector<cpu_list> &nodes);
+
+    size_t GetNumOfNodes() const;
+    const cpu_list &GetCpus(size_t node) const;
+    cpu_list GetAllCpus() const;
+    // the node cpu belongs to, or GetNumOfNodes() if it is not online
+    size_t GetNodeOf(int cpu) const;
+
+    // "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+    static cpu_list ParseCpuList(const std::string &text);
+    // restricts the calling thread to cpus. false if the OS refused (or is
+    // not supported), in which case the thread may run anywhere
+    static bool PinCurrentThread(const cpu_list &cpus);
+
+private:
+    std::vector<cpu_list> m_nodes;
+};
+//╚═════════════════════════      CpuTopology       ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_CPU_TOPOLOGY_HPP
@@ -0,0 +1,181 @@
+/* welcome to mpmc_ring_buffer.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_MPMC_RING_BUFFER_HPP
+#define GHS_MPMC_RING_BUFFER_HPP
+
+#include <cstddef>                     // size_t
+#include <utility>                     // move
+#include <boost/noncopyable.hpp>       // noncopyable
+#include <boost/scoped_array.hpp>      // scoped_array
+#include <boost/atomic.hpp>            // atomic, memory_order
+
+namespace GHS
+{
+namespace project
+{
+//╔═════════════════════════     MPMCRingBuffer     ═══════════════════════════╗
+/******************************************************************************
+ * bounded, lock-free, multi-producer/multi-consumer ring buffer.
+ *
+ * every cell carries a sequence number: a cell is free for the producer that
+ * claims position p when its sequence equals p, and holds data for the
+ * consumer that claims position p when its sequence equals p + 1.
+ * the producer and consumer positions live on separate cache lines.
+ *
+ * capacity is rounded up to a power of two. T must be default constructible
+ * and move assignable; items are moved in and out of the cells.
+ ******************************************************************************/
+template <typename T>
+class MPMCRingBuffer : private boost::noncopyable
+{
+public:
+    explicit MPMCRingBuffer(size_t capacity);
+    ~MPMCRingBuffer() = default;
+
+    bool TryPush(const T &value);
+    // on failure value is left untouched
+    bool TryPush(T &&value);
+    bool TryPop(T &out);
+
+    bool IsEmpty() const;
+    size_t GetCapacity() const;
+
+private:
+    enum { CACHE_LINE = 64 };
+
+    struct Cell
+    {
+        boost::atomic<size_t> m_sequence;
+        T m_data;
+    };
+
+    static size_t RoundUpToPowerOfTwo(size_t num);
+
+    char m_padding0[CACHE_LINE];
+    const size_t m_mask;
+    boost::scoped_array<Cell> m_cells;
+    char m_padding1[CACHE_LINE];
+    boost::atomic<size_t> m_pushPosition;
+    char m_padding2[CACHE_LINE];
+    boost::atomic<size_t> m_popPosition;
+    char m_padding3[CACHE_LINE];
+};
+
+template <typename T>
+MPMCRingBuffer<T>::MPMCRingBuffer(size_t capacity)
+    : m_mask(RoundUpToPowerOfTwo(capacity) - 1),
+      m_cells(new Cell[m_mask + 1]),
+      m_pushPosition(0), m_popPosition(0)
+{
+    for (size_t i = 0; i <= m_mask; ++i)
+    {
+        m_cells[i].m_sequence.store(i, boost::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+bool MPMCRingBuffer<T>::TryPush(const T &value)
+{
+    T copy(value);
+    return TryPush(std::move(copy));
+}
+
+template <typename T>
+bool MPMCRingBuffer<T>::TryPush(T &&value)
+{
+    size_t position = m_pushPosition.load(boost::memory_order_relaxed);
+
+    for (;;)
+    {
+        Cell &cell = m_cells[position & m_mask];
+        size_t sequence = cell.m_sequence.load(boost::memory_order_acquire);
+        ptrdiff_t diff = static_cast<ptrdiff_t>(sequence - position);
+
+        if (0 == diff)
+        {
+            if (m_pushPosition.compare_exchange_weak(position, position + 1,
+                                                boost::memory_order_relaxed))
+            {
+                cell.m_data = std::move(value);
+                cell.m_sequence.store(position + 1,
+                                      boost::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            position = m_pushPosition.load(boost::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+bool MPMCRingBuffer<T>::TryPop(T &out)
+{
+    size_t position = m_popPosition.load(boost::memory_order_relaxed);
+
+    for (;;)
+    {
+        Cell &cell = m_cells[position & m_mask];
+        size_t sequence = cell.m_sequence.load(boost::memory_order_acquire);
+        ptrdiff_t diff = static_cast<ptrdiff_t>(sequence - (position + 1));
+
+        if (0 == diff)
+        {
+            if (m_popPosition.compare_exchange_weak(position, position + 1,
+                                                boost::memory_order_relaxed))
+            {
+                out = std::move(cell.m_data);
+                cell.m_sequence.store(position + m_mask + 1,
+                                      boost::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // empty
+        }
+        else
+        {
+            position = m_popPosition.load(boost::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+bool MPMCRingBuffer<T>::IsEmpty() const
+{
+    return (m_popPosition.load(boost::memory_order_acquire) ==
+            m_pushPosition.load(boost::memory_order_acquire));
+}
+
+template <typename T>
+size_t MPMCRingBuffer<T>::GetCapacity() const
+{
+    return (m_mask + 1);
+}
+
+template <typename T>
+size_t MPMCRingBuffer<T>::RoundUpToPowerOfTwo(size_t num)
+{
+    size_t power = 2;
+    while (power < num)
+    {
+        power <<= 1;
+    }
+    return power;
+}
+//╚═════════════════════════     MPMCRingBuffer     ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_MPMC_RING_BUFFER_HPP
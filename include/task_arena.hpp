@@ -0,0 +1,183 @@
+/* welcome to task_arena.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_TASK_ARENA_HPP
+#define GHS_TASK_ARENA_HPP
+
+#include <cstddef>                     // size_t, max_align_t
+#include <map>                         // map
+#include <vector>                      // vector
+#include <new>                         // bad_alloc
+#include <boost/noncopyable.hpp>       // noncopyable
+#include <boost/shared_ptr.hpp>        // shared_ptr
+#include <boost/atomic.hpp>            // atomic counters
+#include <boost/cstdint.hpp>           // uint64_t
+#include <boost/thread/mutex.hpp>      // boost::mutex
+#include <boost/thread/thread.hpp>     // thread::id
+
+namespace GHS
+{
+namespace project
+{
+//╔═════════════════════════       TaskArena        ═══════════════════════════╗
+/******************************************************************************
+ * slab allocator for task objects and their control blocks.
+ * requests are rounded up to one of a few size classes; every class keeps a
+ * free list of blocks carved out of slabs of BLOCKS_PER_SLAB blocks. freed
+ * blocks go back to their free list and slabs are only released with the
+ * arena, so once the free lists are warm, allocation never reaches malloc.
+ * every thread keeps a cache of free blocks of its own and takes no lock
+ * while it can serve from it; the cache refills from (and spills to) the
+ * shared free lists CACHE_BATCH blocks at a time, and goes back to them
+ * whole as the thread exits.
+ * blocks are aligned to BLOCK_ALIGNMENT. requests above the largest class,
+ * or for a stricter alignment, fall back to operator new.
+ ******************************************************************************/
+class TaskArena : private boost::noncopyable
+{
+public:
+    struct Stats
+    {
+        size_t allocations;         // blocks handed out
+        size_t deallocations;       // blocks given back
+        size_t slabAllocations;     // calls to operator new for new slabs
+        size_t oversizeAllocations; // requests served by operator new
+        size_t bytesReserved;       // bytes held in slabs
+    };
+
+    explicit TaskArena(size_t blocksPerSlab = DEFAULT_BLOCKS_PER_SLAB);
+    ~TaskArena();
+
+    // throws bad_alloc for an alignment operator new cannot honour
+    void *Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    // size and alignment as given to Allocate
+    void Deallocate(void *block, size_t size,
+                    size_t alignment = alignof(std::max_align_t)) noexcept;
+    // carves enough slabs up front for numOfBlocks blocks of the given size
+    void Reserve(size_t size, size_t numOfBlocks);
+
+    Stats GetStats() const;
+
+private:
+    enum
+    {
+        DEFAULT_BLOCKS_PER_SLAB = 64,
+        NUM_OF_CLASSES = 5,
+        SMALLEST_CLASS = 64,
+        BLOCK_ALIGNMENT = SMALLEST_CLASS,
+        CACHE_BATCH = 16,
+        CACHE_LIMIT = 2 * CACHE_BATCH
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock *m_next;
+    };
+
+    struct SizeClass
+    {
+        SizeClass() : m_freeList(NULL) {}
+
+        boost::mutex m_mutex;
+        FreeBlock *m_freeList;
+    };
+
+    // the free blocks of one thread. only the counters are read by others
+    struct Cache
+    {
+        Cache();
+
+        FreeBlock *m_freeLists[NUM_OF_CLASSES];
+        size_t m_numOfFree[NUM_OF_CLASSES];
+        boost::atomic<size_t> m_allocations;
+        boost::atomic<size_t> m_deallocations;
+    };
+    typedef std::map<boost::thread::id, boost::shared_ptr<Cache> > cache_map;
+    class ThreadCaches; // the arenas the calling thread has a cache in
+
+    static size_t ClassOf(size_t size);
+    static size_t BlockSize(size_t sizeClass);
+    static void *NewOversize(size_t size, size_t alignment);
+    static void DeleteOversize(void *block, size_t alignment) noexcept;
+    // NULL if the calling thread has no cache and one cannot be made
+    Cache *GetCache() noexcept;
+    // moves up to CACHE_BATCH blocks from the shared list to the cache
+    void Refill(Cache &cache, size_t sizeClass);
+    // moves numOfBlocks blocks from the cache back to the shared list
+    void Spill(Cache &cache, size_t sizeClass, size_t numOfBlocks) noexcept;
+    // spills the whole cache of an exiting thread, and forgets it
+    void ReleaseCache(boost::thread::id thread) noexcept;
+    void AddSlab(size_t sizeClass);
+
+    const size_t m_blocksPerSlab;
+    const boost::uint64_t m_id; // tells arenas apart, even at one address
+    SizeClass m_classes[NUM_OF_CLASSES];
+
+    boost::mutex m_slabsMutex;
+    std::vector<char *> m_slabs;
+
+    mutable boost::mutex m_cachesMutex;
+    cache_map m_caches;         // guarded by m_cachesMutex
+
+    // of the threads that had no cache, and of released caches
+    boost::atomic<size_t> m_allocations;
+    boost::atomic<size_t> m_deallocations;
+    boost::atomic<size_t> m_slabAllocations;
+    boost::atomic<size_t> m_oversizeAllocations;
+    boost::atomic<size_t> m_bytesReserved;
+};
+//╚═════════════════════════       TaskArena        ═══════════════════════════╝
+
+//╔═════════════════════════     ArenaAllocator     ═══════════════════════════╗
+/******************************************************************************
+ * standard allocator over a TaskArena, for boost::allocate_shared.
+ * every copy shares ownership of the arena, so objects (and control blocks)
+ * allocated from it may safely outlive whoever created the arena.
+ ******************************************************************************/
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(const boost::shared_ptr<TaskArena> &arena)
+                                                        : m_arena(arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.m_arena) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(m_arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *block, size_t n) noexcept
+    {
+        m_arena->Deallocate(block, n * sizeof(T), alignof(T));
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> &other) const noexcept
+    {
+        return (m_arena == other.m_arena);
+    }
+
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> &other) const noexcept
+    {
+        return (m_arena != other.m_arena);
+    }
+
+private:
+    template <class U> friend class ArenaAllocator;
+
+    boost::shared_ptr<TaskArena> m_arena;
+};
+//╚═════════════════════════     ArenaAllocator     ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_TASK_ARENA_HPP
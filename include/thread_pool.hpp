@@ -12,8 +12,33 @@
 #include <boost/thread.hpp>     // threads
 #include <boost/chrono.hpp>     // time_point, milliseconds
 #include <boost/atomic.hpp>     // atomic variables
+#include <boost/scoped_ptr.hpp> // scoped_ptr
+#include <vector>                // vector
+#include <deque>                 // deque
+#include <functional>            // hash
+#include <unordered_map>         // unordered_map
+#include <iterator>              // distance
+#include <utility>               // forward, declval
+#include <type_traits>           // decay
+#include <exception>             // exception_ptr
+#include <stdexcept>             // invalid_argument
+#include <boost/make_shared.hpp> // allocate_shared
+#include <boost/optional.hpp>    // optional
+#include <boost/cstdint.hpp>     // int64_t
+#include <boost/function.hpp>    // function
+#include <boost/bind/bind.hpp>   // bind
+#include <boost/ref.hpp>         // ref, cref
+#include <algorithm>             // sort
+#include <typeinfo>              // typeid
 
 #include "waitable_queue.hpp"
+#include "bucket_queue.hpp"
+#include "task_arena.hpp"
+#include "cpu_topology.hpp"
+#include "timing_wheel.hpp"
+#include "co_task.hpp"
+#include "work_stealing_queue.hpp"
+#include "tracer.hpp"
 
 #if __cplusplus<201103L
 #define noexcept throw()
@@ -27,7 +52,152 @@ namespace project
 class ThreadPool: boost::noncopyable
 {
 public:
-	explicit ThreadPool(size_t numOfThreads);
+	// SHARED_QUEUE: every worker pops from one queue guarded by one mutex.
+	// WORK_STEALING: every worker owns a lane, AddTask calls are spread across
+	//                lanes and idle workers steal from the lanes of busy ones.
+	enum scheduling
+	{
+		SHARED_QUEUE,
+		WORK_STEALING
+	};
+
+	// NO_PLACEMENT: the kernel places workers.
+	// PIN_TO_CPUS: every worker is pinned to one CPU of the set, in turn.
+	// PIN_TO_NUMA_NODES: workers are split evenly over the NUMA nodes and
+	//                    pinned to the CPUs of their node. in WORK_STEALING
+	//                    mode the lanes are split the same way, and workers
+	//                    steal from lanes of their own node first.
+	enum placement
+	{
+		NO_PLACEMENT,
+		PIN_TO_CPUS,
+		PIN_TO_NUMA_NODES
+	};
+
+	// what AddTask, AddTasks and Submit do when the pool is full:
+	// BLOCK: wait for room. a worker runs the tasks itself instead, as
+	//        waiting for its own pool could wait forever.
+	// REJECT: throw QueueFull.
+	// CALLER_RUNS: run the tasks on the calling thread, as a worker would
+	//              (deadlines, stats, reservations). if tasks throw, the
+	//              first exception is rethrown once all of them ran.
+	enum overflow_policy
+	{
+		BLOCK,
+		REJECT,
+		CALLER_RUNS
+	};
+
+	struct Options
+	{
+		Options();
+
+		scheduling schedulingMode;
+		// a waiting priority level is served after being passed over by this
+		// many tasks of higher priority levels (0 disables aging)
+		size_t priorityAgingLimit;
+		// tasks a worker takes off the queue at once; 1 keeps priority order
+		// exact, larger batches pay the queue's lock once per batch
+		size_t workerBatchSize;
+		// room preallocated in the queue for tasks of each priority level
+		size_t initialQueueCapacity;
+
+		// auto-scaling, on when maxThreads is not 0: every scalingInterval
+		// the pool grows (up to maxThreads) if more than scaleUpQueueDepth
+		// tasks per worker are queued, or a task waited in the queue longer
+		// than scaleUpQueueWait. a worker that found no task for keepAlive
+		// retires, as long as at least minThreads remain.
+		size_t minThreads;
+		size_t maxThreads;
+		size_t scaleUpQueueDepth;
+		boost::chrono::milliseconds scaleUpQueueWait;
+		boost::chrono::milliseconds keepAlive;
+		boost::chrono::milliseconds scalingInterval;
+
+		placement placementPolicy;
+		// the CPUs workers may run on; empty takes every online CPU
+		std::vector<int> cpuSet;
+
+		// tick of the timing wheel behind AddTaskAfter, AddTaskAt and
+		// AddPeriodic. timers never fire early, and up to a tick late
+		boost::chrono::milliseconds timerResolution;
+
+		// how idle workers wait for tasks: spinning a while before parking
+		// cuts the latency of tasks that follow each other closely
+		WaitStrategy waitStrategy;
+
+		// the most tasks queued or running at once (0: unbounded), see
+		// overflow_policy. timers, continuations and coroutine resumptions
+		// are never held back, the work they belong to got in already.
+		size_t maxPendingTasks;
+		overflow_policy overflowPolicy;
+
+		// the most spare workers running at once in place of workers blocked
+		// in a BlockingRegion (0: none). a spare parks once the worker it
+		// stood in for is back, and exits after keepAlive parked.
+		size_t maxSpareThreads;
+
+		// load shedding, off when 0: AddTask, AddTasks and Submit throw
+		// Overloaded while the estimated queue wait (GetEstimatedQueueWait)
+		// is longer. tasks added by workers are never shed
+		boost::chrono::milliseconds maxQueueWait;
+
+		// worker reservations, off when empty: reservedThreads[p] workers
+		// (indexed by Task::priority) are kept for tasks of priority p and
+		// above. a worker holds back a task that would leave fewer workers
+		// free than the levels above it reserve, and queues it again once
+		// a worker is done. the levels below a reservation always share at
+		// least one worker. a level whose tasks ran for maxBorrowingRunTime
+		// at most on average borrows reserved workers (0: never), so that
+		// is about how long a reserved level waits for one to come back.
+		// a level that has not run yet has no average, and does not borrow.
+		std::vector<size_t> reservedThreads;
+		boost::chrono::microseconds maxBorrowingRunTime;
+
+		// while it is enabled, every task's ENQUEUE, DEQUEUE, START and
+		// FINISH go to tracer, tagged with its type and priority, and so
+		// does the size of the SHARED_QUEUE. NULL (the default) or disabled
+		// costs a check per event. it must outlive the pool
+		Tracer *tracer;
+	};
+
+	class QueueFull : public std::runtime_error
+	{
+	public:
+		QueueFull();
+	};
+	class Overloaded : public std::runtime_error
+	{
+	public:
+		Overloaded();
+	};
+	// what the future of a task that expired in the queue rethrows
+	class TaskExpired : public std::runtime_error
+	{
+	public:
+		TaskExpired();
+	};
+	// what the future of a task Shutdown dropped rethrows, and what co_await
+	// throws in a coroutine whose resumption it dropped. such a coroutine is
+	// still resumed on a worker, so that it unwinds (and its frame is freed)
+	// instead of leaking
+	class TaskCancelled : public std::runtime_error
+	{
+	public:
+		TaskCancelled();
+	};
+
+	// DRAIN: queued and running tasks get until the deadline to finish.
+	// CANCEL: queued tasks are dropped at once and running ones are asked to
+	//         stop (see IsCancellationRequested) before the deadline.
+	enum shutdown_mode
+	{
+		DRAIN,
+		CANCEL
+	};
+
+	explicit ThreadPool(size_t numOfThreads,
+	                    const Options &options = Options());
 	~ThreadPool();
 
 	class Task
@@ -45,39 +215,500 @@ public:
 		virtual ~Task();
 
 		bool operator<(const Task &other) const noexcept;
+		priority GetPriority() const noexcept;
+		// a task still queued at its deadline is not executed: the worker
+		// that dequeues it calls OnExpired instead. set it before adding
+		// the task. none by default
+		void SetDeadline(boost::chrono::steady_clock::time_point deadline);
+		boost::chrono::steady_clock::time_point GetDeadline() const noexcept;
 	private:
 		friend class ThreadPool;
 
 		virtual void Execute() = 0;
+		// called instead of Execute past the deadline. does nothing by default
+		virtual void OnExpired();
+		// called once Shutdown dropped the task from the queue, before it is
+		// handed back. tasks it holds and added to dropped are dropped in
+		// turn. true keeps the task queued to run anyway, still pending and
+		// not handed back. does nothing (false) by default
+		virtual bool OnDropped(std::vector<boost::shared_ptr<Task> > &dropped);
 		priority m_priority;
+		bool m_isControl; // internal tasks, not counted as pending work
+		// internal tasks only a worker may run (strand turns, coroutine
+		// resumptions): a thread helping a TaskGroup pushes them back
+		bool m_isWorkerOnly;
+		// internal tasks that carry user work of their own (a strand's
+		// tasks): what they carry is recorded instead of them, and Shutdown
+		// drops it and never hands them back
+		bool m_isCarrier;
+		boost::chrono::steady_clock::time_point m_enqueueTime;
+		boost::chrono::steady_clock::time_point m_deadline;
+		// the in-flight flag of the periodic timer adding the task, if any.
+		// cleared once a run is done, or Shutdown dropped the task
+		boost::shared_ptr<boost::atomic<bool> > m_timerInFlight;
+	};
+
+	// a snapshot of the pool's counters. each worker's counters are copied
+	// consistently, and then summed with those of the workers that left.
+	struct Stats
+	{
+		enum
+		{
+			NUM_OF_PRIORITIES = Task::SUPREME + 1,
+			NUM_OF_BUCKETS = 24
+		};
+
+		size_t numOfThreads;
+		size_t busyThreads;
+		size_t blockedThreads;                      // in a BlockingRegion
+		size_t spareThreads;                        // on top of numOfThreads
+		size_t pendingTasks;                        // queued or running
+		size_t tasksExecuted;
+		size_t tasksExpired;                        // dropped at dequeue
+		size_t tasksShed;                           // rejected as Overloaded
+		size_t heldTasks;                           // by reservations, now
+		boost::chrono::nanoseconds queueWaitTime;   // summed over the tasks
+		boost::chrono::nanoseconds busyTime;        // summed over the workers
+		boost::chrono::nanoseconds idleTime;        // summed over the workers
+		// executionTimes[p][b]: tasks of priority p that ran for less than
+		// 2^b microseconds, and at least 2^(b-1). the last bucket takes all
+		// longer runs
+		size_t executionTimes[NUM_OF_PRIORITIES][NUM_OF_BUCKETS];
+		QueueStats queue;
+	};
+
+	template <class R> class Future;
+	class TaskGroup;
+	class Strand;
+	template <class Key, class Hash = std::hash<Key> > class StrandMap;
+	template <class F>
+	struct ResultOf
+	{
+		typedef decltype(std::declval<typename std::decay<F>::type &>()()) type;
+	};
+	// what func(future) returns, for Future<R>::Then
+	template <class F, class R>
+	struct ContinuationResult
+	{
+		typedef decltype(std::declval<typename std::decay<F>::type &>()(
+		                                   std::declval<Future<R> >())) type;
 	};
 
 	void AddTask(boost::shared_ptr<Task> newTask);
+	// adds a range of shared_ptr<Task> with a single lock and wakeup
+	template <class ForwardIt>
+	void AddTasks(ForwardIt first, ForwardIt last);
+	// runs func() on the pool. func is moved into the task itself, and the
+	// task doubles as the state of the returned future, so the whole
+	// submission costs a single allocation
+	template <class F>
+	Future<typename ResultOf<F>::type> Submit(F &&func,
+	                                   Task::priority priority = Task::MEDIUM);
+	// the same, but func is dropped if it is still queued at the deadline,
+	// and the future rethrows TaskExpired
+	template <class F>
+	Future<typename ResultOf<F>::type> Submit(F &&func,
+	                          boost::chrono::steady_clock::time_point deadline,
+	                          Task::priority priority = Task::MEDIUM);
+	// allocates a task (and its control block) from the pool's arena
+	template <class T, class... Args>
+	boost::shared_ptr<T> MakeTask(Args&&... args);
+	// a future that becomes ready once every future of the range is, with a
+	// result or an exception. nothing blocks on the inputs: the last of them
+	// to become ready completes it
+	template <class InputIt>
+	Future<void> WhenAll(InputIt first, InputIt last);
+	// a future of the index (in the range) of the first input to be ready.
+	// throws invalid_argument on an empty range
+	template <class InputIt>
+	Future<size_t> WhenAny(InputIt first, InputIt last);
+
+	// algorithms over the integral indices [first, last). the range is split
+	// in halves down to chunks of grain indices (0 picks a grain that makes
+	// about four chunks per worker), every right half becomes a task of one
+	// TaskGroup, and the calling thread runs chunks as well until all are
+	// done. the first exception a chunk throws is rethrown.
+	// body(i) for every index
+	template <class Index, class Body>
+	void ParallelFor(Index first, Index last, Body body, size_t grain = 0);
+	// combine(...combine(combine(identity, map(first)), map(first + 1))...),
+	// in index order but grouped per chunk, so combine must be associative
+	template <class Index, class T, class Map, class Combine>
+	T ParallelReduce(Index first, Index last, T identity, Map map,
+	                 Combine combine, size_t grain = 0);
+	// out[i] = func(first[i]) over random access iterators. returns the end
+	// of the output range
+	template <class RandomIt, class OutputIt, class Func>
+	OutputIt ParallelTransform(RandomIt first, RandomIt last, OutputIt out,
+	                           Func func, size_t grain = 0);
+
+#if defined(__cpp_impl_coroutine)
+	// co_await pool.Schedule() suspends the calling coroutine and resumes it
+	// on a worker, queued like a task of the given priority
+	class ScheduleAwaiter;
+	ScheduleAwaiter Schedule(Task::priority priority = Task::MEDIUM);
+	// runs task on a worker and returns the future of its result
+	template <class T>
+	Future<T> Spawn(CoTask<T> task, Task::priority priority = Task::MEDIUM);
+#endif
+	TaskArena::Stats GetAllocatorStats() const;
+	Stats GetStats() const;
+	// how long a task added now would wait for a worker: the queued tasks
+	// times the recent average run time, over the number of threads
+	boost::chrono::nanoseconds GetEstimatedQueueWait() const;
+
+	// timers hold no worker: once due, the task is added like AddTask does.
+	// a periodic task is added every interval (the first time after one
+	// interval). a tick that finds its previous run still queued or running
+	// is skipped, so the runs never overlap. a task may be on one periodic
+	// timer at a time.
+	typedef boost::uint64_t timer_id;
+	timer_id AddTaskAfter(boost::chrono::nanoseconds delay,
+	                      boost::shared_ptr<Task> task);
+	timer_id AddTaskAt(boost::chrono::steady_clock::time_point time,
+	                   boost::shared_ptr<Task> task);
+	timer_id AddPeriodic(boost::chrono::nanoseconds interval,
+	                     boost::shared_ptr<Task> task);
+	// false if the timer already fired (periodic ones never do) or was
+	// cancelled before
+	bool CancelTimer(timer_id id);
+
+	// returns true as soon as no task is queued or running, or false once the
+	// deadline passes first
+	bool Drain(boost::chrono::steady_clock::time_point deadline);
+	// stops all work per mode without tearing the workers down, and returns
+	// the tasks that did not complete: the ones dropped from the queue and
+	// the ones still running at the deadline, which are asked to stop as in
+	// CANCEL. the futures of the dropped tasks rethrow TaskCancelled, and
+	// the tasks are not run if added again. the pool stays usable.
+	std::vector<boost::shared_ptr<Task> > Shutdown(shutdown_mode mode,
+	                         boost::chrono::steady_clock::time_point deadline);
+	// Shutdown(CANCEL, now + timeout)
 	void Stop(boost::chrono::milliseconds timeout);
-	void Pause() noexcept;
+	// polled by long running tasks: true once the pool running the calling
+	// task asked it to stop
+	static bool IsCancellationRequested();
+	// declared on the stack of a task around code that blocks (I/O, waiting
+	// on a future or a lock): while the worker's outermost region lasts, a
+	// spare worker keeps the pool's parallelism, see Options::maxSpareThreads.
+	// does nothing on a thread that is not a worker
+	class BlockingRegion;
+	// runs func() inside a BlockingRegion and returns what it returns
+	template <class F>
+	static typename ResultOf<F>::type RunBlocking(F &&func);
+	// workers finish the tasks they already hold, then park before taking
+	// another one. the deadline overload also waits, until every worker is
+	// parked (true) or the deadline passes (false).
+	void Pause();
+	bool Pause(boost::chrono::steady_clock::time_point deadline);
 	void Resume() noexcept;
 	void SetNumOfThreads(size_t newNumOfThreads);
+	// spare workers not included
 	size_t GetNumOfThreads() const;
 
 private:
+	template <class R> struct ResultStorage;
+	template <class R> class FutureState;
+	template <class F, class R> class CallableTask;
+	template <class F, class R> class ContinuationCall;
+	class StrandState;
+	class StrandTurn;
+	class WhenAllState;
+	class WhenAnyState;
+#if defined(__cpp_impl_coroutine)
+	class ResumeTask;
+	template <class R> class SpawnState;
+	template <class R> class FutureAwaiter;
+	struct DetachedCoroutine;
+
+	template <class T>
+	static DetachedCoroutine RunSpawned(ThreadPool *pool, CoTask<T> task,
+	                                    boost::shared_ptr<SpawnState<T> > state,
+	                                    Task::priority priority);
+#endif
+
+	// one FIFO per Task::priority, plus the sentinel levels of VoidTask below
+	// LOW and of PauseTask above SUPREME
+	struct TaskLevels
+	{
+		enum
+		{
+			NUM_LEVELS = Task::SUPREME + 3,
+			FIRST_AGING_LEVEL = Task::LOW + 1
+		};
+		static size_t Level(const boost::shared_ptr<Task> &task);
+	};
+	typedef BucketQueue<boost::shared_ptr<Task>, TaskLevels> task_container;
+
 	boost::atomic<bool> m_threadsArePaused;
+	size_t m_numOfParkedThreads; // guarded by m_conditionVariableMutex
+	boost::shared_ptr<TaskArena> m_arena;
+	// pushed once per worker on Pause, to get workers blocked on an empty
+	// queue to the pause gate
+	boost::shared_ptr<Task> m_pauseTask;
+
+	WaitableQueue<boost::shared_ptr<Task>, task_container> m_TaskQueue;
+	// non-null only in WORK_STEALING mode, in which case it replaces m_TaskQueue
+	boost::scoped_ptr<WorkStealingQueue<boost::shared_ptr<Task>,
+	                                    task_container> > m_stealingQueue;
+	boost::atomic<size_t> m_nextLane;
+	size_t m_workerBatchSize;
+	// the CPUs of every lane (or worker, in SHARED_QUEUE mode) in turn;
+	// empty when workers are not pinned
+	std::vector<CpuTopology::cpu_list> m_placements;
+
+	// written by its worker only. m_sequence is odd while an update is in
+	// progress, so a reader knows to retry its copy
+	struct WorkerStats
+	{
+		WorkerStats();
+
+		boost::atomic<size_t> m_sequence;
+		boost::atomic<size_t> m_tasksExecuted;
+		boost::atomic<boost::int64_t> m_queueWaitTime;
+		boost::atomic<boost::int64_t> m_busyTime;
+		boost::atomic<boost::int64_t> m_idleTime;
+		boost::atomic<size_t> m_executionTimes[Stats::NUM_OF_PRIORITIES]
+		                                      [Stats::NUM_OF_BUCKETS];
+	};
+
+	enum { CACHE_LINE = 64 };
+
+	struct Worker
+	{
+		Worker() : m_cancelRequested(false) {}
+
+		boost::shared_ptr<boost::thread> m_thread;
+		boost::mutex m_currentMutex;
+		boost::shared_ptr<Task> m_current; // the task it runs, if any
+		boost::atomic<bool> m_cancelRequested;
+		char m_padding0[CACHE_LINE];
+		WorkerStats m_stats;
+		char m_padding1[CACHE_LINE];
+	};
+	typedef std::map<boost::thread::id,boost::shared_ptr<Worker> > thread_map;
+	thread_map m_ThreadGroup;
+
+	// user tasks queued or running, and the signal that it dropped to zero
+	boost::atomic<size_t> m_pendingTasks;
+
+	// deadlines and load shedding
+	const boost::chrono::nanoseconds m_queueWaitLimit;
+	boost::atomic<boost::int64_t> m_avgRunTime; // ns, moving average
+	boost::atomic<size_t> m_tasksExpired;
+	boost::atomic<size_t> m_tasksShed;
+	Tracer *const m_tracer;
+	// m_ThreadGroup.size(), readable without m_mapMutex
+	boost::atomic<size_t> m_numOfLiveThreads;
+
+	// worker reservations. m_reservedFrom[p]: workers reserved for tasks of
+	// priority p and above. the rest is guarded by m_reserveMutex
+	size_t m_reservedFrom[Stats::NUM_OF_PRIORITIES];
+	bool m_hasReservations;
+	const boost::chrono::nanoseconds m_maxBorrowingRunTime;
+	boost::atomic<boost::int64_t> m_avgRunTimeOf[Stats::NUM_OF_PRIORITIES];
+	boost::atomic<size_t> m_numOfRunsOf[Stats::NUM_OF_PRIORITIES]; // sampled
+	size_t m_numOfRunning[Stats::NUM_OF_PRIORITIES]; // per priority level
+	task_container m_heldTasks;
+	mutable boost::mutex m_reserveMutex;
+
+	// managed blocking, guarded by m_mapMutex. spare threads are in the
+	// thread map, but are not counted by GetNumOfThreads
+	const size_t m_maxSpareThreads;
+	size_t m_numOfSpareThreads;
+	size_t m_numOfBlockedWorkers;
+	size_t m_numOfCompensated;   // blocked workers that have a spare
+	size_t m_numOfParkedSpares;
+	size_t m_numOfSpareWakeups;  // handed to parked spares, not yet taken
+	bool m_isShuttingDown;
+	// threads that are to park, as their blocked worker is back. readable
+	// without the lock, so a worker checks it between tasks for free
+	boost::atomic<size_t> m_numOfSurplus;
+	boost::condition_variable m_spareSignal;
+
+	// backpressure
+	const size_t m_maxPendingTasks;
+	const overflow_policy m_overflowPolicy;
+	boost::atomic<size_t> m_numOfBlockedProducers;
+	boost::mutex m_roomMutex;
+	boost::condition_variable m_roomSignal;
+
+	// auto-scaling
+	const size_t m_minThreads;
+	const size_t m_maxThreads;
+	const size_t m_scaleUpQueueDepth;
+	const boost::chrono::nanoseconds m_scaleUpQueueWait;
+	const boost::chrono::nanoseconds m_keepAlive;
+	const boost::chrono::nanoseconds m_scalingInterval;
+	boost::atomic<size_t> m_busyThreads;
+	boost::atomic<boost::int64_t> m_maxQueueWait; // ns, since the last check
+	bool m_scalerIsRunning;                       // guarded by m_mapMutex
+	Stats m_retiredStats;                         // m_mapMutex too
+	// tasks run by threads off the pool. m_callerStatsMutex serializes them
+	WorkerStats m_callerStats;
+	boost::mutex m_callerStatsMutex;
+	std::vector<boost::shared_ptr<Worker> > m_retiredWorkers; // m_mapMutex too
+	boost::mutex m_scalerMutex;
+	boost::condition_variable m_scalerSignal;
+	boost::scoped_ptr<boost::thread> m_scalerThread;
+
+	// timers. the wheel and its thread are only created with the first timer
+	struct TimerRecord
+	{
+		boost::shared_ptr<Task> m_task;
+		timer_id m_id;
+		boost::uint64_t m_dueTick;
+		boost::uint64_t m_interval;    // in ticks, 0 for a one-shot timer
+		bool m_isCancelled;            // guarded by m_timerMutex
+		// periodic timers: the task is queued or running. shared with it,
+		// as the record may be gone by the time the run is done
+		boost::shared_ptr<boost::atomic<bool> > m_isInFlight;
+	};
+	typedef TimingWheel<boost::shared_ptr<TimerRecord> > timer_wheel;
 
-	WaitableQueue<boost::shared_ptr<Task>,
-					      PriorityQueue<boost::shared_ptr<Task> > > m_TaskQueue;
-	std::map<boost::thread::id,boost::shared_ptr<boost::thread> > m_ThreadGroup;
+	const boost::chrono::steady_clock::time_point m_timerEpoch;
+	const boost::chrono::nanoseconds m_timerResolution;
+	boost::mutex m_timerMutex;
+	boost::condition_variable m_timerSignal;
+	boost::scoped_ptr<timer_wheel> m_timers;
+	std::unordered_map<timer_id, boost::shared_ptr<TimerRecord> > m_activeTimers;
+	timer_id m_nextTimerId;
+	bool m_timersAreRunning;
+	boost::scoped_ptr<boost::thread> m_timerThread;
+	boost::mutex m_idleMutex;
+	boost::condition_variable m_idleSignal;
 
 	mutable boost::mutex m_mapMutex;
 	mutable boost::mutex m_conditionVariableMutex;
 
 	boost::condition_variable m_conditionVariable;
+	boost::condition_variable m_parkedSignal;
 
-	void InitAndRunThread();
+	typedef std::vector<boost::shared_ptr<Task> > task_batch;
 
-	void KillAllThreads();
+	void InitAndRunThread(boost::shared_ptr<Worker> worker);
+	void InitPlacement(const Options &options, size_t numOfSlots);
+	void InitReservations(const Options &options);
+
+	// counts the tasks as pending without admission control, for work that
+	// was admitted already
+	void EnqueueTask(boost::shared_ptr<Task> task);
+	template <class ForwardIt>
+	void EnqueueTasks(ForwardIt first, ForwardIt last);
+	// reserves room for numOfTasks pending tasks per the overflow policy.
+	// false if the caller is to run them itself
+	bool AdmitTasks(size_t numOfTasks);
+	// throws Overloaded past Options::maxQueueWait
+	void ShedIfOverloaded(size_t numOfTasks);
+	bool TryReserve(size_t numOfTasks);
+	// stamps counted tasks and pushes them
+	template <class ForwardIt>
+	void QueueTasks(ForwardIt first, ForwardIt last);
+	// queues the turn of a strand that just got its first task
+	void StartStrand(boost::shared_ptr<StrandState> state,
+	                 Task::priority priority);
+	void PushTask(boost::shared_ptr<Task> task);
+	void PushTasks(task_batch::const_iterator first,
+	               task_batch::const_iterator last);
+	// false if auto-scaling is on and no task came within the keep-alive
+	bool PopTasks(task_batch &out, size_t lane);
+	template <class ForwardIt>
+	void PushTaskRange(ForwardIt first, ForwardIt last);
+	bool RunTask(Worker &worker, const boost::shared_ptr<Task> &task);
+	// runs a user task a worker was claimed for, on the calling thread: the
+	// deadline, stats, tracing and reservations of a worker's run, and counts
+	// it done. rethrows what the task threw once that is over
+	void RunClaimed(const boost::shared_ptr<Task> &task, bool countAsBusy);
+	// the part of RunClaimed every task run gets, a strand's tasks included:
+	// the deadline, stats and tracing. returns what the task threw
+	std::exception_ptr RunMeasured(Task &task);
+	// the overflow policy's CALLER_RUNS, and a worker's own tasks under BLOCK
+	void RunOnCaller(const boost::shared_ptr<Task> &task);
+	// into the calling worker's stats, or m_callerStats off the pool
+	void RecordRun(const Task &task, boost::chrono::nanoseconds queueWait,
+	               boost::chrono::nanoseconds runTime);
+	// executes the task, or expires it if it is past its deadline at now.
+	// false if it expired
+	bool ExecuteOrExpire(Task &task,
+	                     boost::chrono::steady_clock::time_point now);
+	// the priority of the task the calling thread runs, MEDIUM outside of
+	// tasks. what a coroutine resumes at after co_await on a future
+	static Task::priority GetCurrentPriority();
+	void NoteRunTime(Task::priority priority,
+	                 boost::chrono::nanoseconds runTime);
+	// records the event if tracing is on. control tasks are left out
+	void TraceTask(Tracer::event_type type, const Task &task);
+	// takes a worker for the task as its reservations allow. if they do not,
+	// the task is held back until ReleaseWorker queues it again. a worker
+	// running the task in its own place (isOwnWorker) takes none: its task
+	// was allowed one already, and holding the nested one could wait for it
+	bool ClaimWorker(const boost::shared_ptr<Task> &task, bool isOwnWorker);
+	void ReleaseWorker(Task::priority priority);
+	// queues again every held task that can start now
+	void ReleaseHeldTasks();
+	// whether a task of the priority may take a worker now.
+	// m_reserveMutex held
+	bool CanStart(Task::priority priority) const;
+	// runs one queued user task on the calling thread, for TaskGroup::Wait,
+	// skipping the worker-only ones unless it is a worker. false if none was
+	// queued (or the pool is paused). rethrows what the task threw
+	bool RunQueuedTask();
+	size_t GrainOf(size_t numOfIndices, size_t grain) const;
+	// runs chunk(first, last) on [first, last) cut to grain, pushing the
+	// right halves to group and running the leftmost chunk itself
+	template <class Index, class Chunk>
+	void SplitRange(TaskGroup &group, Index first, Index last, size_t grain,
+	                const Chunk &chunk);
+	void WaitAtPauseGate();
+	bool GetOwnLane(size_t &lane) const;
+	void TasksDone(size_t numOfTasks);
+	bool WaitForPendingTasks(boost::chrono::steady_clock::time_point deadline);
+	void RemoveQueuedTasks(task_batch &removed);
+	void RequestCancellation();
+	void CollectRunningTasks(task_batch &running);
+	void EndCancellation();
+
+	bool IsAutoScaling() const;
+	void RunAutoScaler();
+	void StopAutoScaler();
+	void ScaleUp();
+	void NoteQueueWait(boost::chrono::nanoseconds wait);
+	bool TryRetire();
+	// under m_mapMutex: the calling worker leaves the map, to be joined
+	void RetireCurrentThread();
+	void JoinRetiredThreads();
+
+	static void BeginBlocking();
+	static void EndBlocking();
+	// counts a worker that starts blocking, and wakes or starts a spare for
+	// it. false if it got none
+	bool AddSpare();
+	void RemoveSpare(bool hasSpare);
+	// parks a surplus thread until a worker blocks again. false if the
+	// thread is to end
+	bool ParkSpare();
+	size_t GetNumOfAwakeThreads() const;
+
+	static void RecordIdleTime(WorkerStats &stats,
+	                           boost::chrono::nanoseconds idleTime);
+	static void RecordTask(WorkerStats &stats, const Task &task,
+	                       boost::chrono::nanoseconds queueWait,
+	                       boost::chrono::nanoseconds runTime);
+	static void AddWorkerStats(Stats &total, const WorkerStats &stats);
+	static size_t BucketOf(boost::chrono::nanoseconds runTime);
+
+	timer_id AddTimer(boost::chrono::steady_clock::time_point dueTime,
+	                  boost::chrono::nanoseconds interval,
+	                  boost::shared_ptr<Task> task);
+	void RunTimers();
+	void StopTimers();
+	boost::uint64_t TickOf(boost::chrono::steady_clock::time_point time) const;
+	boost::chrono::steady_clock::time_point TimeOf(boost::uint64_t tick) const;
 
 	void AddThreads(size_t threadAmountToAdd);
+	void StartWorker(); // under m_mapMutex
 	void ReducePoolSize(size_t threadAmountToReduce);
-	boost::shared_ptr<boost::thread> EraseThread(boost::thread::id id);
+	boost::shared_ptr<Worker> EraseThread(boost::thread::id id);
 	void JoinAllThreads();
 	void AddCloseThreadTask(boost::shared_ptr
 	                              <boost::promise<boost::thread::id> > promise);
@@ -102,8 +733,1121 @@ private:
 	private:
 		virtual void Execute();
 	};
+	class PauseTask : public Task
+	{
+	public:
+		explicit PauseTask();
+		virtual ~PauseTask() = default;
+
+	private:
+		virtual void Execute();
+	};
 };
 
+class ThreadPool::BlockingRegion : boost::noncopyable
+{
+public:
+	BlockingRegion();
+	~BlockingRegion();
+};
+
+//╔════════════════════════    ThreadPool::Future    ══════════════════════════╗
+template <class R>
+class ThreadPool::Future
+{
+public:
+	Future() : m_pool(NULL) {}
+	Future(boost::shared_ptr<FutureState<R> > state, ThreadPool *pool);
+
+	bool IsValid() const;
+	bool IsReady() const;
+	// a wait on a worker is a BlockingRegion, a spare runs meanwhile
+	void Wait() const;
+	bool WaitFor(boost::chrono::milliseconds timeout) const;
+	// waits for the result and moves it out (or rethrows what the callable
+	// threw). may be called once.
+	R Get();
+	// runs func(future) on the pool once this future is ready, and returns
+	// the future of what it returns. no thread waits in between: the task is
+	// added by the thread that completes this future, a worker adds it to its
+	// own lane. a task with several predecessors is WhenAll(...).Then(func)
+	template <class F>
+	Future<typename ContinuationResult<F, R>::type> Then(F &&func,
+	                                   Task::priority priority = Task::MEDIUM);
+#if defined(__cpp_impl_coroutine)
+	// suspends the awaiting coroutine until the future is ready, then
+	// resumes it on a worker with the result of Get()
+	FutureAwaiter<R> operator co_await();
+#endif
+
+private:
+	friend class ThreadPool;
+
+	boost::shared_ptr<FutureState<R> > m_state;
+	ThreadPool *m_pool;
+};
+
+template <class R>
+struct ThreadPool::ResultStorage
+{
+	template <class F>
+	void Store(F &func)
+	{
+		m_value = func();
+	}
+	R Take()
+	{
+		return std::move(*m_value);
+	}
+	boost::optional<R> m_value;
+};
+
+template <>
+struct ThreadPool::ResultStorage<void>
+{
+	template <class F>
+	void Store(F &func)
+	{
+		func();
+	}
+	void Take()
+	{
+		// empty
+	}
+};
+
+template <class R>
+class ThreadPool::FutureState : boost::noncopyable
+{
+public:
+	FutureState() : m_isReady(false) {}
+	virtual ~FutureState() = default;
+
+	bool IsReady() const;
+	void Wait() const;
+	bool WaitFor(boost::chrono::milliseconds timeout) const;
+	R Get();
+	// continuation runs on the thread that makes the state ready, or at once
+	// if it already is. it should be short, as adding a task is
+	void OnReady(boost::function<void()> continuation);
+
+protected:
+	template <class F>
+	void Run(F &func);
+
+private:
+	mutable boost::mutex m_mutex;
+	mutable boost::condition_variable m_readySignal;
+	boost::atomic<bool> m_isReady;
+	std::exception_ptr m_exception;
+	ResultStorage<R> m_result;
+	std::vector<boost::function<void()> > m_continuations; // until ready
+};
+
+template <class F, class R>
+class ThreadPool::CallableTask : public Task, public FutureState<R>
+{
+public:
+	template <class Func>
+	CallableTask(Func &&func, priority taskPriority)
+	            : Task(taskPriority), m_func(std::forward<Func>(func)) {}
+	virtual ~CallableTask() = default;
+
+private:
+	virtual void Execute()
+	{
+		if (!this->IsReady()) // dropped already
+		{
+			this->Run(m_func);
+		}
+	}
+	virtual void OnExpired()
+	{
+		auto expire = []() -> R { throw TaskExpired(); };
+		this->Run(expire);
+	}
+	virtual bool OnDropped(std::vector<boost::shared_ptr<Task> > &)
+	{
+		auto cancel = []() -> R { throw TaskCancelled(); };
+		this->Run(cancel);
+		return false;
+	}
+	F m_func;
+};
+
+// the callable of a Then task: hands the ready input future to func
+template <class F, class R>
+class ThreadPool::ContinuationCall
+{
+public:
+	template <class Func>
+	ContinuationCall(Func &&func, const Future<R> &input)
+	                        : m_func(std::forward<Func>(func)), m_input(input) {}
+
+	typename ContinuationResult<F, R>::type operator()()
+	{
+		return m_func(std::move(m_input));
+	}
+
+private:
+	F m_func;
+	Future<R> m_input;
+};
+
+// completed by whichever input arrives last. counts one extra input for
+// WhenAll itself, so it cannot complete before every input is registered
+class ThreadPool::WhenAllState : public FutureState<void>
+{
+public:
+	explicit WhenAllState(size_t numOfInputs) : m_left(numOfInputs + 1) {}
+
+	void Arrive()
+	{
+		if (0 == --m_left)
+		{
+			auto nothing = []{};
+			this->Run(nothing);
+		}
+	}
+
+private:
+	boost::atomic<size_t> m_left;
+};
+
+class ThreadPool::WhenAnyState : public FutureState<size_t>
+{
+public:
+	WhenAnyState() : m_isDone(false) {}
+
+	void Arrive(size_t index)
+	{
+		if (!m_isDone.exchange(true))
+		{
+			auto result = [index]{ return index; };
+			this->Run(result);
+		}
+	}
+
+private:
+	boost::atomic<bool> m_isDone;
+};
+//╚════════════════════════    ThreadPool::Future    ══════════════════════════╝
+
+//╔══════════════════════    ThreadPool::TaskGroup    ═════════════════════════╗
+/******************************************************************************
+ * tasks to be waited for together. Wait runs queued tasks of the pool (any of
+ * them) on the waiting thread for as long as the group is not done, so a task
+ * that waits for the group it spawned keeps its worker busy instead of
+ * blocking it. the destructor waits too, but rethrows nothing.
+ * a task Shutdown dropped counts as done, and Wait rethrows TaskCancelled.
+ ******************************************************************************/
+class ThreadPool::TaskGroup : boost::noncopyable
+{
+public:
+	explicit TaskGroup(ThreadPool &pool);
+	~TaskGroup();
+
+	template <class F>
+	void Run(F &&func, Task::priority priority = Task::MEDIUM);
+	// rethrows the first exception a task of the group threw, if any
+	void Wait();
+
+private:
+	// counts the task of state done, with what it threw
+	template <class R>
+	void Arrive(FutureState<R> *state);
+	void Done(std::exception_ptr exception);
+	void WaitForTasks();
+
+	ThreadPool &m_pool;
+	boost::mutex m_mutex;
+	boost::condition_variable m_doneSignal;
+	size_t m_numOfPending;            // guarded by m_mutex
+	size_t m_numOfQueued;             // m_mutex too, ever
+	std::exception_ptr m_exception;   // m_mutex too
+};
+//╚══════════════════════    ThreadPool::TaskGroup    ═════════════════════════╝
+
+//╔════════════════════════    ThreadPool::Strand    ══════════════════════════╗
+/******************************************************************************
+ * a serial executor: the tasks posted to a strand run one at a time, in the
+ * order they were posted, while different strands run in parallel.
+ * a strand owns no thread. its first task queues a turn on the pool, and the
+ * turn runs the strand's tasks until none are left (or it ran a batch of
+ * them, then it queues a new turn behind the other work). the strand's lock
+ * is held only to queue and dequeue, never while a task runs.
+ * tasks still queued when a Strand is destroyed run all the same, though
+ * Shutdown drops them (and hands them back) like any queued task.
+ * strand tasks are not held back by Options::maxPendingTasks.
+ ******************************************************************************/
+class ThreadPool::Strand : boost::noncopyable
+{
+public:
+	explicit Strand(ThreadPool &pool, Task::priority priority = Task::MEDIUM);
+	~Strand() = default;
+
+	template <class F>
+	Future<typename ResultOf<F>::type> Post(F &&func);
+
+private:
+	class OwnState;
+
+	ThreadPool &m_pool;
+	const Task::priority m_priority;
+	boost::shared_ptr<OwnState> m_state;
+};
+
+/******************************************************************************
+ * a strand per key, made on the key's first Post and dropped as soon as it
+ * ran out of tasks, so idle keys cost nothing and there may be any number of
+ * them. keys hash to shards, each a map under its own lock, so posts to
+ * different keys rarely contend. tasks still queued when the map is
+ * destroyed run all the same.
+ ******************************************************************************/
+template <class Key, class Hash>
+class ThreadPool::StrandMap : boost::noncopyable
+{
+public:
+	enum { DEFAULT_SHARDS = 64 };
+
+	explicit StrandMap(ThreadPool &pool,
+	                   Task::priority priority = Task::MEDIUM,
+	                   size_t numOfShards = DEFAULT_SHARDS);
+	~StrandMap() = default;
+
+	template <class F>
+	Future<typename ResultOf<F>::type> Post(const Key &key, F &&func);
+	// strands with tasks queued or running
+	size_t GetNumOfActiveStrands() const;
+
+private:
+	class KeyedState;
+	struct Shard
+	{
+		boost::mutex m_mutex;
+		std::unordered_map<Key, boost::shared_ptr<KeyedState>, Hash>
+		                                                        m_strands;
+	};
+
+	ThreadPool &m_pool;
+	const Task::priority m_priority;
+	Hash m_hash;
+	// the strands share their shard, which outlives the map while they run
+	std::vector<boost::shared_ptr<Shard> > m_shards;
+};
+
+// the queue of a strand and the lock that guards it
+class ThreadPool::StrandState : boost::noncopyable
+{
+public:
+	StrandState() : m_isScheduled(false) {}
+	virtual ~StrandState() = default;
+
+	virtual boost::mutex &GetMutex() = 0;
+	// under the mutex. true if the strand was idle, and needs a turn
+	bool Push(boost::shared_ptr<Task> task);
+	// under the mutex. the next task, or NULL once the strand is idle again
+	boost::shared_ptr<Task> Pop();
+	// under the mutex, as Shutdown drops the queued turn. hands every task
+	// to out, and leaves the strand idle for the next Push to schedule
+	void PopAll(std::vector<boost::shared_ptr<Task> > &out);
+
+private:
+	// under the mutex, as the strand goes idle
+	virtual void OnIdle();
+
+	std::deque<boost::shared_ptr<Task> > m_tasks;
+	bool m_isScheduled; // a turn is queued or running
+};
+
+class ThreadPool::Strand::OwnState : public StrandState
+{
+public:
+	virtual boost::mutex &GetMutex()
+	{
+		return m_mutex;
+	}
+
+private:
+	boost::mutex m_mutex;
+};
+
+template <class Key, class Hash>
+class ThreadPool::StrandMap<Key, Hash>::KeyedState : public StrandState
+{
+public:
+	KeyedState(const boost::shared_ptr<Shard> &shard, const Key &key)
+	                                            : m_shard(shard), m_key(key) {}
+
+	virtual boost::mutex &GetMutex()
+	{
+		return m_shard->m_mutex;
+	}
+
+private:
+	virtual void OnIdle()
+	{
+		m_shard->m_strands.erase(m_key); // the running turn still holds us
+	}
+
+	boost::shared_ptr<Shard> m_shard;
+	Key m_key;
+};
+
+// runs the tasks of a strand, up to a batch of them per turn
+class ThreadPool::StrandTurn : public Task
+{
+public:
+	StrandTurn(ThreadPool *pool, boost::shared_ptr<StrandState> state,
+	           priority taskPriority);
+	virtual ~StrandTurn() = default;
+
+private:
+	virtual void Execute();
+	virtual bool OnDropped(std::vector<boost::shared_ptr<Task> > &dropped);
+
+	ThreadPool *m_pool;
+	boost::shared_ptr<StrandState> m_state;
+};
+//╚════════════════════════    ThreadPool::Strand    ══════════════════════════╝
+
+//╔══════════════════════    ThreadPool(templates)    ═════════════════════════╗
+template <class F>
+ThreadPool::Future<typename ThreadPool::ResultOf<F>::type>
+ThreadPool::Submit(F &&func, Task::priority priority)
+{
+	typedef typename std::decay<F>::type func_type;
+	typedef typename ResultOf<F>::type result_type;
+
+	boost::shared_ptr<CallableTask<func_type, result_type> > task =
+	    MakeTask<CallableTask<func_type, result_type> >(std::forward<F>(func),
+	                                                    priority);
+	AddTask(task);
+
+	return Future<result_type>(task, this);
+}
+
+template <class F>
+ThreadPool::Future<typename ThreadPool::ResultOf<F>::type>
+ThreadPool::Submit(F &&func, boost::chrono::steady_clock::time_point deadline,
+                   Task::priority priority)
+{
+	typedef typename std::decay<F>::type func_type;
+	typedef typename ResultOf<F>::type result_type;
+
+	boost::shared_ptr<CallableTask<func_type, result_type> > task =
+	    MakeTask<CallableTask<func_type, result_type> >(std::forward<F>(func),
+	                                                    priority);
+	task->SetDeadline(deadline);
+	AddTask(task);
+
+	return Future<result_type>(task, this);
+}
+
+template <class InputIt>
+ThreadPool::Future<void> ThreadPool::WhenAll(InputIt first, InputIt last)
+{
+	boost::shared_ptr<WhenAllState> state = boost::allocate_shared<
+	                                WhenAllState>(ArenaAllocator<WhenAllState>(
+	                                m_arena), std::distance(first, last));
+	for (; first != last; ++first)
+	{
+		first->m_state->OnReady(boost::bind(&WhenAllState::Arrive, state));
+	}
+	state->Arrive(); // WhenAll's own share
+
+	return Future<void>(state, this);
+}
+
+template <class InputIt>
+ThreadPool::Future<size_t> ThreadPool::WhenAny(InputIt first, InputIt last)
+{
+	if (first == last)
+	{
+		throw std::invalid_argument("WhenAny of no futures");
+	}
+
+	boost::shared_ptr<WhenAnyState> state = boost::allocate_shared<
+	                                WhenAnyState>(ArenaAllocator<WhenAnyState>(
+	                                m_arena));
+	for (size_t index = 0; first != last; ++first, ++index)
+	{
+		first->m_state->OnReady(boost::bind(&WhenAnyState::Arrive, state,
+		                                    index));
+	}
+
+	return Future<size_t>(state, this);
+}
+
+template <class Index, class Body>
+void ThreadPool::ParallelFor(Index first, Index last, Body body, size_t grain)
+{
+	if (!(first < last))
+	{
+		return;
+	}
+
+	auto chunk = [&body](Index begin, Index end)
+	{
+		for (; begin != end; ++begin)
+		{
+			body(begin);
+		}
+	};
+	TaskGroup group(*this);
+	SplitRange(group, first, last,
+	           GrainOf(static_cast<size_t>(last - first), grain), chunk);
+	group.Wait();
+}
+
+template <class Index, class T, class Map, class Combine>
+T ThreadPool::ParallelReduce(Index first, Index last, T identity, Map map,
+                             Combine combine, size_t grain)
+{
+	if (!(first < last))
+	{
+		return identity;
+	}
+
+	// partial results keyed by the first index of their chunk
+	std::vector<std::pair<Index, T> > partials;
+	boost::mutex partialsMutex;
+	auto chunk = [&](Index begin, Index end)
+	{
+		T partial = identity;
+		for (Index i = begin; i != end; ++i)
+		{
+			partial = combine(std::move(partial), map(i));
+		}
+
+		boost::unique_lock<boost::mutex> lock(partialsMutex);
+		partials.push_back(std::make_pair(begin, std::move(partial)));
+	};
+	TaskGroup group(*this);
+	SplitRange(group, first, last,
+	           GrainOf(static_cast<size_t>(last - first), grain), chunk);
+	group.Wait();
+
+	std::sort(partials.begin(), partials.end(),
+	          [](const std::pair<Index, T> &left,
+	             const std::pair<Index, T> &right)
+	          { return left.first < right.first; });
+	T result = std::move(identity);
+	for (size_t i = 0; i < partials.size(); ++i)
+	{
+		result = combine(std::move(result), std::move(partials[i].second));
+	}
+
+	return result;
+}
+
+template <class RandomIt, class OutputIt, class Func>
+OutputIt ThreadPool::ParallelTransform(RandomIt first, RandomIt last,
+                                       OutputIt out, Func func, size_t grain)
+{
+	size_t numOfItems = static_cast<size_t>(last - first);
+	ParallelFor(static_cast<size_t>(0), numOfItems, [&](size_t i)
+	{
+		out[i] = func(first[i]);
+	}, grain);
+
+	return out + numOfItems;
+}
+
+template <class Index, class Chunk>
+void ThreadPool::SplitRange(TaskGroup &group, Index first, Index last,
+                            size_t grain, const Chunk &chunk)
+{
+	while (grain < static_cast<size_t>(last - first))
+	{
+		Index middle = first + (last - first) / 2;
+		group.Run(boost::bind(&ThreadPool::SplitRange<Index, Chunk>, this,
+		                      boost::ref(group), middle, last, grain,
+		                      boost::cref(chunk)));
+		last = middle;
+	}
+
+	chunk(first, last);
+}
+
+template <class T, class... Args>
+boost::shared_ptr<T> ThreadPool::MakeTask(Args&&... args)
+{
+	return boost::allocate_shared<T>(ArenaAllocator<T>(m_arena),
+	                                 std::forward<Args>(args)...);
+}
+
+template <class F>
+typename ThreadPool::ResultOf<F>::type ThreadPool::RunBlocking(F &&func)
+{
+	BlockingRegion region;
+	return func();
+}
+
+template <class ForwardIt>
+void ThreadPool::AddTasks(ForwardIt first, ForwardIt last)
+{
+	if (!AdmitTasks(std::distance(first, last)))
+	{
+		// a throwing task does not keep the rest from running
+		std::exception_ptr exception;
+		for (; first != last; ++first)
+		{
+			try
+			{
+				RunOnCaller(*first);
+			}
+			catch (...)
+			{
+				if (!exception)
+				{
+					exception = std::current_exception();
+				}
+			}
+		}
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+		return;
+	}
+
+	QueueTasks(first, last);
+}
+
+template <class ForwardIt>
+void ThreadPool::EnqueueTasks(ForwardIt first, ForwardIt last)
+{
+	m_pendingTasks += std::distance(first, last);
+	QueueTasks(first, last);
+}
+
+template <class ForwardIt>
+void ThreadPool::QueueTasks(ForwardIt first, ForwardIt last)
+{
+	boost::chrono::steady_clock::time_point now =
+	                                        boost::chrono::steady_clock::now();
+	for (ForwardIt it = first; it != last; ++it)
+	{
+		(*it)->m_enqueueTime = now;
+		TraceTask(Tracer::ENQUEUE, **it);
+	}
+	PushTaskRange(first, last);
+}
+
+inline void ThreadPool::TraceTask(Tracer::event_type type, const Task &task)
+{
+	if (NULL != m_tracer && m_tracer->IsEnabled() && !task.m_isControl)
+	{
+		m_tracer->Record(type, &task, typeid(task).name(), task.m_priority);
+	}
+}
+
+template <class ForwardIt>
+void ThreadPool::PushTaskRange(ForwardIt first, ForwardIt last)
+{
+	size_t lane = 0;
+
+	if (!m_stealingQueue)
+	{
+		m_TaskQueue.PushRange(first, last);
+	}
+	else if (GetOwnLane(lane))
+	{
+		m_stealingQueue->PushRange(first, last, lane);
+	}
+	else
+	{
+		m_stealingQueue->PushRange(first, last);
+	}
+}
+
+
+// ════════════════════════    ThreadPool::Future    ═══════════════════════════
+template <class R>
+ThreadPool::Future<R>::Future(boost::shared_ptr<FutureState<R> > state,
+                              ThreadPool *pool) : m_state(state), m_pool(pool)
+{
+	// empty
+}
+
+template <class R>
+bool ThreadPool::Future<R>::IsValid() const
+{
+	return (NULL != m_state);
+}
+
+template <class R>
+bool ThreadPool::Future<R>::IsReady() const
+{
+	return m_state->IsReady();
+}
+
+template <class R>
+void ThreadPool::Future<R>::Wait() const
+{
+	m_state->Wait();
+}
+
+template <class R>
+bool ThreadPool::Future<R>::WaitFor(boost::chrono::milliseconds timeout) const
+{
+	return m_state->WaitFor(timeout);
+}
+
+template <class R>
+R ThreadPool::Future<R>::Get()
+{
+	boost::shared_ptr<FutureState<R> > state;
+	state.swap(m_state);
+
+	return state->Get();
+}
+
+template <class R>
+template <class F>
+ThreadPool::Future<typename ThreadPool::ContinuationResult<F, R>::type>
+ThreadPool::Future<R>::Then(F &&func, Task::priority priority)
+{
+	typedef ContinuationCall<typename std::decay<F>::type, R> call_type;
+	typedef typename ContinuationResult<F, R>::type result_type;
+
+	boost::shared_ptr<CallableTask<call_type, result_type> > task =
+	    m_pool->MakeTask<CallableTask<call_type, result_type> >(
+	                    call_type(std::forward<F>(func), *this), priority);
+	m_state->OnReady(boost::bind(&ThreadPool::EnqueueTask, m_pool,
+	                             boost::shared_ptr<Task>(task)));
+
+	return Future<result_type>(task, m_pool);
+}
+// ═════════════════════    ThreadPool::FutureState    ═════════════════════════
+template <class R>
+bool ThreadPool::FutureState<R>::IsReady() const
+{
+	return m_isReady;
+}
+
+template <class R>
+void ThreadPool::FutureState<R>::Wait() const
+{
+	if (m_isReady)
+	{
+		return;
+	}
+
+	BlockingRegion region;
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	while (!m_isReady)
+	{
+		m_readySignal.wait(lock);
+	}
+}
+
+template <class R>
+bool ThreadPool::FutureState<R>::WaitFor(
+                                    boost::chrono::milliseconds timeout) const
+{
+	if (m_isReady)
+	{
+		return true;
+	}
+
+	boost::chrono::steady_clock::time_point deadline =
+	                                boost::chrono::steady_clock::now() + timeout;
+	BlockingRegion region;
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	while (!m_isReady)
+	{
+		if (boost::cv_status::timeout ==
+		                            m_readySignal.wait_until(lock, deadline))
+		{
+			return m_isReady;
+		}
+	}
+
+	return true;
+}
+
+template <class R>
+R ThreadPool::FutureState<R>::Get()
+{
+	Wait();
+	if (m_exception)
+	{
+		std::rethrow_exception(m_exception);
+	}
+
+	return m_result.Take();
+}
+
+template <class R>
+void ThreadPool::FutureState<R>::OnReady(boost::function<void()> continuation)
+{
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		if (!m_isReady)
+		{
+			m_continuations.push_back(std::move(continuation));
+			return;
+		}
+	}
+
+	continuation();
+}
+
+template <class R>
+template <class F>
+void ThreadPool::FutureState<R>::Run(F &func)
+{
+	try
+	{
+		m_result.Store(func);
+	}
+	catch (...)
+	{
+		m_exception = std::current_exception();
+	}
+
+	std::vector<boost::function<void()> > continuations;
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		m_isReady = true;
+		m_readySignal.notify_all();
+		continuations.swap(m_continuations);
+	}
+
+	for (size_t i = 0; i < continuations.size(); ++i)
+	{
+		continuations[i]();
+	}
+}
+// ══════════════════════    ThreadPool::TaskGroup    ══════════════════════════
+template <class F>
+void ThreadPool::TaskGroup::Run(F &&func, Task::priority priority)
+{
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		++m_numOfPending;
+	}
+
+	typedef typename ResultOf<F>::type result_type;
+	Future<result_type> future;
+	try
+	{
+		future = m_pool.Submit(std::forward<F>(func), priority);
+	}
+	catch (...)
+	{
+		// never queued (QueueFull, Overloaded): nothing will count it done
+		Done(std::exception_ptr());
+		throw;
+	}
+	// run, thrown or dropped by Shutdown, the task is done once its future
+	// is ready. the state runs the continuation, so it outlives the call
+	future.m_state->OnReady(boost::bind(&TaskGroup::Arrive<result_type>, this,
+	                                    future.m_state.get()));
+
+	// a Wait with nothing left to help with may help with this one
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	++m_numOfQueued;
+	m_doneSignal.notify_all();
+}
+template <class R>
+void ThreadPool::TaskGroup::Arrive(FutureState<R> *state)
+{
+	try
+	{
+		state->Get(); // ready, and no one else takes the result
+	}
+	catch (...)
+	{
+		Done(std::current_exception());
+		return;
+	}
+	Done(std::exception_ptr());
+}
+// ════════════════════════    ThreadPool::Strand    ═══════════════════════════
+template <class F>
+ThreadPool::Future<typename ThreadPool::ResultOf<F>::type>
+ThreadPool::Strand::Post(F &&func)
+{
+	typedef typename std::decay<F>::type func_type;
+	typedef typename ResultOf<F>::type result_type;
+
+	boost::shared_ptr<CallableTask<func_type, result_type> > task =
+	    m_pool.MakeTask<CallableTask<func_type, result_type> >(
+	                                        std::forward<F>(func), m_priority);
+	task->m_enqueueTime = boost::chrono::steady_clock::now();
+	m_pool.TraceTask(Tracer::ENQUEUE, *task);
+	bool isIdle = false;
+	{
+		boost::unique_lock<boost::mutex> lock(m_state->GetMutex());
+		isIdle = m_state->Push(task);
+	}
+	if (isIdle)
+	{
+		m_pool.StartStrand(m_state, m_priority);
+	}
+
+	return Future<result_type>(task, &m_pool);
+}
+// ══════════════════════    ThreadPool::StrandMap    ══════════════════════════
+template <class Key, class Hash>
+ThreadPool::StrandMap<Key, Hash>::StrandMap(ThreadPool &pool,
+                                            Task::priority priority,
+                                            size_t numOfShards)
+                                    : m_pool(pool), m_priority(priority)
+{
+	for (size_t i = 0; i < std::max<size_t>(numOfShards, 1); ++i)
+	{
+		m_shards.push_back(boost::make_shared<Shard>());
+	}
+}
+
+template <class Key, class Hash>
+template <class F>
+ThreadPool::Future<typename ThreadPool::ResultOf<F>::type>
+ThreadPool::StrandMap<Key, Hash>::Post(const Key &key, F &&func)
+{
+	typedef typename std::decay<F>::type func_type;
+	typedef typename ResultOf<F>::type result_type;
+
+	boost::shared_ptr<CallableTask<func_type, result_type> > task =
+	    m_pool.MakeTask<CallableTask<func_type, result_type> >(
+	                                        std::forward<F>(func), m_priority);
+	const boost::shared_ptr<Shard> &shard =
+	                                m_shards[m_hash(key) % m_shards.size()];
+	boost::shared_ptr<KeyedState> state;
+	task->m_enqueueTime = boost::chrono::steady_clock::now();
+	m_pool.TraceTask(Tracer::ENQUEUE, *task);
+	bool isIdle = false;
+	{
+		boost::unique_lock<boost::mutex> lock(shard->m_mutex);
+		boost::shared_ptr<KeyedState> &slot = shard->m_strands[key];
+		if (!slot)
+		{
+			slot = boost::make_shared<KeyedState>(shard, key);
+		}
+		state = slot;
+		isIdle = state->Push(task);
+	}
+	if (isIdle)
+	{
+		m_pool.StartStrand(state, m_priority);
+	}
+
+	return Future<result_type>(task, &m_pool);
+}
+
+template <class Key, class Hash>
+size_t ThreadPool::StrandMap<Key, Hash>::GetNumOfActiveStrands() const
+{
+	size_t numOfActive = 0;
+	for (size_t i = 0; i < m_shards.size(); ++i)
+	{
+		boost::unique_lock<boost::mutex> lock(m_shards[i]->m_mutex);
+		numOfActive += m_shards[i]->m_strands.size();
+	}
+
+	return numOfActive;
+}
+//╚══════════════════════    ThreadPool(templates)    ═════════════════════════╝
+
+#if defined(__cpp_impl_coroutine)
+//╔══════════════════════    ThreadPool(coroutines)    ════════════════════════╗
+class ThreadPool::ResumeTask : public Task
+{
+public:
+	// *isDropped is the awaiter's, set when Shutdown drops the task
+	ResumeTask(std::coroutine_handle<> handle, priority taskPriority,
+	           bool *isDropped) : Task(taskPriority), m_handle(handle),
+	                              m_isDropped(isDropped)
+	{
+		m_isWorkerOnly = true;
+	}
+	// a task destroyed unexecuted (its pool destroyed with it queued) leaves
+	// its coroutine suspended: user code is not resumed from a destructor
+	virtual ~ResumeTask() = default;
+
+private:
+	virtual void Execute()
+	{
+		m_handle.resume();
+	}
+	// a dropped task still runs, for co_await to throw TaskCancelled. a
+	// destroyed frame would leak the frames that await it, and may be owned
+	// by one of them
+	virtual bool OnDropped(std::vector<boost::shared_ptr<Task> > &)
+	{
+		*m_isDropped = true;
+		return true;
+	}
+	std::coroutine_handle<> m_handle;
+	bool *m_isDropped;
+};
+
+class ThreadPool::ScheduleAwaiter
+{
+public:
+	ScheduleAwaiter(ThreadPool &pool, Task::priority priority)
+	                : m_pool(pool), m_priority(priority), m_isDropped(false) {}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		m_pool.EnqueueTask(m_pool.MakeTask<ResumeTask>(handle, m_priority,
+		                                               &m_isDropped));
+	}
+	void await_resume() const
+	{
+		if (m_isDropped)
+		{
+			throw TaskCancelled();
+		}
+	}
+
+private:
+	ThreadPool &m_pool;
+	Task::priority m_priority;
+	bool m_isDropped;
+};
+
+template <class R>
+class ThreadPool::FutureAwaiter
+{
+public:
+	explicit FutureAwaiter(const Future<R> &future) : m_future(future),
+	                                                  m_isDropped(false) {}
+
+	bool await_ready() const
+	{
+		return m_future.IsReady();
+	}
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		// the coroutine may be resumed before this returns. it resumes at
+		// the priority it was scheduled (or spawned) at
+		ThreadPool *pool = m_future.m_pool;
+		m_future.m_state->OnReady(boost::bind(&ThreadPool::EnqueueTask, pool,
+		                          boost::shared_ptr<Task>(
+		                          pool->MakeTask<ResumeTask>(handle,
+		                              GetCurrentPriority(), &m_isDropped))));
+	}
+	R await_resume()
+	{
+		if (m_isDropped)
+		{
+			throw TaskCancelled();
+		}
+		return m_future.Get();
+	}
+
+private:
+	Future<R> m_future;
+	bool m_isDropped;
+};
+
+// made ready by hand, by RunSpawned
+template <class R>
+class ThreadPool::SpawnState : public FutureState<R>
+{
+public:
+	template <class F>
+	void Complete(F &func)
+	{
+		this->Run(func);
+	}
+};
+
+// a coroutine that runs as soon as it is called and frees itself once done
+struct ThreadPool::DetachedCoroutine
+{
+	struct promise_type
+	{
+		DetachedCoroutine get_return_object() noexcept
+		{
+			return DetachedCoroutine();
+		}
+		std::suspend_never initial_suspend() noexcept
+		{
+			return std::suspend_never();
+		}
+		std::suspend_never final_suspend() noexcept
+		{
+			return std::suspend_never();
+		}
+		void return_void() noexcept
+		{
+			// empty
+		}
+		void unhandled_exception() noexcept
+		{
+			std::terminate(); // RunSpawned throws only if scheduling failed
+		}
+	};
+};
+
+inline ThreadPool::ScheduleAwaiter ThreadPool::Schedule(Task::priority priority)
+{
+	return ScheduleAwaiter(*this, priority);
+}
+
+template <class T>
+ThreadPool::Future<T> ThreadPool::Spawn(CoTask<T> task,
+                                        Task::priority priority)
+{
+	boost::shared_ptr<SpawnState<T> > state = boost::allocate_shared<
+	                            SpawnState<T> >(ArenaAllocator<SpawnState<T> >(
+	                            m_arena));
+	RunSpawned(this, std::move(task), state, priority);
+
+	return Future<T>(state, this);
+}
+
+template <class T>
+ThreadPool::DetachedCoroutine ThreadPool::RunSpawned(ThreadPool *pool,
+                                    CoTask<T> task,
+                                    boost::shared_ptr<SpawnState<T> > state,
+                                    Task::priority priority)
+{
+	// the future gets TaskCancelled if Shutdown dropped the task unstarted,
+	// as DetachedCoroutine may not throw
+	bool isScheduled = true;
+	try
+	{
+		co_await pool->Schedule(priority);
+	}
+	catch (TaskCancelled &)
+	{
+		isScheduled = false;
+	}
+	if (isScheduled)
+	{
+		co_await task.WhenReady();
+	}
+
+	auto result = [&task, isScheduled]
+	{
+		if (!isScheduled)
+		{
+			throw TaskCancelled();
+		}
+		return task.TakeResult();
+	};
+	state->Complete(result);
+}
+
+template <class R>
+ThreadPool::FutureAwaiter<R> ThreadPool::Future<R>::operator co_await()
+{
+	return FutureAwaiter<R>(*this);
+}
+//╚══════════════════════    ThreadPool(coroutines)    ════════════════════════╝
+#endif // __cpp_impl_coroutine
+
 } //namespace project
 } //namespace GHS
 
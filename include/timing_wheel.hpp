@@ -0,0 +1,222 @@
+/* welcome to timing_wheel.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_TIMING_WHEEL_HPP
+#define GHS_TIMING_WHEEL_HPP
+
+#include <vector>                      // vector
+#include <cstddef>                     // size_t
+#include <utility>                     // move
+#include <boost/cstdint.hpp>           // uint64_t
+#include <boost/noncopyable.hpp>       // noncopyable
+
+namespace GHS
+{
+namespace project
+{
+//╔═════════════════════════      TimingWheel       ═══════════════════════════╗
+/******************************************************************************
+ * hierarchical timing wheel over an abstract tick count.
+ * LEVELS wheels of SLOTS slots each: an item due within SLOTS ticks sits in
+ * the slot of its tick on the first wheel, one due later sits on the wheel
+ * of the highest byte in which its tick differs from the current one, and
+ * is moved one wheel down (cascaded) when the lower wheels wrap around to it.
+ * items further away than the wheels reach wait in an overflow list that is
+ * re-sorted whenever the top wheel wraps.
+ *
+ * Schedule is O(1), and so is every item's share of Advance: an item is
+ * cascaded at most LEVELS times. Advance itself also steps over every
+ * elapsed tick, except when the wheel is empty.
+ * not thread safe.
+ ******************************************************************************/
+template <typename T>
+class TimingWheel : private boost::noncopyable
+{
+public:
+    typedef boost::uint64_t tick_t;
+
+    explicit TimingWheel(tick_t currentTick = 0);
+    ~TimingWheel() = default;
+
+    // items due at or before the current tick are due on the next one
+    void Schedule(T item, tick_t dueTick);
+    // moves the tick forward to now and moves every item due by then to out.
+    // returns the number of items moved
+    template <class OutputIt>
+    size_t Advance(tick_t now, OutputIt out);
+    // the earliest tick Advance may have anything to return at (a tick at
+    // which a wheel wraps counts). meaningless when the wheel is empty
+    tick_t GetNextEventTick() const;
+    tick_t GetCurrentTick() const;
+
+    bool empty() const;
+    size_t size() const;
+
+private:
+    enum
+    {
+        LEVELS = 4,
+        BITS_PER_LEVEL = 8,
+        SLOTS = 1 << BITS_PER_LEVEL
+    };
+
+    struct Entry
+    {
+        Entry(T &&item, tick_t dueTick) : m_item(std::move(item)),
+                                          m_dueTick(dueTick) {}
+
+        T m_item;
+        tick_t m_dueTick;
+    };
+    typedef std::vector<Entry> slot;
+
+    static size_t SlotOf(tick_t tick, size_t level);
+    void Place(Entry &&entry);
+    void Cascade(slot &source);
+
+    slot m_wheels[LEVELS][SLOTS];
+    slot m_overflow;
+    tick_t m_currentTick;
+    size_t m_size;
+};
+
+template <typename T>
+TimingWheel<T>::TimingWheel(tick_t currentTick) : m_currentTick(currentTick),
+                                                  m_size(0)
+{
+    // empty
+}
+
+template <typename T>
+void TimingWheel<T>::Schedule(T item, tick_t dueTick)
+{
+    if (dueTick <= m_currentTick)
+    {
+        dueTick = m_currentTick + 1;
+    }
+
+    Place(Entry(std::move(item), dueTick));
+    ++m_size;
+}
+
+template <typename T>
+template <class OutputIt>
+size_t TimingWheel<T>::Advance(tick_t now, OutputIt out)
+{
+    size_t moved = 0;
+
+    if (0 == m_size && now > m_currentTick)
+    {
+        m_currentTick = now; // nothing to step over
+    }
+
+    while (m_currentTick < now)
+    {
+        ++m_currentTick;
+
+        // the highest wrapping wheel first, its items may land on the lower
+        // wheels' slots that are about to be cascaded as well
+        if (0 == (m_currentTick & ((tick_t(1) << (LEVELS * BITS_PER_LEVEL)) -
+                                                                          1)))
+        {
+            Cascade(m_overflow);
+        }
+        for (size_t level = LEVELS - 1; 0 < level; --level)
+        {
+            tick_t mask = (tick_t(1) << (level * BITS_PER_LEVEL)) - 1;
+            if (0 == (m_currentTick & mask))
+            {
+                Cascade(m_wheels[level][SlotOf(m_currentTick, level)]);
+            }
+        }
+
+        slot &due = m_wheels[0][SlotOf(m_currentTick, 0)];
+        for (size_t i = 0; i < due.size(); ++i, ++out)
+        {
+            *out = std::move(due[i].m_item);
+        }
+        moved += due.size();
+        m_size -= due.size();
+        due.clear();
+    }
+
+    return moved;
+}
+
+template <typename T>
+typename TimingWheel<T>::tick_t TimingWheel<T>::GetNextEventTick() const
+{
+    tick_t tick = m_currentTick + 1;
+    for (; 0 != (tick & (SLOTS - 1)); ++tick)
+    {
+        if (!m_wheels[0][SlotOf(tick, 0)].empty())
+        {
+            return tick;
+        }
+    }
+
+    return tick; // the first wheel wraps, something may cascade down
+}
+
+template <typename T>
+typename TimingWheel<T>::tick_t TimingWheel<T>::GetCurrentTick() const
+{
+    return m_currentTick;
+}
+
+template <typename T>
+bool TimingWheel<T>::empty() const
+{
+    return (0 == m_size);
+}
+
+template <typename T>
+size_t TimingWheel<T>::size() const
+{
+    return m_size;
+}
+
+template <typename T>
+size_t TimingWheel<T>::SlotOf(tick_t tick, size_t level)
+{
+    return ((tick >> (level * BITS_PER_LEVEL)) & (SLOTS - 1));
+}
+
+template <typename T>
+void TimingWheel<T>::Place(Entry &&entry)
+{
+    tick_t differentBits = entry.m_dueTick ^ m_currentTick;
+
+    for (size_t level = 0; level < LEVELS; ++level)
+    {
+        if (0 == (differentBits >> ((level + 1) * BITS_PER_LEVEL)))
+        {
+            m_wheels[level][SlotOf(entry.m_dueTick, level)].push_back(
+                                                            std::move(entry));
+            return;
+        }
+    }
+
+    m_overflow.push_back(std::move(entry));
+}
+
+template <typename T>
+void TimingWheel<T>::Cascade(slot &source)
+{
+    slot entries;
+    entries.swap(source);
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        Place(std::move(entries[i]));
+    }
+}
+//╚═════════════════════════      TimingWheel       ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_TIMING_WHEEL_HPP
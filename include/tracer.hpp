@@ -0,0 +1,109 @@
+/* welcome to tracer.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_TRACER_HPP
+#define GHS_TRACER_HPP
+
+#include <cstddef>                     // size_t
+#include <map>                         // map
+#include <ostream>                     // ostream
+#include <string>                      // string
+#include <vector>                      // vector
+#include <boost/noncopyable.hpp>       // noncopyable
+#include <boost/shared_ptr.hpp>        // shared_ptr
+#include <boost/atomic.hpp>            // atomic flags and counters
+#include <boost/chrono.hpp>            // steady_clock
+#include <boost/cstdint.hpp>           // int64_t, uint64_t
+#include <boost/thread/mutex.hpp>      // boost::mutex
+#include <boost/thread/thread.hpp>     // thread::id
+
+namespace GHS
+{
+namespace project
+{
+//╔═════════════════════════         Tracer         ═══════════════════════════╗
+/******************************************************************************
+ * records task lifecycle events and writes them out as Chrome trace-event
+ * JSON, for chrome://tracing or Perfetto.
+ * every recording thread writes to a ring of its own, without locks; only
+ * its first event takes the lock, to register the ring. a ring keeps the
+ * newest eventsPerThread events and overwrites older ones.
+ * disabled (the default), recording costs the caller a relaxed load: check
+ * IsEnabled before gathering what Record takes.
+ * the tracer must outlive everything that records into it, and the names
+ * it is given must outlive the tracer (type names and literals do).
+ ******************************************************************************/
+class Tracer : private boost::noncopyable
+{
+public:
+    enum event_type
+    {
+        ENQUEUE,   // the task was queued
+        DEQUEUE,   // a worker took it off the queue
+        START,     // it started to run
+        FINISH,    // it returned (or expired)
+        COUNTER    // a sampled value, such as a queue's size
+    };
+
+    struct Event
+    {
+        boost::int64_t m_time;  // ns since the tracer was created
+        const void *m_id;       // the task (or the counter's owner)
+        const char *m_name;     // the task's type (mangled), or the counter's
+        size_t m_value;         // the task's priority, or the counter's value
+        event_type m_type;
+    };
+
+    explicit Tracer(size_t eventsPerThread = DEFAULT_EVENTS_PER_THREAD);
+    ~Tracer() = default;
+
+    void Enable();
+    void Disable();
+    bool IsEnabled() const;
+
+    // does nothing while the tracer is disabled
+    void Record(event_type type, const void *id, const char *name,
+                size_t value);
+    // names the calling thread in the trace. costs no ring
+    void SetThreadName(const std::string &name);
+
+    // events the rings hold, over every thread
+    size_t GetNumOfEvents() const;
+    // safe while threads record: an event overwritten during the copy is
+    // dropped. START and FINISH make a slice named after the task's type,
+    // ENQUEUE and DEQUEUE instants, with a flow arrow from ENQUEUE to START,
+    // and COUNTER events a counter track. timestamps are in microseconds
+    void WriteChromeTrace(std::ostream &out) const;
+
+private:
+    enum { DEFAULT_EVENTS_PER_THREAD = 1 << 16 };
+
+    class Ring; // the events of one thread
+    typedef std::map<boost::thread::id, boost::shared_ptr<Ring> > ring_map;
+    typedef std::map<boost::thread::id, std::string> name_map;
+
+    Ring &GetRing();
+    static std::string TypeName(const char *mangled);
+
+    const size_t m_eventsPerThread;
+    const boost::uint64_t m_id; // tells tracers apart, even at one address
+    const boost::chrono::steady_clock::time_point m_epoch;
+    boost::atomic<bool> m_isEnabled;
+    mutable boost::mutex m_mutex;
+    ring_map m_rings;           // guarded by m_mutex
+    name_map m_threadNames;     // m_mutex too
+};
+
+inline bool Tracer::IsEnabled() const
+{
+    return m_isEnabled.load(boost::memory_order_relaxed);
+}
+//╚═════════════════════════         Tracer         ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_TRACER_HPP
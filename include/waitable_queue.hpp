@@ -10,35 +10,296 @@
 #define GHS_WAITABLEQUEUE_HPP
 
 #include <queue>                       // queue
+#include <vector>                      // vector
+#include <algorithm>                   // push_heap, pop_heap, find
+#include <iterator>                    // input_iterator_tag
+#include <cstddef>                     // ptrdiff_t
+#include <utility>                     // forward, move
+#include <stdexcept>                   // runtime_error
 #include <boost/noncopyable.hpp>       // noncopyable
 #include <boost/chrono.hpp>            // nanoseconds
 #include <boost/thread/mutex.hpp>      // boost::mutex
 #include <boost/thread/condition.hpp>  // boost::condition
+#include <boost/thread/thread.hpp>     // yield, hardware_concurrency
+#include <boost/atomic.hpp>            // atomic counters
+#include <boost/function.hpp>          // function
+
+#include "mpmc_ring_buffer.hpp"        // MPMCRingBuffer
+#include "tracer.hpp"                  // Tracer
 
 
 namespace GHS
 {
 namespace project
 {
+// a snapshot of a queue's state and of the traffic on its lock(s)
+struct QueueStats
+{
+    size_t size;              // items queued
+    size_t lockAcquisitions;  // times the lock was taken
+    size_t contendedLocks;    // of those, times it was held by somebody else
+};
+
+// how a consumer that found its queue empty waits: it spins on the CPU up to
+// spinCount times, then gives up its time slice up to yieldCount times, and
+// only then parks on the queue's condition. spinning wins when items arrive
+// within microseconds; parking costs a wakeup syscall and its latency.
+// WaitStrategy(0, 0) parks at once.
+struct WaitStrategy
+{
+    enum
+    {
+        DEFAULT_SPINS = 1024,
+        DEFAULT_YIELDS = 0
+    };
+
+    explicit WaitStrategy(size_t spins = DEFAULT_SPINS,
+                          size_t yields = DEFAULT_YIELDS)
+                                    : spinCount(spins), yieldCount(yields) {}
+
+    size_t spinCount;
+    size_t yieldCount;
+};
+
+// thrown by the blocking pushes of a closed WaitableQueue
+class QueueClosed : public std::runtime_error
+{
+public:
+    QueueClosed() : std::runtime_error("queue is closed") {}
+};
+
+//╔═════════════════════════       SpinWaiter       ═══════════════════════════╗
+/******************************************************************************
+ * the spin and yield phases of a WaitStrategy, shared by a queue's consumers.
+ * the spin phase adapts (as glibc's adaptive mutexes do): it lasts about
+ * twice as long as the spins that recently saw items arrive, capped by the
+ * strategy, so a queue that stays empty for long parks almost at once.
+ * it is skipped on a single CPU, where a spinner only delays the producer.
+ ******************************************************************************/
+class SpinWaiter : private boost::noncopyable
+{
+public:
+    explicit SpinWaiter(const WaitStrategy &strategy = WaitStrategy());
+
+    // not thread safe: call it before the queue is shared
+    void SetStrategy(const WaitStrategy &strategy);
+    // true as soon as hasItems() is, false once it is time to park
+    template <class Predicate>
+    bool SpinUntil(Predicate hasItems);
+
+private:
+    enum { MIN_SPINS = 16 };
+
+    static void CpuRelax();
+    static bool IsSingleCpu();
+
+    WaitStrategy m_strategy;
+    boost::atomic<size_t> m_spinEstimate;
+};
+//╚═════════════════════════       SpinWaiter       ═══════════════════════════╝
+
 //╔═════════════════════════      WaitableQueue     ═══════════════════════════╗
+/******************************************************************************
+ * unbounded unless SetCapacity is called. on a bounded queue, Push, Emplace
+ * and PushRange block while the queue is full, TryPush fails at once and
+ * the timed Push gives up at its deadline.
+ *
+ * Close ends the stream: every blocked thread wakes, pushes fail from then
+ * on (the blocking ones throw QueueClosed), and consumers drain what is left
+ * before their pops report the end by returning false (or 0).
+ * Select pops from whichever of several queues has an item first, with one
+ * waiting thread for all of them.
+ ******************************************************************************/
 template <class T, class Container = std::queue<T> >
 class WaitableQueue : private boost::noncopyable
 {
 public:
-    explicit WaitableQueue() = default;
+    typedef boost::function<void(bool isAboveHigh)> watermark_callback;
+    class ConsumingRange;
+
+    // arguments, if any, are forwarded to the constructor of the container
+    template <class... ContainerArgs>
+    explicit WaitableQueue(ContainerArgs&&... containerArgs);
     ~WaitableQueue() = default;
 
     void Push(const T& data);
+    void Push(T&& data);
+    // false if the queue stayed full until the timeout, or is closed
+    bool Push(const T& data, boost::chrono::nanoseconds timeout);
+    bool Push(T&& data, boost::chrono::nanoseconds timeout);
+    // false if the queue is full or closed
+    bool TryPush(const T& data);
+    bool TryPush(T&& data);
+    // constructs the item in place, inside the container
+    template <class... Args>
+    void Emplace(Args&&... args);
+    // pushes [first, last) under a single lock with a single wakeup, unless
+    // a bounded queue fills up on the way, in which case it waits for room
+    template <class InputIt>
+    void PushRange(InputIt first, InputIt last);
 
-    void Pop(T &out);
+    // the item is moved out of the container, so T may be move-only.
+    // false once the queue is closed and drained (or the timeout expired)
+    bool Pop(T &out);
     bool Pop(T &out, boost::chrono::nanoseconds timeout);
+    bool TryPop(T &out);
+    // waits for at least one item and moves up to maxItems of them to out.
+    // returns the number of items popped (0 only when the timeout expired,
+    // or the queue is closed and drained)
+    template <class OutputIt>
+    size_t PopBatch(OutputIt out, size_t maxItems);
+    template <class OutputIt>
+    size_t PopBatch(OutputIt out, size_t maxItems,
+                    boost::chrono::nanoseconds timeout);
 
+    // for (T &item : queue.Consume()) pops until the queue is closed and
+    // drained. items are moved out, the loop may move them on
+    ConsumingRange Consume();
+    // pops an item from the first of queues that has one, waiting until one
+    // does; queues earlier in the list take precedence. returns the index of
+    // the queue popped from, or queues.size() once they are all closed and
+    // drained (or the timeout expired)
+    static size_t Select(const std::vector<WaitableQueue *> &queues, T &out);
+    static size_t Select(const std::vector<WaitableQueue *> &queues, T &out,
+                         boost::chrono::nanoseconds timeout);
+
+    // wakes every waiter. idempotent
+    void Close();
+    bool IsClosed() const;
     bool IsEmpty() const;
+    QueueStats GetStats() const;
+    // not thread safe: call these before the queue is shared
+    void SetWaitStrategy(const WaitStrategy &strategy);
+    // 0 makes the queue unbounded again
+    void SetCapacity(size_t capacity);
+    // onCrossing(true) when the size reaches high, and onCrossing(false) when
+    // it drops back to low, once per crossing. it is called by the pushing
+    // (or popping) thread after the lock is released, so crossings that
+    // race may be reported out of order
+    void SetWatermarks(size_t high, size_t low,
+                       watermark_callback onCrossing);
+    // records the size after every push and pop as a counter named name,
+    // while tracer is enabled. NULL stops it
+    void SetTracer(Tracer *tracer, const char *name);
 
 private:
+    class Selector;
+
+    bool IsFull() const;
+    template <class OutputIt>
+    size_t PopUpTo(OutputIt out, size_t maxItems);
+    static size_t SelectUntil(const std::vector<WaitableQueue *> &queues,
+                    T &out,
+                    const boost::chrono::steady_clock::time_point *deadline);
+    template <class U>
+    bool PushUntil(U &&data,
+                   const boost::chrono::steady_clock::time_point *deadline);
+    void SpinForItems();
+    void WaitForItems(boost::unique_lock<boost::mutex> &lock);
+    bool WaitForItems(boost::unique_lock<boost::mutex> &lock,
+                      boost::chrono::steady_clock::time_point deadline);
+    // the untimed one throws QueueClosed when the queue is, or gets, closed
+    void WaitForRoom(boost::unique_lock<boost::mutex> &lock);
+    bool WaitForRoom(boost::unique_lock<boost::mutex> &lock,
+                     boost::chrono::steady_clock::time_point deadline);
+    // account for items pushed (popped) under lock, release it, then wake
+    // whoever sleeps on the other side and report a watermark crossing
+    void EndPush(boost::unique_lock<boost::mutex> &lock, size_t pushed);
+    void EndPop(boost::unique_lock<boost::mutex> &lock, size_t popped);
+    void NotifySelectors();
+
     Container m_container;
-    boost::mutex m_mutex;
+    mutable boost::mutex m_mutex;
     boost::condition_variable m_pushSignal;
+    boost::condition_variable m_popSignal;
+    // consumers waiting on m_pushSignal and producers on m_popSignal, so
+    // that nobody pays a wakeup syscall when nobody sleeps. m_mutex guards
+    // both, and every field below up to m_size
+    size_t m_numOfWaiters;
+    size_t m_numOfBlockedPushers;
+    size_t m_capacity;
+    size_t m_highWatermark;
+    size_t m_lowWatermark;
+    bool m_isAboveHigh;
+    watermark_callback m_onWatermark;
+    Tracer *m_tracer;
+    const char *m_traceName;
+    // the Selects waiting on this queue, among others
+    std::vector<Selector *> m_selectors;
+    // written under m_mutex, readable without it
+    boost::atomic<bool> m_isClosed;
+    // the item count, readable without the lock by spinning consumers
+    boost::atomic<size_t> m_size;
+    SpinWaiter m_spinWaiter;
+    boost::atomic<size_t> m_lockAcquisitions;
+    boost::atomic<size_t> m_contendedLocks;
+};
+
+template <class T, class Container>
+class WaitableQueue<T, Container>::ConsumingRange
+{
+public:
+    class iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T *pointer;
+        typedef T &reference;
+
+        // pops the first item, unless queue is NULL (the end iterator)
+        explicit iterator(WaitableQueue *queue);
+
+        T &operator*() { return m_item; }
+        T *operator->() { return &m_item; }
+        iterator &operator++();
+        bool operator==(const iterator &other) const
+        {
+            return (m_queue == other.m_queue);
+        }
+        bool operator!=(const iterator &other) const
+        {
+            return (m_queue != other.m_queue);
+        }
+
+    private:
+        WaitableQueue *m_queue; // NULL once the queue is closed and drained
+        T m_item;
+    };
+
+    explicit ConsumingRange(WaitableQueue &queue) : m_queue(queue) {}
+
+    iterator begin() { return iterator(&m_queue); }
+    iterator end() { return iterator(NULL); }
+
+private:
+    WaitableQueue &m_queue;
+};
+
+// the wakeup of one Select call, notified by each queue it watches on every
+// push and on Close. it stops watching them when destroyed
+template <class T, class Container>
+class WaitableQueue<T, Container>::Selector : private boost::noncopyable
+{
+public:
+    Selector();
+    ~Selector();
+
+    // under the lock of queue
+    void Watch(WaitableQueue *queue);
+    void Notify();
+    size_t GetNumOfEvents();
+    // waits for Notify to be called more than numOfEvents times in all.
+    // false if the deadline (NULL for none) passed first
+    bool WaitForEvent(size_t numOfEvents,
+                      const boost::chrono::steady_clock::time_point *deadline);
+
+private:
+    std::vector<WaitableQueue *> m_watched;
+    boost::mutex m_mutex;
+    boost::condition_variable m_signal;
+    size_t m_numOfEvents;
 };
 
 //╚═════════════════════════      WaitableQueue     ═══════════════════════════╝
@@ -53,99 +314,1171 @@ public:
 
     const T &front();
     void pop();
+    // moves the top element out, then pops it
+    void pop(T &out);
     void push( const T& value);
+    void push(T&& value);
+    template <class... Args>
+    void emplace(Args&&... args);
     bool empty() const;
+    size_t size() const;
 
 private:
-    std::priority_queue<T> m_queue;
+    std::vector<T> m_heap;
 };
 
 template<typename T>
 const T &PriorityQueue<T>::front()
 {
-    return m_queue.top();
+    return m_heap.front();
 }
 
 template<typename T>
 void PriorityQueue<T>::pop()
 {
-    m_queue.pop();
+    std::pop_heap(m_heap.begin(), m_heap.end());
+    m_heap.pop_back();
+}
+
+template<typename T>
+void PriorityQueue<T>::pop(T &out)
+{
+    // pop_heap moves the top to the back, where it can be moved out safely
+    std::pop_heap(m_heap.begin(), m_heap.end());
+    out = std::move(m_heap.back());
+    m_heap.pop_back();
 }
 
 template<typename T>
 void PriorityQueue<T>::push(const T &value)
 {
-    m_queue.push(value);
+    emplace(value);
+}
+
+template<typename T>
+void PriorityQueue<T>::push(T &&value)
+{
+    emplace(std::move(value));
+}
+
+template<typename T>
+template <class... Args>
+void PriorityQueue<T>::emplace(Args&&... args)
+{
+    m_heap.emplace_back(std::forward<Args>(args)...);
+    std::push_heap(m_heap.begin(), m_heap.end());
 }
 
 template<typename T>
 bool PriorityQueue<T>::empty() const
 {
-    return m_queue.empty();
+    return m_heap.empty();
+}
+
+template<typename T>
+size_t PriorityQueue<T>::size() const
+{
+    return m_heap.size();
 }
 
 //╚═════════════════════════      PriorityQueue     ═══════════════════════════╝
 
 //╔═════════════════════════          utils         ═══════════════════════════╗
-static inline boost::chrono::system_clock::time_point
+// a steady deadline, so that changes to the wall clock do not stretch or
+// cut timed waits
+static inline boost::chrono::steady_clock::time_point
                 GetTimePoint(const boost::chrono::nanoseconds &nano)
 {
-    boost::chrono::system_clock::time_point wakeUpTime
-                    = boost::chrono::system_clock::now() + nano;
+    boost::chrono::steady_clock::time_point wakeUpTime
+                    = boost::chrono::steady_clock::now() + nano;
     return wakeUpTime;
 }
+
+// takes mutex, counting the acquisitions and the ones that found it taken
+inline boost::unique_lock<boost::mutex> LockCounted(boost::mutex &mutex,
+                                      boost::atomic<size_t> &acquisitions,
+                                      boost::atomic<size_t> &contended)
+{
+    boost::unique_lock<boost::mutex> lock(mutex, boost::try_to_lock);
+    acquisitions.fetch_add(1, boost::memory_order_relaxed);
+    if (!lock.owns_lock())
+    {
+        contended.fetch_add(1, boost::memory_order_relaxed);
+        lock.lock();
+    }
+
+    return lock;
+}
+
+// moves the front item of a container out and pops it. containers whose
+// front() is const (heaps) overload this with a pop(T &) of their own
+template <class Container, class T>
+inline void PopFront(Container &container, T &out)
+{
+    out = std::move(container.front());
+    container.pop();
+}
+
+template <class T>
+inline void PopFront(PriorityQueue<T> &container, T &out)
+{
+    container.pop(out);
+}
 //╚═════════════════════════          utils         ═══════════════════════════╝
 
+//╔═════════════════════════       SpinWaiter       ═══════════════════════════╗
+inline SpinWaiter::SpinWaiter(const WaitStrategy &strategy)
+                                : m_strategy(strategy), m_spinEstimate(0)
+{
+    // empty
+}
+
+inline void SpinWaiter::SetStrategy(const WaitStrategy &strategy)
+{
+    m_strategy = strategy;
+    m_spinEstimate = 0;
+}
+
+template <class Predicate>
+bool SpinWaiter::SpinUntil(Predicate hasItems)
+{
+    if (!IsSingleCpu())
+    {
+        // racing updates of the estimate only blur it a little
+        size_t estimate = m_spinEstimate.load(boost::memory_order_relaxed);
+        size_t limit = std::min(m_strategy.spinCount,
+                                2 * estimate + MIN_SPINS);
+        for (size_t spins = 0; spins < limit; ++spins)
+        {
+            if (hasItems())
+            {
+                m_spinEstimate.store((spins < estimate)
+                                    ? estimate - (estimate - spins) / 8
+                                    : estimate + (spins - estimate) / 8,
+                                    boost::memory_order_relaxed);
+                return true;
+            }
+            CpuRelax();
+        }
+        m_spinEstimate.store(estimate - estimate / 8,
+                             boost::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < m_strategy.yieldCount; ++i)
+    {
+        boost::this_thread::yield();
+        if (hasItems())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+inline void SpinWaiter::CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+inline bool SpinWaiter::IsSingleCpu()
+{
+    static const bool isSingleCpu =
+                            (1 >= boost::thread::hardware_concurrency());
+    return isSingleCpu;
+}
+//╚═════════════════════════       SpinWaiter       ═══════════════════════════╝
+
 //╔═════════════════════════      WaitableQueue     ═══════════════════════════╗
+template<class T, class Container>
+template <class... ContainerArgs>
+WaitableQueue<T, Container>::WaitableQueue(ContainerArgs&&... containerArgs)
+    : m_container(std::forward<ContainerArgs>(containerArgs)...),
+      m_numOfWaiters(0), m_numOfBlockedPushers(0), m_capacity(0),
+      m_highWatermark(0), m_lowWatermark(0), m_isAboveHigh(false),
+      m_tracer(NULL), m_traceName(NULL), m_isClosed(false), m_size(0),
+      m_lockAcquisitions(0),
+      m_contendedLocks(0)
+{
+    // empty
+}
+
 template<class T, class Container>
 void WaitableQueue<T, Container>::Push(const T &data)
 {
-    boost::unique_lock<boost::mutex> lock(m_mutex);
-    m_container.push(data);
-    m_pushSignal.notify_one();
+    Emplace(data);
 }
 
 template<class T, class Container>
-void WaitableQueue<T, Container>::Pop(T &out)
+void WaitableQueue<T, Container>::Push(T &&data)
 {
-    boost::unique_lock<boost::mutex> lock(m_mutex);
+    Emplace(std::move(data));
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::Push(const T &data,
+                                       boost::chrono::nanoseconds timeout)
+{
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    return PushUntil(data, &topTime);
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::Push(T &&data,
+                                       boost::chrono::nanoseconds timeout)
+{
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    return PushUntil(std::move(data), &topTime);
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::TryPush(const T &data)
+{
+    boost::chrono::steady_clock::time_point now =
+                                        boost::chrono::steady_clock::now();
+    return PushUntil(data, &now);
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::TryPush(T &&data)
+{
+    boost::chrono::steady_clock::time_point now =
+                                        boost::chrono::steady_clock::now();
+    return PushUntil(std::move(data), &now);
+}
+
+template<class T, class Container>
+template <class... Args>
+void WaitableQueue<T, Container>::Emplace(Args&&... args)
+{
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
+    if (m_isClosed)
+    {
+        throw QueueClosed();
+    }
+    while (IsFull())
+    {
+        WaitForRoom(lock);
+    }
+    m_container.emplace(std::forward<Args>(args)...);
+
+    EndPush(lock, 1);
+}
+
+template<class T, class Container>
+template <class InputIt>
+void WaitableQueue<T, Container>::PushRange(InputIt first, InputIt last)
+{
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
+    if (m_isClosed)
+    {
+        throw QueueClosed();
+    }
+    size_t pushed = 0;
+    for (; first != last; ++first, ++pushed)
+    {
+        if (IsFull())
+        {
+            // consumers must hear of what is in before we wait for them
+            m_size.fetch_add(pushed, boost::memory_order_relaxed);
+            if (0 != m_numOfWaiters)
+            {
+                m_pushSignal.notify_all();
+            }
+            NotifySelectors();
+            pushed = 0;
+            while (IsFull())
+            {
+                WaitForRoom(lock);
+            }
+        }
+        m_container.push(*first);
+    }
+
+    EndPush(lock, pushed);
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::Pop(T &out)
+{
+    SpinForItems();
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
 
     while (IsEmpty())
     {
-        m_pushSignal.wait(lock);
+        if (m_isClosed)
+        {
+            return false;
+        }
+        WaitForItems(lock);
     }
 
-    out = m_container.front();
-    m_container.pop();
+    PopFront(m_container, out);
+    EndPop(lock, 1);
+    return true;
 }
 
 template<class T, class Container>
 bool WaitableQueue<T, Container>::Pop(T &out,
                                       boost::chrono::nanoseconds timeout)
 {
-    boost::chrono::system_clock::time_point topTime = GetTimePoint(timeout);
-    boost::unique_lock<boost::mutex> lock(m_mutex);
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    if (0 < timeout.count())
+    {
+        SpinForItems();
+    }
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
 
     while (IsEmpty())
     {
-        if (boost::cv_status::timeout ==
-                                    m_pushSignal.wait_until(lock, topTime))
+        if (m_isClosed || !WaitForItems(lock, topTime))
         {
             return false;
         }
     }
 
-    out = m_container.front();
-    m_container.pop();
+    PopFront(m_container, out);
+    EndPop(lock, 1);
+    return true;
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::TryPop(T &out)
+{
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
+    if (IsEmpty())
+    {
+        return false;
+    }
+
+    PopFront(m_container, out);
+    EndPop(lock, 1);
     return true;
 }
 
+template<class T, class Container>
+template <class OutputIt>
+size_t WaitableQueue<T, Container>::PopBatch(OutputIt out, size_t maxItems)
+{
+    SpinForItems();
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
+
+    while (IsEmpty())
+    {
+        if (m_isClosed)
+        {
+            return 0;
+        }
+        WaitForItems(lock);
+    }
+
+    size_t popped = PopUpTo(out, maxItems);
+    EndPop(lock, popped);
+    return popped;
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WaitableQueue<T, Container>::PopBatch(OutputIt out, size_t maxItems,
+                                      boost::chrono::nanoseconds timeout)
+{
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    if (0 < timeout.count())
+    {
+        SpinForItems();
+    }
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
+
+    while (IsEmpty())
+    {
+        if (m_isClosed || !WaitForItems(lock, topTime))
+        {
+            return 0;
+        }
+    }
+
+    size_t popped = PopUpTo(out, maxItems);
+    EndPop(lock, popped);
+    return popped;
+}
+
+template<class T, class Container>
+typename WaitableQueue<T, Container>::ConsumingRange
+WaitableQueue<T, Container>::Consume()
+{
+    return ConsumingRange(*this);
+}
+
+template<class T, class Container>
+size_t WaitableQueue<T, Container>::Select(
+                        const std::vector<WaitableQueue *> &queues, T &out)
+{
+    return SelectUntil(queues, out, NULL);
+}
+
+template<class T, class Container>
+size_t WaitableQueue<T, Container>::Select(
+                        const std::vector<WaitableQueue *> &queues, T &out,
+                        boost::chrono::nanoseconds timeout)
+{
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    return SelectUntil(queues, out, &topTime);
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::Close()
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_isClosed = true;
+    NotifySelectors();
+    lock.unlock();
+
+    m_pushSignal.notify_all();
+    m_popSignal.notify_all();
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::IsClosed() const
+{
+    return m_isClosed;
+}
+
 template<class T, class Container>
 bool WaitableQueue<T, Container>::IsEmpty() const
 {
     return m_container.empty();
 }
-//╚═════════════════════════      WaitableQueue     ═══════════════════════════╝
+
+template<class T, class Container>
+QueueStats WaitableQueue<T, Container>::GetStats() const
+{
+    QueueStats stats;
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        stats.size = m_container.size();
+    }
+    stats.lockAcquisitions = m_lockAcquisitions;
+    stats.contendedLocks = m_contendedLocks;
+
+    return stats;
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::SetWaitStrategy(const WaitStrategy &strategy)
+{
+    m_spinWaiter.SetStrategy(strategy);
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::SetCapacity(size_t capacity)
+{
+    m_capacity = capacity;
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::SetWatermarks(size_t high, size_t low,
+                                                watermark_callback onCrossing)
+{
+    m_highWatermark = high;
+    m_lowWatermark = low;
+    m_onWatermark = onCrossing;
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::SetTracer(Tracer *tracer, const char *name)
+{
+    m_tracer = tracer;
+    m_traceName = name;
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::IsFull() const
+{
+    return (0 != m_capacity && m_capacity <= m_container.size());
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WaitableQueue<T, Container>::PopUpTo(OutputIt out, size_t maxItems)
+{
+    size_t popped = 0;
+    for (; popped < maxItems && !IsEmpty(); ++popped, ++out)
+    {
+        T item;
+        PopFront(m_container, item);
+        *out = std::move(item);
+    }
+
+    return popped;
+}
+
+template<class T, class Container>
+size_t WaitableQueue<T, Container>::SelectUntil(
+                    const std::vector<WaitableQueue *> &queues, T &out,
+                    const boost::chrono::steady_clock::time_point *deadline)
+{
+    Selector selector;
+
+    for (bool isFirstPass = true; ; isFirstPass = false)
+    {
+        // events from here on are seen by the scan or wake the wait below
+        size_t numOfEvents = selector.GetNumOfEvents();
+        bool isAllDrained = true;
+
+        for (size_t i = 0; i < queues.size(); ++i)
+        {
+            WaitableQueue &queue = *queues[i];
+            boost::unique_lock<boost::mutex> lock = LockCounted(queue.m_mutex,
+                        queue.m_lockAcquisitions, queue.m_contendedLocks);
+            if (!queue.IsEmpty())
+            {
+                PopFront(queue.m_container, out);
+                queue.EndPop(lock, 1);
+                return i;
+            }
+            // a queue that is closed now stays empty for good
+            if (!queue.m_isClosed)
+            {
+                isAllDrained = false;
+                if (isFirstPass)
+                {
+                    selector.Watch(&queue);
+                }
+            }
+        }
+
+        if (isAllDrained || !selector.WaitForEvent(numOfEvents, deadline))
+        {
+            return queues.size();
+        }
+    }
+}
+
+template<class T, class Container>
+template <class U>
+bool WaitableQueue<T, Container>::PushUntil(U &&data,
+                        const boost::chrono::steady_clock::time_point *deadline)
+{
+    boost::unique_lock<boost::mutex> lock =
+                LockCounted(m_mutex, m_lockAcquisitions, m_contendedLocks);
+    if (m_isClosed)
+    {
+        return false;
+    }
+    while (IsFull())
+    {
+        if (!WaitForRoom(lock, *deadline))
+        {
+            return false;
+        }
+    }
+    m_container.push(std::forward<U>(data));
+
+    EndPush(lock, 1);
+    return true;
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::SpinForItems()
+{
+    m_spinWaiter.SpinUntil([this]
+    {
+        return (0 != m_size.load(boost::memory_order_relaxed) ||
+                m_isClosed.load(boost::memory_order_relaxed));
+    });
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::WaitForItems(
+                                        boost::unique_lock<boost::mutex> &lock)
+{
+    ++m_numOfWaiters;
+    m_pushSignal.wait(lock);
+    --m_numOfWaiters;
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::WaitForItems(
+                            boost::unique_lock<boost::mutex> &lock,
+                            boost::chrono::steady_clock::time_point deadline)
+{
+    ++m_numOfWaiters;
+    boost::cv_status status = m_pushSignal.wait_until(lock, deadline);
+    --m_numOfWaiters;
+
+    return (boost::cv_status::no_timeout == status || !IsEmpty());
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::WaitForRoom(
+                                        boost::unique_lock<boost::mutex> &lock)
+{
+    ++m_numOfBlockedPushers;
+    m_popSignal.wait(lock);
+    --m_numOfBlockedPushers;
+
+    if (m_isClosed)
+    {
+        throw QueueClosed();
+    }
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::WaitForRoom(
+                            boost::unique_lock<boost::mutex> &lock,
+                            boost::chrono::steady_clock::time_point deadline)
+{
+    if (boost::chrono::steady_clock::now() >= deadline)
+    {
+        return false; // TryPush
+    }
+
+    ++m_numOfBlockedPushers;
+    boost::cv_status status = m_popSignal.wait_until(lock, deadline);
+    --m_numOfBlockedPushers;
+
+    return (!m_isClosed &&
+            (boost::cv_status::no_timeout == status || !IsFull()));
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::EndPush(
+                        boost::unique_lock<boost::mutex> &lock, size_t pushed)
+{
+    size_t size = m_size.fetch_add(pushed, boost::memory_order_relaxed) +
+                                                                        pushed;
+    size_t numOfWaiters = m_numOfWaiters;
+    bool isCrossing = (!m_isAboveHigh && 0 != m_highWatermark &&
+                       m_highWatermark <= size);
+    m_isAboveHigh = m_isAboveHigh || isCrossing;
+    if (0 != pushed)
+    {
+        NotifySelectors(); // under the lock, so no Selector is gone yet
+    }
+    if (NULL != m_tracer && m_tracer->IsEnabled())
+    {
+        m_tracer->Record(Tracer::COUNTER, this, m_traceName, size);
+    }
+    lock.unlock();
+
+    // waiters register under the mutex before they sleep, and the count was
+    // read under it, so a consumer that was not counted will see the items.
+    // notifying after unlocking spares the woken thread a bounce off the lock
+    if (0 != numOfWaiters && 0 != pushed)
+    {
+        if (1 == pushed)
+        {
+            m_pushSignal.notify_one();
+        }
+        else
+        {
+            m_pushSignal.notify_all();
+        }
+    }
+    if (isCrossing)
+    {
+        m_onWatermark(true);
+    }
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::EndPop(
+                        boost::unique_lock<boost::mutex> &lock, size_t popped)
+{
+    size_t size = m_size.fetch_sub(popped, boost::memory_order_relaxed) -
+                                                                        popped;
+    size_t numOfBlocked = m_numOfBlockedPushers;
+    bool isCrossing = (m_isAboveHigh && size <= m_lowWatermark);
+    m_isAboveHigh = m_isAboveHigh && !isCrossing;
+    if (NULL != m_tracer && m_tracer->IsEnabled())
+    {
+        m_tracer->Record(Tracer::COUNTER, this, m_traceName, size);
+    }
+    lock.unlock();
+
+    if (0 != numOfBlocked && 0 != popped)
+    {
+        if (1 == popped)
+        {
+            m_popSignal.notify_one();
+        }
+        else
+        {
+            m_popSignal.notify_all();
+        }
+    }
+    if (isCrossing)
+    {
+        m_onWatermark(false);
+    }
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::NotifySelectors()
+{
+    for (size_t i = 0; i < m_selectors.size(); ++i)
+    {
+        m_selectors[i]->Notify();
+    }
+}
+// ═════════════════════    WaitableQueue::Selector    ═════════════════════════
+template<class T, class Container>
+WaitableQueue<T, Container>::Selector::Selector() : m_numOfEvents(0)
+{
+    // empty
+}
+
+template<class T, class Container>
+WaitableQueue<T, Container>::Selector::~Selector()
+{
+    for (size_t i = 0; i < m_watched.size(); ++i)
+    {
+        WaitableQueue &queue = *m_watched[i];
+        boost::unique_lock<boost::mutex> lock(queue.m_mutex);
+        queue.m_selectors.erase(std::find(queue.m_selectors.begin(),
+                                          queue.m_selectors.end(), this));
+    }
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::Selector::Watch(WaitableQueue *queue)
+{
+    queue->m_selectors.push_back(this);
+    m_watched.push_back(queue);
+}
+
+template<class T, class Container>
+void WaitableQueue<T, Container>::Selector::Notify()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        ++m_numOfEvents;
+    }
+    m_signal.notify_one();
+}
+
+template<class T, class Container>
+size_t WaitableQueue<T, Container>::Selector::GetNumOfEvents()
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    return m_numOfEvents;
+}
+
+template<class T, class Container>
+bool WaitableQueue<T, Container>::Selector::WaitForEvent(size_t numOfEvents,
+                    const boost::chrono::steady_clock::time_point *deadline)
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (numOfEvents == m_numOfEvents)
+    {
+        if (NULL == deadline)
+        {
+            m_signal.wait(lock);
+        }
+        else if (boost::cv_status::timeout ==
+                                        m_signal.wait_until(lock, *deadline))
+        {
+            return (numOfEvents != m_numOfEvents);
+        }
+    }
+
+    return true;
+}
+// ══════════════════    WaitableQueue::ConsumingRange    ══════════════════════
+template<class T, class Container>
+WaitableQueue<T, Container>::ConsumingRange::iterator::iterator(
+                                WaitableQueue *queue) : m_queue(queue), m_item()
+{
+    if (NULL != m_queue)
+    {
+        ++*this;
+    }
+}
+
+template<class T, class Container>
+typename WaitableQueue<T, Container>::ConsumingRange::iterator &
+WaitableQueue<T, Container>::ConsumingRange::iterator::operator++()
+{
+    if (!m_queue->Pop(m_item))
+    {
+        m_queue = NULL;
+    }
+
+    return *this;
+}
+//╚═════════════════════════      WaitableQueue     ═══════════════════════════╝
+
+//╔═══════════════    WaitableQueue<T, MPMCRingBuffer<T> >    ═════════════════╗
+/******************************************************************************
+ * lock-free flavour of WaitableQueue, bounded by the ring's capacity.
+ * Push and Pop go straight to the ring and never touch the mutex while the
+ * ring is neither full nor empty. only a consumer that found the ring empty
+ * (or a producer that found it full) takes the mutex and parks, and the other
+ * side takes the mutex to wake it only when a parked thread is registered.
+ *
+ * Close behaves as WaitableQueue's does, though a push that started before
+ * Close may still land after it. PushRange and PopBatch go item by item, so
+ * unlike WaitableQueue's they are not one lock and one wakeup.
+ * the generic queue's Select, Consume, watermarks, tracing and capacity
+ * changes are left out: each needs a lock around every push and pop.
+ ******************************************************************************/
+template <class T>
+class WaitableQueue<T, MPMCRingBuffer<T> > : private boost::noncopyable
+{
+public:
+    explicit WaitableQueue(size_t capacity = DEFAULT_CAPACITY);
+    ~WaitableQueue() = default;
+
+    void Push(const T& data);
+    void Push(T&& data);
+    template <class... Args>
+    void Emplace(Args&&... args);
+    // false if the ring is full or the queue closed
+    bool TryPush(const T& data);
+    bool TryPush(T&& data);
+    // false if the ring stayed full until the timeout, or the queue closed
+    bool Push(T&& data, boost::chrono::nanoseconds timeout);
+    template <class InputIt>
+    void PushRange(InputIt first, InputIt last);
+
+    // false once the queue is closed and drained (or the timeout expired)
+    bool Pop(T &out);
+    bool Pop(T &out, boost::chrono::nanoseconds timeout);
+    bool TryPop(T &out);
+    // waits for one item, then takes whatever else is there, up to maxItems.
+    // 0 only when the timeout expired, or the queue is closed and drained
+    template <class OutputIt>
+    size_t PopBatch(OutputIt out, size_t maxItems);
+    template <class OutputIt>
+    size_t PopBatch(OutputIt out, size_t maxItems,
+                    boost::chrono::nanoseconds timeout);
+
+    // wakes every waiter. idempotent
+    void Close();
+    bool IsClosed() const;
+    bool IsEmpty() const;
+    // not thread safe: call it before the queue is shared
+    void SetWaitStrategy(const WaitStrategy &strategy);
+
+private:
+    enum { DEFAULT_CAPACITY = 1024 };
+
+    void WakeOne(boost::atomic<size_t> &parked,
+                 boost::condition_variable &signal);
+    bool SpinAndTryPop(T &out);
+    template <class OutputIt>
+    size_t PopRest(T &first, OutputIt out, size_t maxItems);
+
+    MPMCRingBuffer<T> m_ring;
+    // written under m_mutex, so a thread parking under it cannot miss it
+    boost::atomic<bool> m_isClosed;
+    SpinWaiter m_spinWaiter;
+    boost::atomic<size_t> m_parkedConsumers;
+    boost::atomic<size_t> m_parkedProducers;
+    boost::mutex m_mutex;
+    boost::condition_variable m_pushSignal;
+    boost::condition_variable m_popSignal;
+};
+
+template<class T>
+WaitableQueue<T, MPMCRingBuffer<T> >::WaitableQueue(size_t capacity)
+    : m_ring(capacity), m_isClosed(false), m_parkedConsumers(0),
+      m_parkedProducers(0)
+{
+    // empty
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::TryPush(const T &data)
+{
+    T copy(data);
+    return TryPush(std::move(copy));
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::TryPush(T &&data)
+{
+    if (m_isClosed || !m_ring.TryPush(std::move(data)))
+    {
+        return false;
+    }
+
+    WakeOne(m_parkedConsumers, m_pushSignal);
+    return true;
+}
+
+template<class T>
+void WaitableQueue<T, MPMCRingBuffer<T> >::Push(const T &data)
+{
+    T copy(data);
+    Push(std::move(copy));
+}
+
+template<class T>
+template <class... Args>
+void WaitableQueue<T, MPMCRingBuffer<T> >::Emplace(Args&&... args)
+{
+    Push(T(std::forward<Args>(args)...));
+}
+
+template<class T>
+void WaitableQueue<T, MPMCRingBuffer<T> >::Push(T &&data)
+{
+    if (TryPush(std::move(data)))
+    {
+        return;
+    }
+
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    ++m_parkedProducers;
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    while (m_isClosed || !m_ring.TryPush(std::move(data)))
+    {
+        if (m_isClosed)
+        {
+            --m_parkedProducers;
+            throw QueueClosed();
+        }
+        m_popSignal.wait(lock);
+    }
+    --m_parkedProducers;
+    lock.unlock();
+
+    WakeOne(m_parkedConsumers, m_pushSignal);
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::Push(T &&data,
+                                      boost::chrono::nanoseconds timeout)
+{
+    if (TryPush(std::move(data)))
+    {
+        return true;
+    }
+
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    ++m_parkedProducers;
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    while (m_isClosed || !m_ring.TryPush(std::move(data)))
+    {
+        if (m_isClosed || boost::cv_status::timeout ==
+                                    m_popSignal.wait_until(lock, topTime))
+        {
+            --m_parkedProducers;
+            return false;
+        }
+    }
+    --m_parkedProducers;
+    lock.unlock();
+
+    WakeOne(m_parkedConsumers, m_pushSignal);
+    return true;
+}
+
+template<class T>
+template <class InputIt>
+void WaitableQueue<T, MPMCRingBuffer<T> >::PushRange(InputIt first,
+                                                     InputIt last)
+{
+    for (; first != last; ++first)
+    {
+        Push(*first);
+    }
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::TryPop(T &out)
+{
+    if (!m_ring.TryPop(out))
+    {
+        return false;
+    }
+
+    WakeOne(m_parkedProducers, m_popSignal);
+    return true;
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::Pop(T &out)
+{
+    if (SpinAndTryPop(out))
+    {
+        return true;
+    }
+
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    ++m_parkedConsumers;
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    while (!m_ring.TryPop(out))
+    {
+        if (m_isClosed)
+        {
+            --m_parkedConsumers;
+            return false;
+        }
+        m_pushSignal.wait(lock);
+    }
+    --m_parkedConsumers;
+    lock.unlock();
+
+    WakeOne(m_parkedProducers, m_popSignal);
+    return true;
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::Pop(T &out,
+                                      boost::chrono::nanoseconds timeout)
+{
+    if (TryPop(out) || (0 < timeout.count() && SpinAndTryPop(out)))
+    {
+        return true;
+    }
+
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    ++m_parkedConsumers;
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    while (!m_ring.TryPop(out))
+    {
+        if (m_isClosed || boost::cv_status::timeout ==
+                                    m_pushSignal.wait_until(lock, topTime))
+        {
+            --m_parkedConsumers;
+            return false;
+        }
+    }
+    --m_parkedConsumers;
+    lock.unlock();
+
+    WakeOne(m_parkedProducers, m_popSignal);
+    return true;
+}
+
+template<class T>
+template <class OutputIt>
+size_t WaitableQueue<T, MPMCRingBuffer<T> >::PopBatch(OutputIt out,
+                                                      size_t maxItems)
+{
+    T first;
+    if (0 == maxItems || !Pop(first))
+    {
+        return 0;
+    }
+
+    return PopRest(first, out, maxItems);
+}
+
+template<class T>
+template <class OutputIt>
+size_t WaitableQueue<T, MPMCRingBuffer<T> >::PopBatch(OutputIt out,
+                                      size_t maxItems,
+                                      boost::chrono::nanoseconds timeout)
+{
+    T first;
+    if (0 == maxItems || !Pop(first, timeout))
+    {
+        return 0;
+    }
+
+    return PopRest(first, out, maxItems);
+}
+
+template<class T>
+void WaitableQueue<T, MPMCRingBuffer<T> >::Close()
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_isClosed = true;
+    lock.unlock();
+
+    m_pushSignal.notify_all();
+    m_popSignal.notify_all();
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::IsClosed() const
+{
+    return m_isClosed;
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::IsEmpty() const
+{
+    return m_ring.IsEmpty();
+}
+
+template<class T>
+void WaitableQueue<T, MPMCRingBuffer<T> >::SetWaitStrategy(
+                                                const WaitStrategy &strategy)
+{
+    m_spinWaiter.SetStrategy(strategy);
+}
+
+template<class T>
+bool WaitableQueue<T, MPMCRingBuffer<T> >::SpinAndTryPop(T &out)
+{
+    while (!TryPop(out))
+    {
+        // closed, the locked path tells drained from not yet
+        if (m_isClosed ||
+            !m_spinWaiter.SpinUntil([this]
+            {
+                return !m_ring.IsEmpty() || m_isClosed;
+            }))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<class T>
+template <class OutputIt>
+size_t WaitableQueue<T, MPMCRingBuffer<T> >::PopRest(T &first, OutputIt out,
+                                                     size_t maxItems)
+{
+    *out = std::move(first);
+    ++out;
+    size_t popped = 1;
+    T item;
+    while (popped < maxItems && TryPop(item))
+    {
+        *out = std::move(item);
+        ++out;
+        ++popped;
+    }
+
+    return popped;
+}
+
+template<class T>
+void WaitableQueue<T, MPMCRingBuffer<T> >::WakeOne(
+                                        boost::atomic<size_t> &parked,
+                                        boost::condition_variable &signal)
+{
+    // the ring operation that precedes this call must be visible before the
+    // parked count is read; a parking thread registers itself before retrying
+    // the ring under the mutex, so one of the two always sees the other.
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (0 != parked.load(boost::memory_order_relaxed))
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        signal.notify_one();
+    }
+}
+//╚═══════════════    WaitableQueue<T, MPMCRingBuffer<T> >    ═════════════════╝
 
 }//namespace project
 }//namespace GHS
@@ -0,0 +1,601 @@
+/* welcome to work_stealing_queue.hpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+
+#ifndef GHS_WORK_STEALING_QUEUE_HPP
+#define GHS_WORK_STEALING_QUEUE_HPP
+
+#include <queue>                       // queue
+#include <vector>                      // vector
+#include <algorithm>                   // min
+#include <iterator>                    // distance
+#include <utility>                     // forward
+#include <boost/noncopyable.hpp>       // noncopyable
+#include <boost/shared_ptr.hpp>        // shared_ptr
+#include <boost/atomic.hpp>            // atomic counters
+#include <boost/chrono.hpp>            // nanoseconds
+#include <boost/thread/mutex.hpp>      // boost::mutex
+#include <boost/thread/condition.hpp>  // boost::condition
+
+#include "waitable_queue.hpp"          // GetTimePoint, PopFront, SpinWaiter
+#include "bucket_queue.hpp"            // BucketQueue
+
+namespace GHS
+{
+namespace project
+{
+// the priority levels of a container's items. a plain FIFO has a single one
+template <class Container>
+struct LevelsOf
+{
+    enum { NUM_LEVELS = 1 };
+    template <class T>
+    static size_t Level(const T &) { return 0; }
+};
+
+template <typename T, typename LevelTraits>
+struct LevelsOf<BucketQueue<T, LevelTraits> >
+{
+    enum { NUM_LEVELS = LevelTraits::NUM_LEVELS };
+    static size_t Level(const T &item) { return LevelTraits::Level(item); }
+};
+
+//╔═════════════════════════   WorkStealingQueue    ═══════════════════════════╗
+/******************************************************************************
+ * A set of lanes, each one a Container guarded by its own mutex.
+ * consumers own a lane: they pop from it first and steal from the other
+ * lanes (in order, starting from their neighbour, lanes of the same group
+ * first) only when it is empty.
+ * a Container with priority levels (a BucketQueue) keeps levels in order
+ * across lanes too: a consumer pops from the lane whose front item is of the
+ * highest level, its own lane winning ties. every lane publishes the level
+ * of its front, and the consumer compares them without taking the locks, so
+ * an item pushed while it compares may be passed over by one pop.
+ * producers that do not own a lane are spread across lanes round-robin.
+ *
+ * consumers park on a single condition only when every lane is empty, and
+ * producers touch that condition only when somebody is actually parked.
+ ******************************************************************************/
+template <class T, class Container = std::queue<T> >
+class WorkStealingQueue : private boost::noncopyable
+{
+public:
+    // arguments, if any, are forwarded to the constructor of every lane
+    template <class... ContainerArgs>
+    explicit WorkStealingQueue(size_t numOfLanes,
+                               ContainerArgs&&... containerArgs);
+    ~WorkStealingQueue() = default;
+
+    void Push(const T &data);
+    void Push(T &&data);
+    void Push(const T &data, size_t lane);
+    void Push(T &&data, size_t lane);
+    // spreads [first, last) over the lanes in contiguous chunks
+    template <class ForwardIt>
+    void PushRange(ForwardIt first, ForwardIt last);
+    template <class ForwardIt>
+    void PushRange(ForwardIt first, ForwardIt last, size_t lane);
+
+    void Pop(T &out, size_t lane);
+    bool Pop(T &out, size_t lane, boost::chrono::nanoseconds timeout);
+    // up to maxItems from the own lane, or up to half of a victim's lane
+    template <class OutputIt>
+    size_t PopBatch(OutputIt out, size_t maxItems, size_t lane);
+    // returns 0 if nothing arrived within timeout
+    template <class OutputIt>
+    size_t PopBatch(OutputIt out, size_t maxItems, size_t lane,
+                    boost::chrono::nanoseconds timeout);
+    // takes whatever every lane holds right now, never blocks
+    template <class OutputIt>
+    size_t TryPopAll(OutputIt out);
+
+    // groupOfLane[i] is the group (e.g. NUMA node) of lane i. a thief visits
+    // the lanes of its own group before all others. not thread safe: call it
+    // before the queue is shared.
+    void SetLaneGroups(const std::vector<size_t> &groupOfLane);
+
+    bool IsEmpty() const;
+    size_t GetNumOfLanes() const;
+    // lock traffic summed over the lanes
+    QueueStats GetStats() const;
+    // not thread safe: call it before the queue is shared
+    void SetWaitStrategy(const WaitStrategy &strategy);
+
+private:
+    enum { CACHE_LINE = 64 };
+
+    struct Lane
+    {
+        template <class... ContainerArgs>
+        explicit Lane(ContainerArgs&&... containerArgs)
+            : m_container(std::forward<ContainerArgs>(containerArgs)...),
+              m_lockAcquisitions(0), m_contendedLocks(0), m_frontLevel(0){}
+
+        boost::mutex m_mutex;
+        Container m_container;
+        boost::atomic<size_t> m_lockAcquisitions;
+        boost::atomic<size_t> m_contendedLocks;
+        // the level of the front item plus 1, 0 while the lane is empty.
+        // written under m_mutex, read without it
+        boost::atomic<size_t> m_frontLevel;
+        char m_padding[CACHE_LINE];
+    };
+
+    enum { NUM_LEVELS = LevelsOf<Container>::NUM_LEVELS };
+
+    // m_mutex of the lane held
+    static void PublishFront(Lane &lane);
+    // the lane to pop from first: the one whose front is of the highest
+    // level, lane itself if none is higher than its own
+    size_t PickSource(size_t lane) const;
+    bool TryPopLocal(T &out, size_t lane);
+    bool TrySteal(T &out, size_t thief);
+    bool TryPopAny(T &out, size_t lane);
+    template <class OutputIt>
+    size_t TryPopBatch(OutputIt out, size_t maxItems, size_t lane,
+                       bool isThief);
+    template <class OutputIt>
+    size_t TryPopBatchAny(OutputIt out, size_t maxItems, size_t lane);
+    // true if items showed up while spinning, so parking can be skipped
+    bool SpinForItems();
+    void WaitForItems();
+    void WakeParked(size_t pushed = 1);
+
+    std::vector<boost::shared_ptr<Lane> > m_lanes;
+    size_t m_numOfLanes;
+    // m_victims[i]: the other lanes, in the order lane i's owner steals
+    std::vector<std::vector<size_t> > m_victims;
+
+    boost::atomic<size_t> m_nextLane;
+    boost::atomic<size_t> m_size;
+    boost::atomic<size_t> m_parked;
+
+    SpinWaiter m_spinWaiter;
+    boost::mutex m_parkMutex;
+    boost::condition_variable m_parkSignal;
+};
+
+//╚═════════════════════════   WorkStealingQueue    ═══════════════════════════╝
+
+//╔═════════════════════════   WorkStealingQueue    ═══════════════════════════╗
+template<class T, class Container>
+template <class... ContainerArgs>
+WorkStealingQueue<T, Container>::WorkStealingQueue(size_t numOfLanes,
+                                               ContainerArgs&&... containerArgs)
+    : m_numOfLanes(numOfLanes ? numOfLanes : 1),
+      m_nextLane(0), m_size(0), m_parked(0)
+{
+    for (size_t i = 0; i < m_numOfLanes; ++i)
+    {
+        m_lanes.push_back(boost::shared_ptr<Lane>(new Lane(containerArgs...)));
+    }
+    SetLaneGroups(std::vector<size_t>(m_numOfLanes, 0));
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::Push(const T &data)
+{
+    Push(data, m_nextLane.fetch_add(1, boost::memory_order_relaxed));
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::Push(T &&data)
+{
+    Push(std::move(data), m_nextLane.fetch_add(1, boost::memory_order_relaxed));
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::Push(const T &data, size_t lane)
+{
+    T copy(data);
+    Push(std::move(copy), lane);
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::Push(T &&data, size_t lane)
+{
+    Lane &target = *m_lanes[lane % m_numOfLanes];
+    {
+        boost::unique_lock<boost::mutex> lock = LockCounted(target.m_mutex,
+                                                    target.m_lockAcquisitions,
+                                                    target.m_contendedLocks);
+        target.m_container.push(std::move(data));
+        PublishFront(target);
+        ++m_size;
+    }
+    WakeParked();
+}
+
+template<class T, class Container>
+template <class ForwardIt>
+void WorkStealingQueue<T, Container>::PushRange(ForwardIt first, ForwardIt last)
+{
+    // the next batch starts past the lanes this one covers
+    size_t total = std::distance(first, last);
+    size_t chunk = (total + m_numOfLanes - 1) / m_numOfLanes;
+    size_t numOfCovered = (0 == total) ? 0 : (total + chunk - 1) / chunk;
+    PushRange(first, last, m_nextLane.fetch_add(numOfCovered,
+                                                boost::memory_order_relaxed));
+}
+
+template<class T, class Container>
+template <class ForwardIt>
+void WorkStealingQueue<T, Container>::PushRange(ForwardIt first, ForwardIt last,
+                                                size_t lane)
+{
+    size_t total = std::distance(first, last);
+    size_t chunk = (total + m_numOfLanes - 1) / m_numOfLanes;
+
+    for (size_t left = total; 0 != left; ++lane)
+    {
+        size_t amount = std::min(chunk, left);
+        Lane &target = *m_lanes[lane % m_numOfLanes];
+
+        boost::unique_lock<boost::mutex> lock = LockCounted(target.m_mutex,
+                                                    target.m_lockAcquisitions,
+                                                    target.m_contendedLocks);
+        for (size_t i = 0; i < amount; ++i, ++first)
+        {
+            target.m_container.push(*first);
+        }
+        PublishFront(target);
+        m_size += amount;
+        left -= amount;
+    }
+
+    WakeParked(total);
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::Pop(T &out, size_t lane)
+{
+    while (!TryPopAny(out, lane))
+    {
+        if (!SpinForItems())
+        {
+            WaitForItems();
+        }
+    }
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WorkStealingQueue<T, Container>::PopBatch(OutputIt out, size_t maxItems,
+                                                 size_t lane)
+{
+    for (;;)
+    {
+        size_t popped = TryPopBatchAny(out, maxItems, lane);
+        if (0 != popped)
+        {
+            return popped;
+        }
+
+        if (!SpinForItems())
+        {
+            WaitForItems();
+        }
+    }
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WorkStealingQueue<T, Container>::PopBatch(OutputIt out, size_t maxItems,
+                                                 size_t lane,
+                                            boost::chrono::nanoseconds timeout)
+{
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+
+    for (;;)
+    {
+        size_t popped = TryPopBatchAny(out, maxItems, lane);
+        if (0 != popped)
+        {
+            return popped;
+        }
+        if (0 < timeout.count() && SpinForItems())
+        {
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(m_parkMutex);
+        ++m_parked;
+        while (0 == m_size)
+        {
+            if (boost::cv_status::timeout ==
+                                    m_parkSignal.wait_until(lock, topTime))
+            {
+                --m_parked;
+                return 0;
+            }
+        }
+        --m_parked;
+    }
+}
+
+template<class T, class Container>
+bool WorkStealingQueue<T, Container>::Pop(T &out, size_t lane,
+                                          boost::chrono::nanoseconds timeout)
+{
+    boost::chrono::steady_clock::time_point topTime = GetTimePoint(timeout);
+
+    while (!TryPopAny(out, lane))
+    {
+        if (0 < timeout.count() && SpinForItems())
+        {
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(m_parkMutex);
+        ++m_parked;
+        while (0 == m_size)
+        {
+            if (boost::cv_status::timeout ==
+                                    m_parkSignal.wait_until(lock, topTime))
+            {
+                --m_parked;
+                return false;
+            }
+        }
+        --m_parked;
+    }
+
+    return true;
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WorkStealingQueue<T, Container>::TryPopAll(OutputIt out)
+{
+    size_t popped = 0;
+    for (size_t lane = 0; lane < m_numOfLanes; ++lane)
+    {
+        popped += TryPopBatch(out, static_cast<size_t>(-1), lane, false);
+    }
+
+    return popped;
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::SetLaneGroups(
+                                        const std::vector<size_t> &groupOfLane)
+{
+    m_victims.assign(m_numOfLanes, std::vector<size_t>());
+    for (size_t lane = 0; lane < m_numOfLanes; ++lane)
+    {
+        // neighbours first, own group before the rest
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            bool wantSameGroup = (0 == pass);
+            for (size_t i = 1; i < m_numOfLanes; ++i)
+            {
+                size_t victim = (lane + i) % m_numOfLanes;
+                if (wantSameGroup ==
+                                (groupOfLane[victim] == groupOfLane[lane]))
+                {
+                    m_victims[lane].push_back(victim);
+                }
+            }
+        }
+    }
+}
+
+template<class T, class Container>
+bool WorkStealingQueue<T, Container>::IsEmpty() const
+{
+    return (0 == m_size);
+}
+
+template<class T, class Container>
+size_t WorkStealingQueue<T, Container>::GetNumOfLanes() const
+{
+    return m_numOfLanes;
+}
+
+template<class T, class Container>
+QueueStats WorkStealingQueue<T, Container>::GetStats() const
+{
+    QueueStats stats;
+    stats.size = m_size;
+    stats.lockAcquisitions = 0;
+    stats.contendedLocks = 0;
+    for (size_t i = 0; i < m_numOfLanes; ++i)
+    {
+        stats.lockAcquisitions += m_lanes[i]->m_lockAcquisitions;
+        stats.contendedLocks += m_lanes[i]->m_contendedLocks;
+    }
+
+    return stats;
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::SetWaitStrategy(
+                                                const WaitStrategy &strategy)
+{
+    m_spinWaiter.SetStrategy(strategy);
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::PublishFront(Lane &lane)
+{
+    if (1 < NUM_LEVELS)
+    {
+        lane.m_frontLevel.store(lane.m_container.empty() ? 0 :
+                            LevelsOf<Container>::Level(
+                                        lane.m_container.front()) + 1,
+                            boost::memory_order_relaxed);
+    }
+}
+
+template<class T, class Container>
+size_t WorkStealingQueue<T, Container>::PickSource(size_t lane) const
+{
+    if (1 == NUM_LEVELS)
+    {
+        return lane;
+    }
+
+    size_t source = lane;
+    size_t highest = m_lanes[lane]->m_frontLevel.load(
+                                                boost::memory_order_relaxed);
+    for (size_t i = 0; i < m_victims[lane].size(); ++i)
+    {
+        size_t victim = m_victims[lane][i];
+        size_t level = m_lanes[victim]->m_frontLevel.load(
+                                                boost::memory_order_relaxed);
+        if (level > highest)
+        {
+            highest = level;
+            source = victim;
+        }
+    }
+
+    return source;
+}
+
+template<class T, class Container>
+bool WorkStealingQueue<T, Container>::TryPopLocal(T &out, size_t lane)
+{
+    Lane &source = *m_lanes[lane];
+    boost::unique_lock<boost::mutex> lock = LockCounted(source.m_mutex,
+                                                    source.m_lockAcquisitions,
+                                                    source.m_contendedLocks);
+
+    if (source.m_container.empty())
+    {
+        return false;
+    }
+
+    PopFront(source.m_container, out);
+    PublishFront(source);
+    --m_size;
+    return true;
+}
+
+template<class T, class Container>
+bool WorkStealingQueue<T, Container>::TrySteal(T &out, size_t thief)
+{
+    for (size_t i = 0; i < m_victims[thief].size(); ++i)
+    {
+        if (TryPopLocal(out, m_victims[thief][i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template<class T, class Container>
+bool WorkStealingQueue<T, Container>::TryPopAny(T &out, size_t lane)
+{
+    lane %= m_numOfLanes;
+    if (0 == m_size)
+    {
+        return false;
+    }
+
+    size_t source = PickSource(lane);
+    return ((source != lane && TryPopLocal(out, source)) ||
+            TryPopLocal(out, lane) || TrySteal(out, lane));
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WorkStealingQueue<T, Container>::TryPopBatch(OutputIt out,
+                                                    size_t maxItems,
+                                                    size_t lane, bool isThief)
+{
+    Lane &source = *m_lanes[lane];
+    boost::unique_lock<boost::mutex> lock = LockCounted(source.m_mutex,
+                                                    source.m_lockAcquisitions,
+                                                    source.m_contendedLocks);
+
+    size_t available = source.m_container.size();
+    if (isThief)
+    {
+        available = (available + 1) / 2;
+    }
+
+    size_t popped = 0;
+    for (; popped < maxItems && popped < available; ++popped, ++out)
+    {
+        T item;
+        PopFront(source.m_container, item);
+        *out = std::move(item);
+    }
+    PublishFront(source);
+    m_size -= popped;
+
+    return popped;
+}
+
+template<class T, class Container>
+template <class OutputIt>
+size_t WorkStealingQueue<T, Container>::TryPopBatchAny(OutputIt out,
+                                                       size_t maxItems,
+                                                       size_t lane)
+{
+    lane %= m_numOfLanes;
+    size_t source = PickSource(lane);
+    size_t popped = (source != lane)
+                    ? TryPopBatch(out, maxItems, source, true) : 0;
+    if (0 == popped)
+    {
+        popped = TryPopBatch(out, maxItems, lane, false);
+    }
+    for (size_t i = 0; 0 == popped && i < m_victims[lane].size(); ++i)
+    {
+        popped = TryPopBatch(out, maxItems, m_victims[lane][i], true);
+    }
+
+    return popped;
+}
+
+template<class T, class Container>
+bool WorkStealingQueue<T, Container>::SpinForItems()
+{
+    return m_spinWaiter.SpinUntil([this]
+    {
+        return (0 != m_size.load(boost::memory_order_relaxed));
+    });
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::WaitForItems()
+{
+    boost::unique_lock<boost::mutex> lock(m_parkMutex);
+    ++m_parked;
+    while (0 == m_size)
+    {
+        m_parkSignal.wait(lock);
+    }
+    --m_parked;
+}
+
+template<class T, class Container>
+void WorkStealingQueue<T, Container>::WakeParked(size_t pushed)
+{
+    // m_size was raised before m_parked is read, and a parking consumer raises
+    // m_parked before it reads m_size, so one of the two always sees the other
+    if (0 != m_parked)
+    {
+        boost::unique_lock<boost::mutex> lock(m_parkMutex);
+        if (1 == pushed)
+        {
+            m_parkSignal.notify_one();
+        }
+        else
+        {
+            m_parkSignal.notify_all();
+        }
+    }
+}
+//╚═════════════════════════   WorkStealingQueue    ═══════════════════════════╝
+
+}//namespace project
+}//namespace GHS
+#endif // GHS_WORK_STEALING_QUEUE_HPP
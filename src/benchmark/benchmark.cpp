@@ -0,0 +1,380 @@
+/* welcome to benchmark.cpp */
+/******************************************************************************
+ *																			  *
+ *                          code by : Gil H. Steinberg                        *
+ *																			  *
+ ******************************************************************************/
+/******************************************************************************
+ * benchmark suite for the queues and the thread pool. prints one JSON object
+ * to stdout, so runs of different versions can be diffed and tracked.
+ *
+ *      queue_throughput   - items/s through a queue, N producers x M consumers
+ *      pool_throughput    - tasks/s for empty and small tasks, per scheduler
+ *      submit_latency     - submit-to-start percentiles (us) of an idle pool
+ *      resize             - cost (us) of growing and shrinking SetNumOfThreads
+ *
+ * every figure is the median of REPEATS runs, after one warm-up run.
+ * usage: benchmark [quick]   (quick divides the workloads by 16)
+ ******************************************************************************/
+
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+using namespace GHS::project;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace boost::chrono;
+using boost::shared_ptr;
+
+static const size_t REPEATS = 3;
+static const size_t PRODUCERS = 4;
+static const size_t THREAD_COUNTS[] = {1, 4, 16, 64};
+static const size_t QUEUE_SHAPES[][2] = {{1, 1}, {1, 4}, {4, 1}, {4, 4}};
+static const size_t RING_CAPACITY = 1024;
+static const size_t SMALL_TASK_ITERATIONS = 200;
+static const size_t RESIZE_SMALL = 4;
+static const size_t RESIZE_LARGE = 64;
+
+static size_t g_itemsPerRun = 1 << 20;
+static size_t g_tasksPerRun = 200000;
+static size_t g_latencySamples = 20000;
+static size_t g_resizeRounds = 10;
+
+//╔═════════════════════════          utils         ═══════════════════════════╗
+template <class Func>
+static double Median(Func runOnce)
+{
+	runOnce(); // warm-up
+
+	vector<double> results;
+	for (size_t i = 0; i < REPEATS; ++i)
+	{
+		results.push_back(runOnce());
+	}
+	std::sort(results.begin(), results.end());
+
+	return results[results.size() / 2];
+}
+
+static double Percentile(const vector<double> &sorted, double percent)
+{
+	size_t index = static_cast<size_t>(percent / 100 * (sorted.size() - 1));
+	return sorted[index];
+}
+
+static const char *SchedulingName(ThreadPool::scheduling mode)
+{
+	return (ThreadPool::SHARED_QUEUE == mode) ? "shared" : "stealing";
+}
+
+// writes a flat list of JSON objects, each on its own line
+class JsonArray
+{
+public:
+	explicit JsonArray(const char *name) : m_isFirst(true)
+	{
+		cout << "  \"" << name << "\": [";
+	}
+	~JsonArray()
+	{
+		cout << "\n  ]";
+	}
+
+	JsonArray &Begin()
+	{
+		cout << (m_isFirst ? "\n    {" : ",\n    {");
+		m_isFirst = false;
+		m_isFirstField = true;
+		return *this;
+	}
+	JsonArray &Field(const char *key, const string &value)
+	{
+		Separator(key);
+		cout << "\"" << value << "\"";
+		return *this;
+	}
+	JsonArray &Field(const char *key, double value)
+	{
+		Separator(key);
+		cout << value;
+		return *this;
+	}
+	void End()
+	{
+		cout << "}";
+	}
+
+private:
+	void Separator(const char *key)
+	{
+		cout << (m_isFirstField ? "\"" : ", \"") << key << "\": ";
+		m_isFirstField = false;
+	}
+
+	bool m_isFirst;
+	bool m_isFirstField;
+};
+//╚═════════════════════════          utils         ═══════════════════════════╝
+
+//╔═════════════════════════    queue_throughput    ═══════════════════════════╗
+template <class Queue>
+static void ProduceItems(Queue *queue, size_t amount)
+{
+	for (size_t i = 0; i < amount; ++i)
+	{
+		queue->Push(static_cast<int>(i));
+	}
+}
+
+template <class Queue>
+static void ConsumeItems(Queue *queue, size_t amount)
+{
+	int item = 0;
+	for (size_t i = 0; i < amount; ++i)
+	{
+		queue->Pop(item);
+	}
+}
+
+template <class Queue>
+static double QueueRun(size_t producers, size_t consumers)
+{
+	Queue queue;
+	size_t items = g_itemsPerRun - g_itemsPerRun % (producers * consumers);
+
+	steady_clock::time_point start = steady_clock::now();
+
+	boost::thread_group threads;
+	for (size_t i = 0; i < consumers; ++i)
+	{
+		threads.create_thread(boost::bind(&ConsumeItems<Queue>, &queue,
+		                                  items / consumers));
+	}
+	for (size_t i = 0; i < producers; ++i)
+	{
+		threads.create_thread(boost::bind(&ProduceItems<Queue>, &queue,
+		                                  items / producers));
+	}
+	threads.join_all();
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return (items / elapsed.count());
+}
+
+// the ring needs its capacity, the default constructor takes the default one
+class RingQueue : public WaitableQueue<int, MPMCRingBuffer<int> >
+{
+public:
+	RingQueue() : WaitableQueue<int, MPMCRingBuffer<int> >(RING_CAPACITY) {}
+};
+
+static void QueueThroughput()
+{
+	JsonArray results("queue_throughput");
+	for (size_t i = 0; i < sizeof(QUEUE_SHAPES) / sizeof(*QUEUE_SHAPES); ++i)
+	{
+		size_t producers = QUEUE_SHAPES[i][0];
+		size_t consumers = QUEUE_SHAPES[i][1];
+
+		results.Begin().Field("container", "std::queue")
+		       .Field("producers", producers).Field("consumers", consumers)
+		       .Field("items_per_sec", Median(boost::bind(
+		             &QueueRun<WaitableQueue<int> >, producers, consumers)))
+		       .End();
+		results.Begin().Field("container", "MPMCRingBuffer")
+		       .Field("producers", producers).Field("consumers", consumers)
+		       .Field("items_per_sec", Median(boost::bind(
+		             &QueueRun<RingQueue>, producers, consumers)))
+		       .End();
+	}
+}
+//╚═════════════════════════    queue_throughput    ═══════════════════════════╝
+
+//╔═════════════════════════    pool_throughput     ═══════════════════════════╗
+class CountDownTask : public ThreadPool::Task
+{
+public:
+	CountDownTask(boost::atomic<size_t> *counter, size_t iterations)
+	                        : m_counter(counter), m_iterations(iterations){}
+	virtual ~CountDownTask(){}
+
+private:
+	void Execute()
+	{
+		// a few hundred dependent multiply-adds stand for a small task
+		volatile size_t sink = 0;
+		size_t value = 1;
+		for (size_t i = 0; i < m_iterations; ++i)
+		{
+			value = value * 31 + i;
+		}
+		sink = value;
+		(void)sink;
+
+		--(*m_counter);
+	}
+	boost::atomic<size_t> *m_counter;
+	size_t m_iterations;
+};
+
+static void ProduceTasks(ThreadPool *pool, shared_ptr<ThreadPool::Task> task,
+                         size_t amount)
+{
+	for (size_t i = 0; i < amount; ++i)
+	{
+		pool->AddTask(task);
+	}
+}
+
+static double PoolRun(ThreadPool::scheduling mode, size_t numOfThreads,
+                      size_t iterations)
+{
+	ThreadPool::Options options;
+	options.schedulingMode = mode;
+	ThreadPool pool(numOfThreads, options);
+
+	size_t tasks = g_tasksPerRun - g_tasksPerRun % PRODUCERS;
+	boost::atomic<size_t> counter(tasks);
+	shared_ptr<ThreadPool::Task> task(new CountDownTask(&counter, iterations));
+
+	steady_clock::time_point start = steady_clock::now();
+
+	boost::thread_group producers;
+	for (size_t i = 0; i < PRODUCERS; ++i)
+	{
+		producers.create_thread(boost::bind(&ProduceTasks, &pool, task,
+		                                    tasks / PRODUCERS));
+	}
+	producers.join_all();
+
+	while (0 != counter)
+	{
+		boost::this_thread::yield();
+	}
+
+	duration<double> elapsed = steady_clock::now() - start;
+	return (tasks / elapsed.count());
+}
+
+static void PoolThroughput()
+{
+	static const ThreadPool::scheduling MODES[] = {ThreadPool::SHARED_QUEUE,
+	                                               ThreadPool::WORK_STEALING};
+	static const size_t ITERATIONS[] = {0, SMALL_TASK_ITERATIONS};
+
+	JsonArray results("pool_throughput");
+	for (size_t m = 0; m < 2; ++m)
+	{
+		for (size_t t = 0; t < 2; ++t)
+		{
+			for (size_t i = 0;
+			     i < sizeof(THREAD_COUNTS) / sizeof(*THREAD_COUNTS); ++i)
+			{
+				results.Begin().Field("scheduling", SchedulingName(MODES[m]))
+				       .Field("task", (0 == ITERATIONS[t]) ? "empty" : "small")
+				       .Field("threads", THREAD_COUNTS[i])
+				       .Field("tasks_per_sec", Median(boost::bind(&PoolRun,
+				                   MODES[m], THREAD_COUNTS[i], ITERATIONS[t])))
+				       .End();
+			}
+		}
+	}
+}
+//╚═════════════════════════    pool_throughput     ═══════════════════════════╝
+
+//╔═════════════════════════     submit_latency     ═══════════════════════════╗
+static void SubmitLatency()
+{
+	static const ThreadPool::scheduling MODES[] = {ThreadPool::SHARED_QUEUE,
+	                                               ThreadPool::WORK_STEALING};
+
+	JsonArray results("submit_latency");
+	for (size_t m = 0; m < 2; ++m)
+	{
+		ThreadPool::Options options;
+		options.schedulingMode = MODES[m];
+		ThreadPool pool(4, options);
+
+		// one task at a time, so every sample pays for waking an idle worker
+		vector<double> samples;
+		samples.reserve(g_latencySamples);
+		for (size_t i = 0; i < g_latencySamples; ++i)
+		{
+			steady_clock::time_point submitted = steady_clock::now();
+			ThreadPool::Future<steady_clock::time_point> started =
+			                pool.Submit([]{ return steady_clock::now(); });
+
+			duration<double, boost::micro> latency = started.Get() - submitted;
+			samples.push_back(latency.count());
+		}
+		std::sort(samples.begin(), samples.end());
+
+		results.Begin().Field("scheduling", SchedulingName(MODES[m]))
+		       .Field("threads", 4)
+		       .Field("p50_us", Percentile(samples, 50))
+		       .Field("p90_us", Percentile(samples, 90))
+		       .Field("p99_us", Percentile(samples, 99))
+		       .Field("p999_us", Percentile(samples, 99.9))
+		       .Field("max_us", samples.back())
+		       .End();
+	}
+}
+//╚═════════════════════════     submit_latency     ═══════════════════════════╝
+
+//╔═════════════════════════         resize         ═══════════════════════════╗
+static void Resize()
+{
+	ThreadPool pool(RESIZE_SMALL);
+	duration<double, boost::micro> grow(0);
+	duration<double, boost::micro> shrink(0);
+
+	for (size_t i = 0; i < g_resizeRounds; ++i)
+	{
+		steady_clock::time_point start = steady_clock::now();
+		pool.SetNumOfThreads(RESIZE_LARGE);
+		steady_clock::time_point grown = steady_clock::now();
+		pool.SetNumOfThreads(RESIZE_SMALL);
+		steady_clock::time_point shrunk = steady_clock::now();
+
+		grow += grown - start;
+		shrink += shrunk - grown;
+	}
+
+	JsonArray results("resize");
+	results.Begin().Field("from", RESIZE_SMALL).Field("to", RESIZE_LARGE)
+	       .Field("mean_us", grow.count() / g_resizeRounds).End();
+	results.Begin().Field("from", RESIZE_LARGE).Field("to", RESIZE_SMALL)
+	       .Field("mean_us", shrink.count() / g_resizeRounds).End();
+}
+//╚═════════════════════════         resize         ═══════════════════════════╝
+
+int main(int argc, char **argv)
+{
+	if (1 < argc && 0 == strcmp(argv[1], "quick"))
+	{
+		g_itemsPerRun /= 16;
+		g_tasksPerRun /= 16;
+		g_latencySamples /= 16;
+		g_resizeRounds = 2;
+	}
+
+	cout << "{\n  \"hardware_threads\": "
+	     << boost::thread::hardware_concurrency() << ",\n";
+	QueueThroughput();
+	cout << ",\n";
+	PoolThroughput();
+	cout << ",\n";
+	SubmitLatency();
+	cout << ",\n";
+	Resize();
+	cout << "\n}" << endl;
+
+	return 0;
+}
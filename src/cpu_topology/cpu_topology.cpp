@@ -0,0 +1,184 @@
+/* welcome to cpu_topology.cpp */
+/******************************************************************************
+ * 																			  *
+ *							CREATED BY: Gil						              *
+ * 																		      *
+ ******************************************************************************/
+
+#include <fstream>                  // ifstream
+#include <sstream>                  // stringstream
+#include <cstdlib>                  // strtol
+#include <boost/thread.hpp>         // hardware_concurrency
+
+#ifdef __linux__
+#include <pthread.h>                // pthread_setaffinity_np
+#include <sched.h>                  // cpu_set_t
+#endif
+
+#include "cpu_topology.hpp"
+
+using std::string;
+using std::vector;
+
+//╔═══════════════════════   static utils and defs   ══════════════════════════╗
+static const char *const CPU_ONLINE_PATH = "/sys/devices/system/cpu/online";
+static const char *const NODE_CPULIST_PATH = "/sys/devices/system/node/node";
+// node numbers may have holes, give up only after this many missing in a row
+static const int MAX_MISSING_NODES = 8;
+
+static bool ReadLine(const string &path, string &line)
+{
+	std::ifstream file(path.c_str());
+	return (file && std::getline(file, line));
+}
+//╚═══════════════════════   static utils and defs   ══════════════════════════╝
+
+namespace GHS
+{
+namespace project
+{
+
+//╔═════════════════════════    CpuTopology(API)    ═══════════════════════════╗
+CpuTopology CpuTopology::Detect()
+{
+	vector<cpu_list> nodes;
+	string line;
+
+	for (int node = 0, missing = 0; missing < MAX_MISSING_NODES; ++node)
+	{
+		std::stringstream path;
+		path << NODE_CPULIST_PATH << node << "/cpulist";
+
+		if (!ReadLine(path.str(), line))
+		{
+			++missing;
+			continue;
+		}
+		missing = 0;
+
+		cpu_list cpus = ParseCpuList(line);
+		if (!cpus.empty()) // memory-only nodes hold no CPUs
+		{
+			nodes.push_back(cpus);
+		}
+	}
+
+	if (nodes.empty())
+	{
+		cpu_list cpus;
+		if (ReadLine(CPU_ONLINE_PATH, line))
+		{
+			cpus = ParseCpuList(line);
+		}
+		for (int cpu = 0; cpus.empty() &&
+		     cpu < static_cast<int>(boost::thread::hardware_concurrency());
+		     ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+		nodes.push_back(cpus);
+	}
+
+	return CpuTopology(nodes);
+}
+
+CpuTopology::CpuTopology(const vector<cpu_list> &nodes) : m_nodes(nodes)
+{
+	// empty
+}
+
+size_t CpuTopology::GetNumOfNodes() const
+{
+	return m_nodes.size();
+}
+
+const CpuTopology::cpu_list &CpuTopology::GetCpus(size_t node) const
+{
+	return m_nodes[node];
+}
+
+CpuTopology::cpu_list CpuTopology::GetAllCpus() const
+{
+	cpu_list all;
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		all.insert(all.end(), m_nodes[i].begin(), m_nodes[i].end());
+	}
+
+	return all;
+}
+
+size_t CpuTopology::GetNodeOf(int cpu) const
+{
+	for (size_t node = 0; node < m_nodes.size(); ++node)
+	{
+		for (size_t i = 0; i < m_nodes[node].size(); ++i)
+		{
+			if (cpu == m_nodes[node][i])
+			{
+				return node;
+			}
+		}
+	}
+
+	return m_nodes.size();
+}
+
+CpuTopology::cpu_list CpuTopology::ParseCpuList(const string &text)
+{
+	cpu_list cpus;
+	const char *runner = text.c_str();
+
+	while ('\0' != *runner)
+	{
+		char *end = NULL;
+		long first = strtol(runner, &end, 10);
+		if (end == runner)
+		{
+			break; // not a number, nothing more to read
+		}
+
+		long last = first;
+		runner = end;
+		if ('-' == *runner)
+		{
+			last = strtol(runner + 1, &end, 10);
+			runner = end;
+		}
+		for (long cpu = first; cpu <= last; ++cpu)
+		{
+			cpus.push_back(static_cast<int>(cpu));
+		}
+
+		if (',' == *runner)
+		{
+			++runner;
+		}
+	}
+
+	return cpus;
+}
+
+bool CpuTopology::PinCurrentThread(const cpu_list &cpus)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus.size(); ++i)
+	{
+		if (0 <= cpus[i] && cpus[i] < CPU_SETSIZE)
+		{
+			CPU_SET(cpus[i], &set);
+		}
+	}
+
+	return (0 != CPU_COUNT(&set) &&
+	        0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set));
+#else
+	(void)cpus;
+	return false;
+#endif
+}
+//╚═════════════════════════    CpuTopology(API)    ═══════════════════════════╝
+} // namespace project
+} // namespace GHS
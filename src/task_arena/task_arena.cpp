@@ -0,0 +1,411 @@
+/* welcome to task_arena.cpp */
+/******************************************************************************
+ * 																			  *
+ *							CREATED BY: Gil						              *
+ * 																		      *
+ ******************************************************************************/
+
+#include "task_arena.hpp"
+
+using boost::mutex;
+
+//╔═══════════════════════   static utils and defs   ══════════════════════════╗
+static boost::atomic<boost::uint64_t> s_nextArenaId(1);
+// the arenas alive, by id, for exiting threads to give their caches back to
+static mutex s_liveArenasMutex;
+static std::map<boost::uint64_t, GHS::project::TaskArena *> s_liveArenas;
+// the cache of the arena the calling thread used last
+static thread_local boost::uint64_t tls_arenaId = 0;
+static thread_local void *tls_cache = NULL;
+// set once the calling thread gave its caches back: it gets no new ones
+static thread_local bool tls_isExiting = false;
+
+// written by one thread only, so a plain store does
+static void CountOne(boost::atomic<size_t> &counter)
+{
+	counter.store(counter.load(boost::memory_order_relaxed) + 1,
+	              boost::memory_order_relaxed);
+}
+//╚═══════════════════════   static utils and defs   ══════════════════════════╝
+
+namespace GHS
+{
+namespace project
+{
+// ═════════════════════    TaskArena::ThreadCaches     ════════════════════════
+// one per thread, destroyed as the thread exits
+class TaskArena::ThreadCaches : private boost::noncopyable
+{
+public:
+	~ThreadCaches();
+
+	static ThreadCaches &OfThisThread();
+	void Add(boost::uint64_t arenaId);
+
+private:
+	ThreadCaches() = default;
+
+	std::vector<boost::uint64_t> m_arenaIds;
+	boost::thread::id m_thread;
+};
+
+//╔═════════════════════════     TaskArena(API)     ═══════════════════════════╗
+TaskArena::TaskArena(size_t blocksPerSlab)
+                            : m_blocksPerSlab(blocksPerSlab ? blocksPerSlab : 1),
+                              m_id(s_nextArenaId++),
+                              m_allocations(0), m_deallocations(0),
+                              m_slabAllocations(0), m_oversizeAllocations(0),
+                              m_bytesReserved(0)
+{
+	mutex::scoped_lock lock(s_liveArenasMutex);
+	s_liveArenas[m_id] = this;
+}
+
+TaskArena::~TaskArena()
+{
+	{
+		// an exiting thread releases its cache under the lock
+		mutex::scoped_lock lock(s_liveArenasMutex);
+		s_liveArenas.erase(m_id);
+	}
+
+	for (size_t i = 0; i < m_slabs.size(); ++i)
+	{
+		::operator delete(m_slabs[i]);
+	}
+}
+
+void *TaskArena::Allocate(size_t size, size_t alignment)
+{
+	size_t sizeClass = ClassOf(size);
+	if (NUM_OF_CLASSES == sizeClass || BLOCK_ALIGNMENT < alignment)
+	{
+		void *block = NewOversize(size, alignment);
+		++m_oversizeAllocations;
+		return block;
+	}
+
+	Cache *cache = GetCache();
+	if (NULL == cache)
+	{
+		// no cache to refill, take a single block straight from the list
+		SizeClass &target = m_classes[sizeClass];
+		mutex::scoped_lock lock(target.m_mutex);
+		while (NULL == target.m_freeList)
+		{
+			lock.unlock();
+			AddSlab(sizeClass);
+			lock.lock();
+		}
+		FreeBlock *block = target.m_freeList;
+		target.m_freeList = block->m_next;
+		++m_allocations;
+
+		return block;
+	}
+
+	if (NULL == cache->m_freeLists[sizeClass])
+	{
+		Refill(*cache, sizeClass);
+	}
+	FreeBlock *block = cache->m_freeLists[sizeClass];
+	cache->m_freeLists[sizeClass] = block->m_next;
+	--cache->m_numOfFree[sizeClass];
+	CountOne(cache->m_allocations);
+
+	return block;
+}
+
+void TaskArena::Deallocate(void *block, size_t size, size_t alignment) noexcept
+{
+	size_t sizeClass = ClassOf(size);
+	if (NUM_OF_CLASSES == sizeClass || BLOCK_ALIGNMENT < alignment)
+	{
+		DeleteOversize(block, alignment);
+		return;
+	}
+
+	FreeBlock *freed = static_cast<FreeBlock *>(block);
+	Cache *cache = GetCache();
+	if (NULL == cache)
+	{
+		SizeClass &target = m_classes[sizeClass];
+		mutex::scoped_lock lock(target.m_mutex);
+		freed->m_next = target.m_freeList;
+		target.m_freeList = freed;
+		++m_deallocations;
+		return;
+	}
+
+	freed->m_next = cache->m_freeLists[sizeClass];
+	cache->m_freeLists[sizeClass] = freed;
+	CountOne(cache->m_deallocations);
+	if (CACHE_LIMIT < ++cache->m_numOfFree[sizeClass])
+	{
+		Spill(*cache, sizeClass, CACHE_BATCH);
+	}
+}
+
+void TaskArena::Reserve(size_t size, size_t numOfBlocks)
+{
+	size_t sizeClass = ClassOf(size);
+	for (size_t reserved = 0;
+	     NUM_OF_CLASSES != sizeClass && reserved < numOfBlocks;
+	     reserved += m_blocksPerSlab)
+	{
+		AddSlab(sizeClass);
+	}
+}
+
+TaskArena::Stats TaskArena::GetStats() const
+{
+	Stats stats;
+	{
+		// released caches move their counters under the lock
+		mutex::scoped_lock lock(m_cachesMutex);
+		stats.allocations = m_allocations;
+		stats.deallocations = m_deallocations;
+		for (cache_map::const_iterator it = m_caches.begin();
+		     it != m_caches.end(); ++it)
+		{
+			if (it->second)
+			{
+				stats.allocations += it->second->m_allocations;
+				stats.deallocations += it->second->m_deallocations;
+			}
+		}
+	}
+	stats.slabAllocations = m_slabAllocations;
+	stats.oversizeAllocations = m_oversizeAllocations;
+	stats.bytesReserved = m_bytesReserved;
+
+	return stats;
+}
+//╚═════════════════════════     TaskArena(API)     ═══════════════════════════╝
+
+//╔═════════════════════════     TaskArena(IMP)     ═══════════════════════════╗
+TaskArena::Cache::Cache() : m_allocations(0), m_deallocations(0)
+{
+	for (size_t i = 0; i < NUM_OF_CLASSES; ++i)
+	{
+		m_freeLists[i] = NULL;
+		m_numOfFree[i] = 0;
+	}
+}
+
+size_t TaskArena::ClassOf(size_t size)
+{
+	size_t sizeClass = 0;
+	while (sizeClass < NUM_OF_CLASSES && BlockSize(sizeClass) < size)
+	{
+		++sizeClass;
+	}
+
+	return sizeClass;
+}
+
+size_t TaskArena::BlockSize(size_t sizeClass)
+{
+	return (static_cast<size_t>(SMALLEST_CLASS) << sizeClass);
+}
+
+void *TaskArena::NewOversize(size_t size, size_t alignment)
+{
+#ifdef __cpp_aligned_new
+	if (__STDCPP_DEFAULT_NEW_ALIGNMENT__ < alignment)
+	{
+		return ::operator new(size, std::align_val_t(alignment));
+	}
+#else
+	if (alignof(std::max_align_t) < alignment)
+	{
+		throw std::bad_alloc(); // no operator new to align it
+	}
+#endif
+
+	return ::operator new(size);
+}
+
+void TaskArena::DeleteOversize(void *block, size_t alignment) noexcept
+{
+#ifdef __cpp_aligned_new
+	if (__STDCPP_DEFAULT_NEW_ALIGNMENT__ < alignment)
+	{
+		::operator delete(block, std::align_val_t(alignment));
+		return;
+	}
+#else
+	(void)alignment;
+#endif
+
+	::operator delete(block);
+}
+
+TaskArena::Cache *TaskArena::GetCache() noexcept
+{
+	if (m_id == tls_arenaId)
+	{
+		return static_cast<Cache *>(tls_cache);
+	}
+	if (tls_isExiting)
+	{
+		return NULL;
+	}
+
+	try
+	{
+		mutex::scoped_lock lock(m_cachesMutex);
+		boost::shared_ptr<Cache> &cache =
+		                            m_caches[boost::this_thread::get_id()];
+		if (!cache)
+		{
+			ThreadCaches::OfThisThread().Add(m_id);
+			cache.reset(new Cache);
+		}
+		tls_arenaId = m_id;
+		tls_cache = cache.get();
+
+		return cache.get();
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void TaskArena::Refill(Cache &cache, size_t sizeClass)
+{
+	SizeClass &target = m_classes[sizeClass];
+	mutex::scoped_lock lock(target.m_mutex);
+	while (NULL == target.m_freeList)
+	{
+		lock.unlock();
+		AddSlab(sizeClass);
+		lock.lock();
+	}
+
+	FreeBlock *first = target.m_freeList;
+	FreeBlock *last = first;
+	size_t numOfTaken = 1;
+	for (; numOfTaken < CACHE_BATCH && NULL != last->m_next; ++numOfTaken)
+	{
+		last = last->m_next;
+	}
+	target.m_freeList = last->m_next;
+	lock.unlock();
+
+	last->m_next = cache.m_freeLists[sizeClass];
+	cache.m_freeLists[sizeClass] = first;
+	cache.m_numOfFree[sizeClass] += numOfTaken;
+}
+
+void TaskArena::Spill(Cache &cache, size_t sizeClass,
+                      size_t numOfBlocks) noexcept
+{
+	FreeBlock *first = cache.m_freeLists[sizeClass];
+	FreeBlock *last = first;
+	for (size_t i = 1; i < numOfBlocks; ++i)
+	{
+		last = last->m_next;
+	}
+	cache.m_freeLists[sizeClass] = last->m_next;
+	cache.m_numOfFree[sizeClass] -= numOfBlocks;
+
+	SizeClass &target = m_classes[sizeClass];
+	mutex::scoped_lock lock(target.m_mutex);
+	last->m_next = target.m_freeList;
+	target.m_freeList = first;
+}
+
+void TaskArena::ReleaseCache(boost::thread::id thread) noexcept
+{
+	boost::shared_ptr<Cache> cache;
+	{
+		mutex::scoped_lock lock(m_cachesMutex);
+		cache_map::iterator it = m_caches.find(thread);
+		if (m_caches.end() == it)
+		{
+			return;
+		}
+		cache.swap(it->second);
+		m_caches.erase(it);
+		if (!cache)
+		{
+			return;
+		}
+		m_allocations += cache->m_allocations;
+		m_deallocations += cache->m_deallocations;
+	}
+
+	for (size_t sizeClass = 0; sizeClass < NUM_OF_CLASSES; ++sizeClass)
+	{
+		if (0 != cache->m_numOfFree[sizeClass])
+		{
+			Spill(*cache, sizeClass, cache->m_numOfFree[sizeClass]);
+		}
+	}
+}
+
+void TaskArena::AddSlab(size_t sizeClass)
+{
+	// the slab is padded so that its first block (and so every block) is
+	// aligned to BLOCK_ALIGNMENT, more than operator new promises
+	size_t blockSize = BlockSize(sizeClass);
+	char *raw = static_cast<char *>(::operator new(blockSize * m_blocksPerSlab +
+	                                               BLOCK_ALIGNMENT - 1));
+	{
+		mutex::scoped_lock lock(m_slabsMutex);
+		m_slabs.push_back(raw);
+	}
+	++m_slabAllocations;
+	m_bytesReserved += blockSize * m_blocksPerSlab;
+	size_t misalignment = reinterpret_cast<size_t>(raw) % BLOCK_ALIGNMENT;
+	char *slab = raw + (misalignment ? BLOCK_ALIGNMENT - misalignment : 0);
+
+	// thread the new blocks into a list and splice it in front of the old one
+	for (size_t i = 0; i + 1 < m_blocksPerSlab; ++i)
+	{
+		reinterpret_cast<FreeBlock *>(slab + i * blockSize)->m_next =
+		              reinterpret_cast<FreeBlock *>(slab + (i + 1) * blockSize);
+	}
+	FreeBlock *last =
+	    reinterpret_cast<FreeBlock *>(slab + (m_blocksPerSlab - 1) * blockSize);
+
+	SizeClass &target = m_classes[sizeClass];
+	mutex::scoped_lock lock(target.m_mutex);
+	last->m_next = target.m_freeList;
+	target.m_freeList = reinterpret_cast<FreeBlock *>(slab);
+}
+// ═════════════════════    TaskArena::ThreadCaches     ════════════════════════
+TaskArena::ThreadCaches::~ThreadCaches()
+{
+	tls_isExiting = true; // whatever the thread frees from here on
+	tls_arenaId = 0;      // goes straight to the shared lists
+
+	mutex::scoped_lock lock(s_liveArenasMutex);
+	for (size_t i = 0; i < m_arenaIds.size(); ++i)
+	{
+		std::map<boost::uint64_t, TaskArena *>::iterator arena =
+		                                    s_liveArenas.find(m_arenaIds[i]);
+		if (s_liveArenas.end() != arena)
+		{
+			arena->second->ReleaseCache(m_thread);
+		}
+	}
+}
+
+TaskArena::ThreadCaches &TaskArena::ThreadCaches::OfThisThread()
+{
+	static thread_local ThreadCaches caches;
+	return caches;
+}
+
+void TaskArena::ThreadCaches::Add(boost::uint64_t arenaId)
+{
+	// the thread's id may be gone by the time its thread_locals are
+	m_thread = boost::this_thread::get_id();
+	m_arenaIds.push_back(arenaId);
+}
+//╚═════════════════════════     TaskArena(IMP)     ═══════════════════════════╝
+} // namespace project
+} // namespace GHS
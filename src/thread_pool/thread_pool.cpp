@@ -8,6 +8,9 @@
 #define BOOST_THREAD_PROVIDES_FUTURE //needed for boost::future to work
 
 #include <stdexcept>                // exceptions
+#include <iterator>                 // back_inserter
+#include <algorithm>                // count, remove_if, max
+#include <string>                   // to_string
 
 #include <boost/thread/future.hpp>  // future
 
@@ -29,34 +32,62 @@ using boost::future;
 using boost::promise;
 
 //╔═══════════════════════   static utils and defs   ══════════════════════════╗
-typedef map<thread::id, shared_ptr<thread> > thread_map;
+static const size_t DEFAULT_AGING_LIMIT = 64;
+static const size_t DEFAULT_QUEUE_CAPACITY = 128;
+static const size_t DEFAULT_SCALE_UP_DEPTH = 4;
+static const milliseconds DEFAULT_SCALE_UP_WAIT(10);
+static const milliseconds DEFAULT_KEEP_ALIVE(30000);
+static const milliseconds DEFAULT_SCALING_INTERVAL(50);
+static const milliseconds DEFAULT_TIMER_RESOLUTION(1);
+static const size_t DEFAULT_MAX_SPARE_THREADS = 16;
+// weight of the newest run in the moving average of run times, as 1 / N
+static const boost::int64_t RUN_TIME_SMOOTHING = 8;
+// chunks per thread (the caller's included) of the parallel algorithms'
+// default grain: enough to even out chunks that take longer than others
+static const size_t CHUNKS_PER_THREAD = 4;
+// tasks a strand runs per turn before it lets the rest of the queue through
+static const size_t TASKS_PER_STRAND_TURN = 64;
+
 class remove_me : public std::runtime_error
 {
 public:
 	explicit remove_me() : std::runtime_error(""){}
 };
 
-struct ThreadJoiner
-{
-    void operator()
-    (std::pair<boost::thread::id,boost::shared_ptr<boost::thread> > i)
-    {
-        i.second->join();
-    }
-};
+// the pool (and lane) the calling thread works for, if it is a worker at all
+static thread_local GHS::project::ThreadPool *tls_currentPool = NULL;
+static thread_local size_t tls_currentLane = 0;
+static thread_local const boost::atomic<bool> *tls_cancelFlag = NULL;
+// the calling worker's WorkerStats, private to ThreadPool
+static thread_local void *tls_workerStats = NULL;
+// BlockingRegions the calling worker is in, and whether it got a spare
+static thread_local size_t tls_blockingDepth = 0;
+static thread_local bool tls_hasSpare = false;
+// the priority of the task the calling thread runs
+static thread_local GHS::project::ThreadPool::Task::priority tls_currentPriority
+                                         (GHS::project::ThreadPool::Task::MEDIUM);
 
-static void MakeThreadCancelable()
+// sets tls_currentPriority for a scope, nested tasks restore the outer one
+class PriorityScope
 {
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-}
+public:
+	explicit PriorityScope(GHS::project::ThreadPool::Task::priority priority)
+	                                            : m_outer(tls_currentPriority)
+	{
+		tls_currentPriority = priority;
+	}
+	~PriorityScope()
+	{
+		tls_currentPriority = m_outer;
+	}
 
-static void KillThread(shared_ptr<thread> thrPtr)
-{
-	pthread_t toKill = thrPtr->native_handle();
+private:
+	GHS::project::ThreadPool::Task::priority m_outer;
+};
 
-	pthread_cancel(toKill);
-	pthread_join(toKill, NULL);
+static bool IsEmptyCpuList(const GHS::project::CpuTopology::cpu_list &cpus)
+{
+	return cpus.empty();
 }
 //╚═══════════════════════   static utils and defs   ══════════════════════════╝
 
@@ -66,49 +97,223 @@ namespace project
 {
 
 //╔═════════════════════════    ThreadPool(API)     ═══════════════════════════╗
-ThreadPool::ThreadPool(size_t numOfThreads): m_threadsArePaused(false)
+ThreadPool::ThreadPool(size_t numOfThreads, const Options &options)
+                                    : m_threadsArePaused(false),
+                                      m_numOfParkedThreads(0),
+                                      m_arena(new TaskArena()),
+                                      m_pauseTask(new PauseTask()),
+                                      m_TaskQueue(options.priorityAgingLimit,
+                                                 options.initialQueueCapacity),
+                                      m_nextLane(0),
+                                      m_workerBatchSize(options.workerBatchSize
+                                                  ? options.workerBatchSize : 1),
+                                      m_pendingTasks(0),
+                                      m_queueWaitLimit(options.maxQueueWait),
+                                      m_avgRunTime(0),
+                                      m_tasksExpired(0),
+                                      m_tasksShed(0),
+                                      m_tracer(options.tracer),
+                                      m_numOfLiveThreads(0),
+                                      m_hasReservations(false),
+                                      m_maxBorrowingRunTime(
+                                        options.maxBorrowingRunTime),
+                                      m_maxSpareThreads(
+                                        options.maxSpareThreads),
+                                      m_numOfSpareThreads(0),
+                                      m_numOfBlockedWorkers(0),
+                                      m_numOfCompensated(0),
+                                      m_numOfParkedSpares(0),
+                                      m_numOfSpareWakeups(0),
+                                      m_isShuttingDown(false),
+                                      m_numOfSurplus(0),
+                                      m_maxPendingTasks(
+                                        options.maxPendingTasks),
+                                      m_overflowPolicy(
+                                        options.overflowPolicy),
+                                      m_numOfBlockedProducers(0),
+                                      m_minThreads(options.minThreads),
+                                      m_maxThreads(options.maxThreads),
+                                      m_scaleUpQueueDepth(
+                                        options.scaleUpQueueDepth
+                                            ? options.scaleUpQueueDepth : 1),
+                                      m_scaleUpQueueWait(
+                                        options.scaleUpQueueWait),
+                                      m_keepAlive(options.keepAlive),
+                                      m_scalingInterval(
+                                        options.scalingInterval),
+                                      m_busyThreads(0),
+                                      m_maxQueueWait(0),
+                                      m_scalerIsRunning(IsAutoScaling()),
+                                      m_retiredStats(),
+                                      m_timerEpoch(steady_clock::now()),
+                                      m_timerResolution(
+                                        std::max(options.timerResolution,
+                                                 milliseconds(1))),
+                                      m_nextTimerId(0),
+                                      m_timersAreRunning(true)
 {
+	// a lane (or placement) per worker the pool may ever have
+	size_t numOfSlots = std::max(std::max(numOfThreads, m_maxThreads),
+	                             static_cast<size_t>(1));
+	if (WORK_STEALING == options.schedulingMode)
+	{
+		m_stealingQueue.reset(new WorkStealingQueue<shared_ptr<Task>,
+		                                            task_container>(numOfSlots,
+		                                          options.priorityAgingLimit,
+		                                          options.initialQueueCapacity));
+		m_stealingQueue->SetWaitStrategy(options.waitStrategy);
+	}
+	m_TaskQueue.SetWaitStrategy(options.waitStrategy);
+	m_TaskQueue.SetTracer(m_tracer, "task queue");
+	InitPlacement(options, numOfSlots);
+	InitReservations(options);
     AddThreads(numOfThreads);
+
+	if (IsAutoScaling())
+	{
+		m_scalerThread.reset(new thread(bind(&ThreadPool::RunAutoScaler,
+		                                     this)));
+	}
 }
 
 ThreadPool::~ThreadPool()
 {
-	size_t numOfThreads = GetNumOfThreads();
+	StopTimers();
+	StopAutoScaler();
+	Resume();
+	size_t numOfThreads = 0;
+	{
+		// parked spares end on their own, the others take a VoidTask
+		mutex::scoped_lock lock(m_mapMutex);
+		m_isShuttingDown = true;
+		m_spareSignal.notify_all();
+		numOfThreads = m_ThreadGroup.size() - m_numOfParkedSpares;
+	}
 
 	for (size_t i = 0; i < numOfThreads; ++i)
 	{
-		shared_ptr<Task> empty(new VoidTask());
-		m_TaskQueue.Push(empty);
+		PushTask(shared_ptr<Task>(new VoidTask()));
 	}
     JoinAllThreads();
+	JoinRetiredThreads();
 }
 
 void ThreadPool::AddTask(shared_ptr<Task> newTask)
 {
-	m_TaskQueue.Push(newTask);
+	if (!AdmitTasks(1))
+	{
+		RunOnCaller(newTask);
+		return;
+	}
+
+	newTask->m_enqueueTime = steady_clock::now();
+	TraceTask(Tracer::ENQUEUE, *newTask);
+	PushTask(std::move(newTask));
+}
+
+bool ThreadPool::Drain(steady_clock::time_point deadline)
+{
+	return WaitForPendingTasks(deadline);
+}
+
+ThreadPool::task_batch ThreadPool::Shutdown(shutdown_mode mode,
+                                            steady_clock::time_point deadline)
+{
+	task_batch unfinished;
+
+	if (CANCEL == mode)
+	{
+		RequestCancellation();
+		RemoveQueuedTasks(unfinished);
+	}
+
+	if (!WaitForPendingTasks(deadline))
+	{
+		RequestCancellation();
+		RemoveQueuedTasks(unfinished);
+		CollectRunningTasks(unfinished);
+	}
+	EndCancellation();
+
+	return unfinished;
 }
 
 void ThreadPool::Stop(milliseconds timeout)
 {
-	size_t numOfThreads = GetNumOfThreads();
+	Shutdown(CANCEL, steady_clock::now() + timeout);
+}
+
+ThreadPool::timer_id ThreadPool::AddTaskAfter(nanoseconds delay,
+                                              shared_ptr<Task> task)
+{
+	return AddTimer(steady_clock::now() + delay, nanoseconds(0),
+	                std::move(task));
+}
 
-	time_point<steady_clock> wakeupTime =
-			(steady_clock::now()+ milliseconds(timeout));
-	sleep_until(wakeupTime);
+ThreadPool::timer_id ThreadPool::AddTaskAt(steady_clock::time_point time,
+                                           shared_ptr<Task> task)
+{
+	return AddTimer(time, nanoseconds(0), std::move(task));
+}
 
-	KillAllThreads();
-    AddThreads(numOfThreads);
+ThreadPool::timer_id ThreadPool::AddPeriodic(nanoseconds interval,
+                                             shared_ptr<Task> task)
+{
+	return AddTimer(steady_clock::now() + interval, interval, std::move(task));
+}
+
+bool ThreadPool::CancelTimer(timer_id id)
+{
+	mutex::scoped_lock lock(m_timerMutex);
+	std::unordered_map<timer_id, shared_ptr<TimerRecord> >::iterator it =
+	                                                    m_activeTimers.find(id);
+	if (m_activeTimers.end() == it)
+	{
+		return false;
+	}
+
+	// the wheel drops it when its tick comes
+	it->second->m_isCancelled = true;
+	m_activeTimers.erase(it);
+	return true;
+}
+
+bool ThreadPool::IsCancellationRequested()
+{
+	return (NULL != tls_cancelFlag && *tls_cancelFlag);
+}
+
+void ThreadPool::Pause()
+{
+	m_threadsArePaused = true;
+
+	task_batch wakeups(GetNumOfAwakeThreads(), m_pauseTask);
+	PushTasks(wakeups.begin(), wakeups.end());
 }
 
-void ThreadPool::Pause() noexcept
+bool ThreadPool::Pause(steady_clock::time_point deadline)
 {
-    m_threadsArePaused = true;
+	Pause();
+
+	mutex::scoped_lock lock(m_conditionVariableMutex);
+	while (m_threadsArePaused &&
+	       m_numOfParkedThreads < GetNumOfAwakeThreads())
+	{
+		if (boost::cv_status::timeout ==
+		                            m_parkedSignal.wait_until(lock, deadline))
+		{
+			return (m_numOfParkedThreads >= GetNumOfAwakeThreads());
+		}
+	}
+
+	return m_threadsArePaused;
 }
 
 void ThreadPool::Resume() noexcept
 {
-    m_threadsArePaused = false;
-	m_conditionVariable.notify_all();
+	mutex::scoped_lock lock(m_conditionVariableMutex);
+	m_threadsArePaused = false;
+	m_conditionVariable.notify_all(); // only parked workers wait on it
 }
 
 void ThreadPool::SetNumOfThreads(size_t newNumOfThreads)
@@ -128,139 +333,1602 @@ void ThreadPool::SetNumOfThreads(size_t newNumOfThreads)
 size_t ThreadPool::GetNumOfThreads() const
 {
 	mutex::scoped_lock scopeLock(m_mapMutex);
-	return (m_ThreadGroup.size());
+	return (m_ThreadGroup.size() - m_numOfSpareThreads);
+}
+
+TaskArena::Stats ThreadPool::GetAllocatorStats() const
+{
+	return m_arena->GetStats();
+}
+
+ThreadPool::Stats ThreadPool::GetStats() const
+{
+	Stats stats;
+	{
+		mutex::scoped_lock lock(m_mapMutex);
+		stats = m_retiredStats;
+		stats.numOfThreads = m_ThreadGroup.size() - m_numOfSpareThreads;
+		stats.blockedThreads = m_numOfBlockedWorkers;
+		stats.spareThreads = m_numOfSpareThreads;
+		for (thread_map::const_iterator it = m_ThreadGroup.begin();
+		     it != m_ThreadGroup.end(); ++it)
+		{
+			AddWorkerStats(stats, it->second->m_stats);
+		}
+	}
+	AddWorkerStats(stats, m_callerStats);
+	stats.busyThreads = m_busyThreads;
+	stats.pendingTasks = m_pendingTasks;
+	stats.tasksExpired = m_tasksExpired;
+	stats.tasksShed = m_tasksShed;
+	{
+		mutex::scoped_lock lock(m_reserveMutex);
+		stats.heldTasks = m_heldTasks.size();
+	}
+	stats.queue = m_stealingQueue ? m_stealingQueue->GetStats()
+	                              : m_TaskQueue.GetStats();
+
+	return stats;
+}
+
+nanoseconds ThreadPool::GetEstimatedQueueWait() const
+{
+	size_t busy = m_busyThreads;
+	size_t pending = m_pendingTasks;
+	size_t queued = (pending > busy) ? pending - busy : 0;
+	size_t numOfThreads = std::max<size_t>(m_numOfLiveThreads, 1);
+
+	return nanoseconds(m_avgRunTime * static_cast<boost::int64_t>(queued) /
+	                   static_cast<boost::int64_t>(numOfThreads));
 }
 //╚═════════════════════════    ThreadPool(API)     ═══════════════════════════╝
 
 //╔═════════════════════════    ThreadPool(IMP)     ═══════════════════════════╗
-void ThreadPool::InitAndRunThread()
+void ThreadPool::InitAndRunThread(shared_ptr<Worker> worker)
 {
-	MakeThreadCancelable();
-	shared_ptr<Task> current;
+	size_t lane = m_nextLane++;
+	if (m_stealingQueue)
+	{
+		lane %= m_stealingQueue->GetNumOfLanes();
+	}
+	if (!m_placements.empty())
+	{
+		CpuTopology::PinCurrentThread(m_placements[lane % m_placements.size()]);
+	}
+	tls_currentPool = this;
+	tls_currentLane = lane;
+	tls_cancelFlag = &worker->m_cancelRequested;
+	tls_workerStats = &worker->m_stats;
+	if (NULL != m_tracer)
+	{
+		m_tracer->SetThreadName("worker " + std::to_string(lane));
+	}
+
+	task_batch batch;
+	batch.reserve(m_workerBatchSize);
 	bool ThreadIsAlive = true;
 	while(ThreadIsAlive)
 	{
-		bool Execute = true;
-		m_TaskQueue.Pop(current);
-		while (m_threadsArePaused)
+		if (0 != m_numOfSurplus.load(boost::memory_order_relaxed) &&
+		    !ParkSpare())
 		{
-			mutex::scoped_lock lock(m_conditionVariableMutex);
-			m_conditionVariable.wait(lock); //waits for notify all
-			m_TaskQueue.Push(current);
-			Execute = false;
+			ThreadIsAlive = false;
+			continue;
 		}
-		try
+
+		steady_clock::time_point idleSince = steady_clock::now();
+		WaitAtPauseGate();
+		bool hasTasks = PopTasks(batch, lane);
+		RecordIdleTime(worker->m_stats, steady_clock::now() - idleSince);
+		if (!hasTasks)
 		{
-			if (Execute)
-			{
-				current->Execute();
-			}
+			ThreadIsAlive = !TryRetire();
+			continue;
 		}
-		catch (remove_me &except)
+		for (size_t i = 0; i < batch.size(); ++i)
 		{
-			ThreadIsAlive = false;
+			TraceTask(Tracer::DEQUEUE, *batch[i]);
+		}
+
+		// a worker parks once per pause; extra PauseTasks are for the others
+		size_t numOfPauseTasks = std::count(batch.begin(), batch.end(),
+		                                    m_pauseTask);
+		if (1 < numOfPauseTasks)
+		{
+			task_batch extras(numOfPauseTasks - 1, m_pauseTask);
+			PushTasks(extras.begin(), extras.end());
+		}
+
+		task_batch::const_iterator current = batch.begin();
+		while (ThreadIsAlive && current != batch.end())
+		{
+			ThreadIsAlive = RunTask(*worker, *current);
+			++current;
 		}
+
+		// whatever the thread's removal left unexecuted goes back
+		PushTasks(current, batch.end());
+		batch.clear();
 	}
 }
 
+void ThreadPool::InitPlacement(const Options &options, size_t numOfSlots)
+{
+	if (NO_PLACEMENT == options.placementPolicy)
+	{
+		return;
+	}
+
+	CpuTopology topology = CpuTopology::Detect();
+	CpuTopology::cpu_list allowed = options.cpuSet.empty()
+	                                ? topology.GetAllCpus() : options.cpuSet;
+
+	if (PIN_TO_CPUS == options.placementPolicy)
+	{
+		for (size_t i = 0; i < allowed.size(); ++i)
+		{
+			m_placements.push_back(CpuTopology::cpu_list(1, allowed[i]));
+		}
+		return;
+	}
+
+	// the allowed CPUs of every node that has any
+	std::vector<CpuTopology::cpu_list> nodes(topology.GetNumOfNodes());
+	for (size_t i = 0; i < allowed.size(); ++i)
+	{
+		size_t node = topology.GetNodeOf(allowed[i]);
+		if (node < nodes.size())
+		{
+			nodes[node].push_back(allowed[i]);
+		}
+	}
+	nodes.erase(std::remove_if(nodes.begin(), nodes.end(), IsEmptyCpuList),
+	            nodes.end());
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	// contiguous slots share a node, so lane neighbours are node neighbours
+	std::vector<size_t> nodeOfSlot(numOfSlots);
+	for (size_t slot = 0; slot < numOfSlots; ++slot)
+	{
+		nodeOfSlot[slot] = slot * nodes.size() / numOfSlots;
+		m_placements.push_back(nodes[nodeOfSlot[slot]]);
+	}
+	if (m_stealingQueue)
+	{
+		m_stealingQueue->SetLaneGroups(nodeOfSlot);
+	}
+}
 
-void ThreadPool::KillAllThreads()
+bool ThreadPool::RunTask(Worker &worker, const shared_ptr<Task> &task)
 {
-	mutex::scoped_lock scopeLock(m_mapMutex);
-	thread_map::iterator next_it;
-	for (thread_map::iterator it = m_ThreadGroup.begin(), next_it = it;
-	     it != m_ThreadGroup.end();
-	     it = next_it)
+	if (!task->m_isControl && !ClaimWorker(task, false))
+	{
+		return true; // held back, the worker moves on
+	}
+
+	bool threadIsAlive = true;
 	{
-		next_it++;
-		KillThread(it->second);
-		m_ThreadGroup.erase(it);
+		mutex::scoped_lock lock(worker.m_currentMutex);
+		worker.m_current = task;
 	}
+	if (task->m_isControl)
+	{
+		try
+		{
+			task->Execute();
+		}
+		catch (remove_me &except)
+		{
+			threadIsAlive = false;
+		}
+	}
+	else
+	{
+		RunClaimed(task, true);
+	}
+
+	{
+		mutex::scoped_lock lock(worker.m_currentMutex);
+		worker.m_current.reset();
+		worker.m_cancelRequested = false; // it was meant for this task only
+	}
+
+	return threadIsAlive;
 }
 
-void ThreadPool::AddThreads(size_t threadAmountToAdd)
+void ThreadPool::RunClaimed(const shared_ptr<Task> &task, bool countAsBusy)
 {
-	mutex::scoped_lock lock(m_mapMutex);
-	for (size_t i = 0; i < threadAmountToAdd; ++i)
+	if (countAsBusy)
 	{
-		shared_ptr<thread> threadPtr(new thread
-                             (bind(&ThreadPool::InitAndRunThread, this)));
-		m_ThreadGroup[threadPtr->get_id()] = threadPtr;
+		++m_busyThreads;
+	}
+	std::exception_ptr exception = RunMeasured(*task); // rethrown once counted
+	ReleaseWorker(task->m_priority);
+	if (countAsBusy)
+	{
+		--m_busyThreads;
+	}
+	TasksDone(1);
+
+	if (exception)
+	{
+		std::rethrow_exception(exception);
 	}
 }
 
-void ThreadPool::ReducePoolSize(size_t numToRemove)
+std::exception_ptr ThreadPool::RunMeasured(Task &task)
 {
-	for (size_t i = 0; i < numToRemove; ++i)
+	steady_clock::time_point start = steady_clock::now();
+	nanoseconds queueWait = start - task.m_enqueueTime;
+	NoteQueueWait(queueWait);
+
+	bool isExpired = false;
+	std::exception_ptr exception;
+	TraceTask(Tracer::START, task);
+	try
 	{
-		shared_ptr<promise<thread::id> > prom(new promise<thread::id>());
-		future<thread::id> threadFuture = prom->get_future();
+		isExpired = !ExecuteOrExpire(task, start);
+	}
+	catch (...)
+	{
+		exception = std::current_exception();
+	}
+	TraceTask(Tracer::FINISH, task);
+	if (task.m_timerInFlight)
+	{
+		task.m_timerInFlight->store(false, boost::memory_order_release);
+	}
 
-		AddCloseThreadTask(prom);
-		thread::id threadId = threadFuture.get();
+	// a carrier's run is the runs of what it carries, recorded one by one
+	if (!isExpired && !task.m_isCarrier)
+	{
+		nanoseconds runTime = steady_clock::now() - start;
+		RecordRun(task, queueWait, runTime);
+		NoteRunTime(task.m_priority, runTime);
+	}
+
+	return exception;
+}
 
-		shared_ptr<thread> threadToJoin = EraseThread(threadId);
-		threadToJoin->join();
+void ThreadPool::RunOnCaller(const shared_ptr<Task> &task)
+{
+	// counted as pending like a queued task, so RunClaimed (or the worker a
+	// held task goes to) counts it done the same way
+	++m_pendingTasks;
+	task->m_enqueueTime = steady_clock::now();
+	size_t lane = 0;
+	bool isWorker = GetOwnLane(lane);
+	if (ClaimWorker(task, isWorker))
+	{
+		RunClaimed(task, !isWorker); // a worker is counted already
 	}
 }
 
-shared_ptr<thread> ThreadPool::EraseThread(thread::id id)
+void ThreadPool::RecordRun(const Task &task, nanoseconds queueWait,
+                           nanoseconds runTime)
 {
-	mutex::scoped_lock lock(m_mapMutex);
-	thread_map::iterator it = m_ThreadGroup.find(id);
-	shared_ptr<thread> threadPtr(it->second);
-	m_ThreadGroup.erase(it);
-	return threadPtr;
+	if (this == tls_currentPool)
+	{
+		RecordTask(*static_cast<WorkerStats *>(tls_workerStats), task,
+		           queueWait, runTime);
+		return;
+	}
+
+	mutex::scoped_lock lock(m_callerStatsMutex);
+	RecordTask(m_callerStats, task, queueWait, runTime);
 }
 
-void ThreadPool::JoinAllThreads()
+bool ThreadPool::RunQueuedTask()
 {
-    std::for_each(m_ThreadGroup.begin(), m_ThreadGroup.end(), ThreadJoiner());
+	if (m_threadsArePaused)
+	{
+		return false;
+	}
+
+	shared_ptr<Task> task;
+	size_t lane = 0;
+	bool isWorker = GetOwnLane(lane);
+	// tasks meant for a worker's own loop are set aside, and queued again
+	// once a task this thread may run is found (or none is left)
+	task_batch setAside;
+	for (;;)
+	{
+		if (!(m_stealingQueue ? m_stealingQueue->Pop(task, lane,
+		                                             nanoseconds(0))
+		                      : m_TaskQueue.Pop(task, nanoseconds(0))))
+		{
+			task.reset();
+			break;
+		}
+		if (!task->m_isControl && (isWorker || !task->m_isWorkerOnly))
+		{
+			break;
+		}
+		setAside.push_back(std::move(task));
+	}
+	for (size_t i = 0; i < setAside.size(); ++i)
+	{
+		PushTask(std::move(setAside[i]));
+	}
+	if (!task)
+	{
+		return false;
+	}
+
+	// a helping worker is counted as busy already, and runs the task in its
+	// own place
+	TraceTask(Tracer::DEQUEUE, *task);
+	if (ClaimWorker(task, isWorker))
+	{
+		RunClaimed(task, !isWorker);
+	}
+
+	return true;
 }
 
-void ThreadPool::AddCloseThreadTask(shared_ptr<promise<thread::id> > promise)
+bool ThreadPool::ExecuteOrExpire(Task &task, steady_clock::time_point now)
 {
-	shared_ptr<Task> closingTask(new ThreadCloser(promise));
-	m_TaskQueue.Push(closingTask);
+	if (task.m_deadline < now)
+	{
+		++m_tasksExpired;
+		task.OnExpired();
+		return false;
+	}
+
+	PriorityScope scope(task.m_priority);
+	task.Execute();
+	return true;
 }
 
-// ═════════════════════════    ThreadPool::Task     ═══════════════════════════
-ThreadPool::Task::Task(ThreadPool::Task::priority priority): m_priority(priority)
+ThreadPool::Task::priority ThreadPool::GetCurrentPriority()
 {
-	// empty
+	return tls_currentPriority;
 }
 
-ThreadPool::Task::~Task()
+void ThreadPool::NoteRunTime(Task::priority priority, nanoseconds runTime)
 {
-	// empty
+	// racing workers may drop each other's sample, an average can afford it
+	boost::int64_t average = m_avgRunTime.load(boost::memory_order_relaxed);
+	m_avgRunTime.store(average + (runTime.count() - average) /
+	                   RUN_TIME_SMOOTHING, boost::memory_order_relaxed);
+
+	// a level's first sample is its average, not an eighth of it
+	average = m_avgRunTimeOf[priority].load(boost::memory_order_relaxed);
+	if (0 != m_numOfRunsOf[priority].load(boost::memory_order_relaxed))
+	{
+		average += (runTime.count() - average) / RUN_TIME_SMOOTHING;
+	}
+	else
+	{
+		average = runTime.count();
+	}
+	m_avgRunTimeOf[priority].store(average, boost::memory_order_relaxed);
+	m_numOfRunsOf[priority].fetch_add(1, boost::memory_order_release);
 }
 
-bool ThreadPool::Task::operator<(const ThreadPool::Task &other) const noexcept
+void ThreadPool::InitReservations(const Options &options)
 {
-	return (m_priority < other.m_priority);
+	size_t numOfLevels = std::min<size_t>(options.reservedThreads.size(),
+	                                      Stats::NUM_OF_PRIORITIES);
+	size_t reserved = 0;
+	for (size_t level = Stats::NUM_OF_PRIORITIES; 0 < level--; )
+	{
+		if (level < numOfLevels)
+		{
+			reserved += options.reservedThreads[level];
+		}
+		m_reservedFrom[level] = reserved;
+		m_avgRunTimeOf[level] = 0;
+		m_numOfRunsOf[level] = 0;
+		m_numOfRunning[level] = 0;
+	}
+	m_hasReservations = (0 != reserved);
 }
-// ═══════════════════    ThreadPool::ThreadCloser     ═════════════════════════
-ThreadPool::ThreadCloser::ThreadCloser(shared_ptr<promise<thread::id> > prom)
-										: Task(SUPREME), m_threadToRemove(prom)
+
+bool ThreadPool::ClaimWorker(const shared_ptr<Task> &task, bool isOwnWorker)
 {
-	// empty
+	if (!m_hasReservations)
+	{
+		return true;
+	}
+
+	mutex::scoped_lock lock(m_reserveMutex);
+	if (!isOwnWorker && !CanStart(task->m_priority))
+	{
+		// a task of a lower level runs, its ReleaseWorker gets to this one
+		m_heldTasks.push(task);
+		return false;
+	}
+	++m_numOfRunning[task->m_priority];
+
+	return true;
 }
 
-void ThreadPool::ThreadCloser::Execute()
+void ThreadPool::ReleaseWorker(Task::priority priority)
 {
-	m_threadToRemove->set_value(get_id());
-	throw remove_me();
+	if (!m_hasReservations)
+	{
+		return;
+	}
+
+	{
+		mutex::scoped_lock lock(m_reserveMutex);
+		--m_numOfRunning[priority];
+	}
+	ReleaseHeldTasks();
 }
-// ═══════════════════    ThreadPool::VoidTask     ═════════════════════════════
-ThreadPool::VoidTask::VoidTask() : Task(static_cast<priority>(LOW - 1))
+
+void ThreadPool::ReleaseHeldTasks()
 {
-	// empty
+	if (!m_hasReservations)
+	{
+		return;
+	}
+
+	std::vector<shared_ptr<Task> > released;
+	{
+		mutex::scoped_lock lock(m_reserveMutex);
+		// the front is of the highest level held, the least restricted one.
+		// each task released counts as running meanwhile, so no more are
+		// released than could start
+		while (!m_heldTasks.empty() &&
+		       CanStart(m_heldTasks.front()->m_priority))
+		{
+			++m_numOfRunning[m_heldTasks.front()->m_priority];
+			released.push_back(std::move(m_heldTasks.front()));
+			m_heldTasks.pop();
+		}
+		for (size_t i = 0; i < released.size(); ++i)
+		{
+			--m_numOfRunning[released[i]->m_priority];
+		}
+	}
+	for (size_t i = 0; i < released.size(); ++i)
+	{
+		PushTask(std::move(released[i])); // still counted as pending
+	}
 }
 
+bool ThreadPool::CanStart(Task::priority priority) const
+{
+	// a level borrows once it has run at least once, it has no average before
+	if (0 != m_maxBorrowingRunTime.count() &&
+	    0 != m_numOfRunsOf[priority].load(boost::memory_order_acquire) &&
+	    m_avgRunTimeOf[priority] <= m_maxBorrowingRunTime.count())
+	{
+		return true; // short enough to borrow reserved workers
+	}
 
-void ThreadPool::VoidTask::Execute()
+	// every level above the task's may not find fewer free workers than it
+	// reserves, though the levels below it keep a worker between them
+	size_t numOfThreads = m_numOfLiveThreads;
+	size_t numOfRunningBelow = 0;
+	for (size_t level = 0; level < Stats::NUM_OF_PRIORITIES; ++level)
+	{
+		if (level > static_cast<size_t>(priority))
+		{
+			size_t unreserved = (numOfThreads > m_reservedFrom[level])
+			                    ? numOfThreads - m_reservedFrom[level] : 0;
+			if (numOfRunningBelow >= std::max<size_t>(unreserved, 1))
+			{
+				return false;
+			}
+		}
+		numOfRunningBelow += m_numOfRunning[level];
+	}
+
+	return true;
+}
+
+size_t ThreadPool::GrainOf(size_t numOfIndices, size_t grain) const
 {
-	throw remove_me();
+	if (0 != grain)
+	{
+		return grain;
+	}
+
+	size_t numOfChunks = CHUNKS_PER_THREAD * (GetNumOfThreads() + 1);
+	return std::max(numOfIndices / numOfChunks, static_cast<size_t>(1));
+}
+
+void ThreadPool::WaitAtPauseGate()
+{
+	if (!m_threadsArePaused)
+	{
+		return;
+	}
+
+	mutex::scoped_lock lock(m_conditionVariableMutex);
+	++m_numOfParkedThreads;
+	m_parkedSignal.notify_all();
+	while (m_threadsArePaused)
+	{
+		m_conditionVariable.wait(lock); //waits for notify all
+	}
+	--m_numOfParkedThreads;
+}
+
+void ThreadPool::EnqueueTask(shared_ptr<Task> task)
+{
+	++m_pendingTasks;
+	task->m_enqueueTime = steady_clock::now();
+	TraceTask(Tracer::ENQUEUE, *task);
+	PushTask(std::move(task));
+}
+
+void ThreadPool::StartStrand(shared_ptr<StrandState> state,
+                             Task::priority priority)
+{
+	EnqueueTask(MakeTask<StrandTurn>(this, state, priority));
+}
+
+bool ThreadPool::AdmitTasks(size_t numOfTasks)
+{
+	ShedIfOverloaded(numOfTasks);
+	if (0 == m_maxPendingTasks)
+	{
+		m_pendingTasks += numOfTasks;
+		return true;
+	}
+	if (TryReserve(numOfTasks))
+	{
+		return true;
+	}
+
+	size_t lane = 0;
+	if (REJECT == m_overflowPolicy)
+	{
+		throw QueueFull();
+	}
+	if (CALLER_RUNS == m_overflowPolicy || GetOwnLane(lane))
+	{
+		return false;
+	}
+
+	// TasksDone lowers the count before it reads m_numOfBlockedProducers,
+	// and a producer raises that before it tries again, so one of the two
+	// sees the other
+	mutex::scoped_lock lock(m_roomMutex);
+	++m_numOfBlockedProducers;
+	while (!TryReserve(numOfTasks))
+	{
+		m_roomSignal.wait(lock);
+	}
+	--m_numOfBlockedProducers;
+
+	return true;
+}
+
+void ThreadPool::ShedIfOverloaded(size_t numOfTasks)
+{
+	size_t lane = 0;
+	if (0 != m_queueWaitLimit.count() && !GetOwnLane(lane) &&
+	    GetEstimatedQueueWait() > m_queueWaitLimit)
+	{
+		m_tasksShed += numOfTasks;
+		throw Overloaded();
+	}
+}
+
+bool ThreadPool::TryReserve(size_t numOfTasks)
+{
+	size_t pending = m_pendingTasks;
+
+	// a batch larger than the whole capacity gets in on an empty pool
+	while (0 == pending || pending + numOfTasks <= m_maxPendingTasks)
+	{
+		if (m_pendingTasks.compare_exchange_weak(pending,
+		                                         pending + numOfTasks))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::PushTask(shared_ptr<Task> task)
+{
+	if (!m_stealingQueue)
+	{
+		m_TaskQueue.Push(std::move(task));
+	}
+	else if (this == tls_currentPool)
+	{
+		// a task spawned by one of our workers stays on that worker's lane
+		m_stealingQueue->Push(std::move(task), tls_currentLane);
+	}
+	else
+	{
+		m_stealingQueue->Push(std::move(task));
+	}
+}
+
+void ThreadPool::PushTasks(task_batch::const_iterator first,
+                           task_batch::const_iterator last)
+{
+	if (first != last)
+	{
+		PushTaskRange(first, last); // already counted as pending
+	}
+}
+
+bool ThreadPool::PopTasks(task_batch &out, size_t lane)
+{
+	if (IsAutoScaling())
+	{
+		return (0 != (m_stealingQueue
+		    ? m_stealingQueue->PopBatch(std::back_inserter(out),
+		                                m_workerBatchSize, lane, m_keepAlive)
+		    : m_TaskQueue.PopBatch(std::back_inserter(out), m_workerBatchSize,
+		                           m_keepAlive)));
+	}
+
+	if (m_stealingQueue)
+	{
+		m_stealingQueue->PopBatch(std::back_inserter(out), m_workerBatchSize,
+		                          lane);
+	}
+	else
+	{
+		m_TaskQueue.PopBatch(std::back_inserter(out), m_workerBatchSize);
+	}
+
+	return true;
+}
+
+bool ThreadPool::GetOwnLane(size_t &lane) const
+{
+	if (this != tls_currentPool)
+	{
+		return false;
+	}
+
+	lane = tls_currentLane;
+	return true;
+}
+
+void ThreadPool::TasksDone(size_t numOfTasks)
+{
+	if (0 == numOfTasks)
+	{
+		return;
+	}
+
+	if (0 == (m_pendingTasks -= numOfTasks))
+	{
+		mutex::scoped_lock lock(m_idleMutex);
+		m_idleSignal.notify_all();
+	}
+	if (0 != m_numOfBlockedProducers)
+	{
+		mutex::scoped_lock lock(m_roomMutex);
+		m_roomSignal.notify_all();
+	}
+}
+
+bool ThreadPool::WaitForPendingTasks(steady_clock::time_point deadline)
+{
+	mutex::scoped_lock lock(m_idleMutex);
+	while (0 != m_pendingTasks)
+	{
+		if (boost::cv_status::timeout == m_idleSignal.wait_until(lock, deadline))
+		{
+			return (0 == m_pendingTasks);
+		}
+	}
+
+	return true;
+}
+
+void ThreadPool::RemoveQueuedTasks(task_batch &removed)
+{
+	task_batch queued;
+	if (m_stealingQueue)
+	{
+		m_stealingQueue->TryPopAll(std::back_inserter(queued));
+	}
+	else
+	{
+		m_TaskQueue.PopBatch(std::back_inserter(queued),
+		                     static_cast<size_t>(-1), nanoseconds(0));
+	}
+
+	{
+		mutex::scoped_lock lock(m_reserveMutex);
+		for (; !m_heldTasks.empty(); m_heldTasks.pop())
+		{
+			queued.push_back(std::move(m_heldTasks.front()));
+		}
+	}
+
+	// threads being removed still need their control tasks, and tasks kept
+	// by OnDropped still run. carriers add what they carry, which is handed
+	// back but was never counted pending
+	size_t numOfQueued = queued.size();
+	size_t numOfRemoved = 0;
+	for (size_t i = 0; i < queued.size(); ++i)
+	{
+		shared_ptr<Task> task = std::move(queued[i]); // OnDropped may grow it
+		if (task->m_isControl)
+		{
+			PushTask(std::move(task));
+			continue;
+		}
+
+		if (task->OnDropped(queued))
+		{
+			PushTask(std::move(task));
+			continue;
+		}
+		if (task->m_timerInFlight)
+		{
+			// the timer's next tick queues it again
+			task->m_timerInFlight->store(false, boost::memory_order_release);
+		}
+		if (i < numOfQueued)
+		{
+			++numOfRemoved;
+		}
+		if (!task->m_isCarrier)
+		{
+			removed.push_back(std::move(task));
+		}
+	}
+	TasksDone(numOfRemoved);
+}
+
+void ThreadPool::RequestCancellation()
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	for (thread_map::iterator it = m_ThreadGroup.begin();
+	     it != m_ThreadGroup.end(); ++it)
+	{
+		it->second->m_cancelRequested = true;
+	}
+}
+
+void ThreadPool::CollectRunningTasks(task_batch &running)
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	for (thread_map::iterator it = m_ThreadGroup.begin();
+	     it != m_ThreadGroup.end(); ++it)
+	{
+		mutex::scoped_lock currentLock(it->second->m_currentMutex);
+		if (it->second->m_current && !it->second->m_current->m_isControl &&
+		    !it->second->m_current->m_isCarrier)
+		{
+			running.push_back(it->second->m_current);
+		}
+	}
+}
+
+void ThreadPool::EndCancellation()
+{
+	// busy workers keep the request until the task they run returns
+	mutex::scoped_lock lock(m_mapMutex);
+	for (thread_map::iterator it = m_ThreadGroup.begin();
+	     it != m_ThreadGroup.end(); ++it)
+	{
+		mutex::scoped_lock currentLock(it->second->m_currentMutex);
+		if (!it->second->m_current)
+		{
+			it->second->m_cancelRequested = false;
+		}
+	}
+}
+
+bool ThreadPool::IsAutoScaling() const
+{
+	return (0 != m_maxThreads);
+}
+
+void ThreadPool::RunAutoScaler()
+{
+	mutex::scoped_lock lock(m_scalerMutex);
+	for (;;)
+	{
+		m_scalerSignal.wait_for(lock, m_scalingInterval);
+		{
+			mutex::scoped_lock mapLock(m_mapMutex);
+			if (!m_scalerIsRunning)
+			{
+				return;
+			}
+		}
+
+		if (!m_threadsArePaused)
+		{
+			ScaleUp();
+		}
+		JoinRetiredThreads();
+	}
+}
+
+void ThreadPool::StopAutoScaler()
+{
+	{
+		// also stops workers from retiring, so the map holds still from here
+		mutex::scoped_lock mapLock(m_mapMutex);
+		m_scalerIsRunning = false;
+	}
+
+	if (m_scalerThread)
+	{
+		{
+			mutex::scoped_lock lock(m_scalerMutex);
+			m_scalerSignal.notify_all();
+		}
+		m_scalerThread->join();
+	}
+}
+
+void ThreadPool::ScaleUp()
+{
+	size_t numOfThreads = GetNumOfThreads();
+	size_t busy = m_busyThreads;
+	size_t pending = m_pendingTasks;
+	size_t queued = (pending > busy) ? pending - busy : 0;
+	nanoseconds maxWait(m_maxQueueWait.exchange(0));
+
+	if (numOfThreads >= m_maxThreads)
+	{
+		return;
+	}
+
+	// enough workers to bring the depth under the limit, at least one
+	size_t wanted = (queued + m_scaleUpQueueDepth - 1) / m_scaleUpQueueDepth;
+	if (queued > numOfThreads * m_scaleUpQueueDepth)
+	{
+		AddThreads(std::min(m_maxThreads, wanted) - numOfThreads);
+	}
+	else if (0 != queued && maxWait > m_scaleUpQueueWait)
+	{
+		AddThreads(1);
+	}
+}
+
+void ThreadPool::NoteQueueWait(nanoseconds queueWait)
+{
+	if (!IsAutoScaling())
+	{
+		return;
+	}
+
+	boost::int64_t wait = queueWait.count();
+	boost::int64_t maxWait = m_maxQueueWait.load(boost::memory_order_relaxed);
+	while (wait > maxWait &&
+	       !m_maxQueueWait.compare_exchange_weak(maxWait, wait,
+	                                             boost::memory_order_relaxed))
+	{
+		// maxWait was reloaded, try again
+	}
+}
+
+bool ThreadPool::TryRetire()
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	if (!m_scalerIsRunning)
+	{
+		return false;
+	}
+	if (0 != m_numOfSurplus)
+	{
+		// it leaves as the spare that was to park
+		--m_numOfSurplus;
+		--m_numOfSpareThreads;
+	}
+	else if (m_ThreadGroup.size() - m_numOfSpareThreads <= m_minThreads)
+	{
+		return false;
+	}
+
+	RetireCurrentThread();
+	return true;
+}
+
+void ThreadPool::RetireCurrentThread()
+{
+	// the scaler (or the destructor) joins it, a thread can't join itself
+	thread_map::iterator it = m_ThreadGroup.find(get_id());
+	AddWorkerStats(m_retiredStats, it->second->m_stats);
+	m_retiredWorkers.push_back(it->second);
+	m_ThreadGroup.erase(it);
+	--m_numOfLiveThreads;
+}
+
+void ThreadPool::JoinRetiredThreads()
+{
+	std::vector<shared_ptr<Worker> > retired;
+	{
+		mutex::scoped_lock lock(m_mapMutex);
+		retired.swap(m_retiredWorkers);
+	}
+
+	for (size_t i = 0; i < retired.size(); ++i)
+	{
+		retired[i]->m_thread->join();
+	}
+}
+
+void ThreadPool::BeginBlocking()
+{
+	ThreadPool *pool = tls_currentPool;
+	if (NULL == pool || 0 != tls_blockingDepth++)
+	{
+		return;
+	}
+
+	pool->JoinRetiredThreads(); // spares that left, as nobody else may
+	tls_hasSpare = pool->AddSpare();
+}
+
+void ThreadPool::EndBlocking()
+{
+	ThreadPool *pool = tls_currentPool;
+	if (NULL == pool || 0 != --tls_blockingDepth)
+	{
+		return;
+	}
+
+	pool->RemoveSpare(tls_hasSpare);
+}
+
+bool ThreadPool::AddSpare()
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	++m_numOfBlockedWorkers;
+	if (m_isShuttingDown || m_numOfCompensated >= m_maxSpareThreads)
+	{
+		return false;
+	}
+	++m_numOfCompensated;
+
+	if (0 != m_numOfSurplus)
+	{
+		--m_numOfSurplus; // a thread about to park carries on instead
+	}
+	else if (m_numOfParkedSpares > m_numOfSpareWakeups)
+	{
+		++m_numOfSpareWakeups;
+		m_spareSignal.notify_one();
+	}
+	else
+	{
+		++m_numOfSpareThreads;
+		StartWorker();
+	}
+
+	return true;
+}
+
+void ThreadPool::RemoveSpare(bool hasSpare)
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	--m_numOfBlockedWorkers;
+	if (hasSpare)
+	{
+		--m_numOfCompensated;
+		++m_numOfSurplus;
+	}
+}
+
+bool ThreadPool::ParkSpare()
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	if (0 == m_numOfSurplus || m_isShuttingDown)
+	{
+		return true; // another thread parked first
+	}
+	--m_numOfSurplus;
+	++m_numOfParkedSpares;
+
+	steady_clock::time_point deadline = steady_clock::now() + m_keepAlive;
+	while (0 == m_numOfSpareWakeups && !m_isShuttingDown &&
+	       boost::cv_status::timeout !=
+	                                m_spareSignal.wait_until(lock, deadline))
+	{
+		// spurious wakeup
+	}
+	--m_numOfParkedSpares;
+
+	if (m_isShuttingDown)
+	{
+		// the destructor counted it out of its VoidTasks, and joins it
+		return false;
+	}
+	if (0 != m_numOfSpareWakeups)
+	{
+		--m_numOfSpareWakeups;
+		return true;
+	}
+
+	// nobody blocked for keepAlive: the spare leaves
+	--m_numOfSpareThreads;
+	RetireCurrentThread();
+	return false;
+}
+
+size_t ThreadPool::GetNumOfAwakeThreads() const
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	return (m_ThreadGroup.size() - m_numOfParkedSpares);
+}
+
+ThreadPool::timer_id ThreadPool::AddTimer(steady_clock::time_point dueTime,
+                                          nanoseconds interval,
+                                          shared_ptr<Task> task)
+{
+	shared_ptr<TimerRecord> record(new TimerRecord());
+	record->m_task = std::move(task);
+	// round up, a timer never fires early
+	record->m_dueTick = TickOf(dueTime + m_timerResolution - nanoseconds(1));
+	record->m_interval = std::max<boost::uint64_t>(
+	        (interval.count() + m_timerResolution.count() - 1) /
+	                                            m_timerResolution.count(),
+	        (0 == interval.count()) ? 0 : 1);
+	record->m_isCancelled = false;
+	if (0 != record->m_interval)
+	{
+		record->m_isInFlight = boost::make_shared<boost::atomic<bool> >(false);
+		record->m_task->m_timerInFlight = record->m_isInFlight;
+	}
+
+	mutex::scoped_lock lock(m_timerMutex);
+	if (!m_timers)
+	{
+		m_timers.reset(new timer_wheel(TickOf(steady_clock::now())));
+		m_timerThread.reset(new thread(bind(&ThreadPool::RunTimers, this)));
+	}
+
+	record->m_id = m_nextTimerId++;
+	m_timers->Schedule(record, record->m_dueTick);
+	m_activeTimers[record->m_id] = record;
+	m_timerSignal.notify_one();
+
+	return record->m_id;
+}
+
+void ThreadPool::RunTimers()
+{
+	std::vector<shared_ptr<TimerRecord> > expired;
+	task_batch due;
+
+	mutex::scoped_lock lock(m_timerMutex);
+	while (m_timersAreRunning)
+	{
+		m_timers->Advance(TickOf(steady_clock::now()),
+		                  std::back_inserter(expired));
+		for (size_t i = 0; i < expired.size(); ++i)
+		{
+			TimerRecord &record = *expired[i];
+			if (record.m_isCancelled)
+			{
+				continue;
+			}
+
+			// a periodic task still queued or running skips the tick
+			if (0 == record.m_interval ||
+			    !record.m_isInFlight->exchange(true,
+			                                   boost::memory_order_acquire))
+			{
+				due.push_back(record.m_task);
+			}
+			if (0 != record.m_interval)
+			{
+				// a late tick does not shift the period, and ticks missed
+				// altogether are skipped
+				record.m_dueTick = std::max(record.m_dueTick + record.m_interval,
+				                            m_timers->GetCurrentTick() + 1);
+				m_timers->Schedule(expired[i], record.m_dueTick);
+			}
+			else
+			{
+				m_activeTimers.erase(record.m_id);
+			}
+		}
+		expired.clear();
+
+		if (!due.empty())
+		{
+			lock.unlock();
+			EnqueueTasks(due.begin(), due.end());
+			due.clear();
+			lock.lock();
+		}
+		else if (m_timers->empty())
+		{
+			m_timerSignal.wait(lock);
+		}
+		else
+		{
+			m_timerSignal.wait_until(lock,
+			                         TimeOf(m_timers->GetNextEventTick()));
+		}
+	}
+}
+
+void ThreadPool::StopTimers()
+{
+	{
+		mutex::scoped_lock lock(m_timerMutex);
+		m_timersAreRunning = false;
+		m_timerSignal.notify_all();
+	}
+
+	if (m_timerThread)
+	{
+		m_timerThread->join();
+	}
+}
+
+boost::uint64_t ThreadPool::TickOf(steady_clock::time_point time) const
+{
+	return (time <= m_timerEpoch) ? 0
+	       : ((time - m_timerEpoch).count() / m_timerResolution.count());
+}
+
+steady_clock::time_point ThreadPool::TimeOf(boost::uint64_t tick) const
+{
+	return m_timerEpoch +
+	       m_timerResolution * static_cast<boost::int64_t>(tick);
+}
+
+void ThreadPool::RecordIdleTime(WorkerStats &stats, nanoseconds idleTime)
+{
+	stats.m_idleTime.fetch_add(idleTime.count(), boost::memory_order_relaxed);
+}
+
+void ThreadPool::RecordTask(WorkerStats &stats, const Task &task,
+                            nanoseconds queueWait, nanoseconds runTime)
+{
+	size_t sequence = stats.m_sequence.load(boost::memory_order_relaxed);
+	stats.m_sequence.store(sequence + 1, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+
+	stats.m_tasksExecuted.fetch_add(1, boost::memory_order_relaxed);
+	stats.m_queueWaitTime.fetch_add(queueWait.count(),
+	                                boost::memory_order_relaxed);
+	stats.m_busyTime.fetch_add(runTime.count(), boost::memory_order_relaxed);
+	int priority = std::min<int>(std::max<int>(task.GetPriority(), Task::LOW),
+	                             Task::SUPREME);
+	stats.m_executionTimes[priority][BucketOf(runTime)].fetch_add(1,
+	                                               boost::memory_order_relaxed);
+
+	stats.m_sequence.store(sequence + 2, boost::memory_order_release);
+}
+
+void ThreadPool::AddWorkerStats(Stats &total, const WorkerStats &stats)
+{
+	Stats copy;
+	size_t sequence = 0;
+	do
+	{
+		sequence = stats.m_sequence.load(boost::memory_order_acquire);
+		copy.tasksExecuted = stats.m_tasksExecuted.load(
+		                                        boost::memory_order_relaxed);
+		copy.queueWaitTime = nanoseconds(stats.m_queueWaitTime.load(
+		                                        boost::memory_order_relaxed));
+		copy.busyTime = nanoseconds(stats.m_busyTime.load(
+		                                        boost::memory_order_relaxed));
+		for (size_t p = 0; p < Stats::NUM_OF_PRIORITIES; ++p)
+		{
+			for (size_t b = 0; b < Stats::NUM_OF_BUCKETS; ++b)
+			{
+				copy.executionTimes[p][b] = stats.m_executionTimes[p][b].load(
+				                                    boost::memory_order_relaxed);
+			}
+		}
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+	}
+	while ((sequence & 1) ||
+	       sequence != stats.m_sequence.load(boost::memory_order_relaxed));
+
+	// idle time is not part of a task's record, it is read on its own
+	total.idleTime += nanoseconds(stats.m_idleTime.load(
+	                                            boost::memory_order_relaxed));
+	total.tasksExecuted += copy.tasksExecuted;
+	total.queueWaitTime += copy.queueWaitTime;
+	total.busyTime += copy.busyTime;
+	for (size_t p = 0; p < Stats::NUM_OF_PRIORITIES; ++p)
+	{
+		for (size_t b = 0; b < Stats::NUM_OF_BUCKETS; ++b)
+		{
+			total.executionTimes[p][b] += copy.executionTimes[p][b];
+		}
+	}
+}
+
+size_t ThreadPool::BucketOf(nanoseconds runTime)
+{
+	boost::int64_t micros = duration_cast<microseconds>(runTime).count();
+	size_t bucket = 0;
+	for (; 0 < micros && bucket + 1 < Stats::NUM_OF_BUCKETS; micros >>= 1)
+	{
+		++bucket;
+	}
+
+	return bucket;
+}
+
+void ThreadPool::AddThreads(size_t threadAmountToAdd)
+{
+	{
+		mutex::scoped_lock lock(m_mapMutex);
+		for (size_t i = 0; i < threadAmountToAdd; ++i)
+		{
+			StartWorker();
+		}
+	}
+	ReleaseHeldTasks(); // the new workers may take some of them
+}
+
+void ThreadPool::StartWorker()
+{
+	shared_ptr<Worker> worker(new Worker());
+	worker->m_thread.reset(new thread
+                           (bind(&ThreadPool::InitAndRunThread, this, worker)));
+	m_ThreadGroup[worker->m_thread->get_id()] = worker;
+	++m_numOfLiveThreads;
+}
+
+void ThreadPool::ReducePoolSize(size_t numToRemove)
+{
+	// all closers go out at once, so the threads retire in parallel
+	std::vector<future<thread::id> > threadFutures;
+	for (size_t i = 0; i < numToRemove; ++i)
+	{
+		shared_ptr<promise<thread::id> > prom(new promise<thread::id>());
+		threadFutures.push_back(prom->get_future());
+
+		AddCloseThreadTask(prom);
+	}
+
+	for (size_t i = 0; i < numToRemove; ++i)
+	{
+		shared_ptr<Worker> workerToJoin = EraseThread(threadFutures[i].get());
+		workerToJoin->m_thread->join();
+	}
+}
+
+shared_ptr<ThreadPool::Worker> ThreadPool::EraseThread(thread::id id)
+{
+	mutex::scoped_lock lock(m_mapMutex);
+	thread_map::iterator it = m_ThreadGroup.find(id);
+	shared_ptr<Worker> worker(it->second);
+	AddWorkerStats(m_retiredStats, worker->m_stats);
+	m_ThreadGroup.erase(it);
+	--m_numOfLiveThreads;
+	return worker;
+}
+
+void ThreadPool::JoinAllThreads()
+{
+	for (thread_map::iterator it = m_ThreadGroup.begin();
+	     it != m_ThreadGroup.end(); ++it)
+	{
+		it->second->m_thread->join();
+	}
+}
+
+void ThreadPool::AddCloseThreadTask(shared_ptr<promise<thread::id> > promise)
+{
+	PushTask(shared_ptr<Task>(new ThreadCloser(promise)));
+}
+
+// ═══════════════════════    ThreadPool::Options     ═══════════════════════════
+ThreadPool::Options::Options() : schedulingMode(SHARED_QUEUE),
+                                 priorityAgingLimit(DEFAULT_AGING_LIMIT),
+                                 workerBatchSize(1),
+                                 initialQueueCapacity(DEFAULT_QUEUE_CAPACITY),
+                                 minThreads(1),
+                                 maxThreads(0),
+                                 scaleUpQueueDepth(DEFAULT_SCALE_UP_DEPTH),
+                                 scaleUpQueueWait(DEFAULT_SCALE_UP_WAIT),
+                                 keepAlive(DEFAULT_KEEP_ALIVE),
+                                 scalingInterval(DEFAULT_SCALING_INTERVAL),
+                                 placementPolicy(NO_PLACEMENT),
+                                 timerResolution(DEFAULT_TIMER_RESOLUTION),
+                                 maxPendingTasks(0),
+                                 overflowPolicy(BLOCK),
+                                 maxSpareThreads(DEFAULT_MAX_SPARE_THREADS),
+                                 maxQueueWait(0),
+                                 maxBorrowingRunTime(0),
+                                 tracer(NULL)
+{
+	// empty
+}
+// ══════════════════════    ThreadPool::QueueFull    ══════════════════════════
+ThreadPool::QueueFull::QueueFull() : std::runtime_error("thread pool is full")
+{
+	// empty
+}
+
+ThreadPool::Overloaded::Overloaded()
+                        : std::runtime_error("thread pool is overloaded")
+{
+	// empty
+}
+
+ThreadPool::TaskExpired::TaskExpired()
+                        : std::runtime_error("task expired in the queue")
+{
+	// empty
+}
+
+ThreadPool::TaskCancelled::TaskCancelled()
+                        : std::runtime_error("task was dropped by Shutdown")
+{
+	// empty
+}
+// ═══════════════════    ThreadPool::WorkerStats     ══════════════════════════
+ThreadPool::WorkerStats::WorkerStats() : m_sequence(0), m_tasksExecuted(0),
+                                         m_queueWaitTime(0), m_busyTime(0),
+                                         m_idleTime(0)
+{
+	for (size_t p = 0; p < Stats::NUM_OF_PRIORITIES; ++p)
+	{
+		for (size_t b = 0; b < Stats::NUM_OF_BUCKETS; ++b)
+		{
+			m_executionTimes[p][b].store(0, boost::memory_order_relaxed);
+		}
+	}
+}
+// ══════════════════════    ThreadPool::TaskGroup    ══════════════════════════
+ThreadPool::TaskGroup::TaskGroup(ThreadPool &pool) : m_pool(pool),
+                                                     m_numOfPending(0),
+                                                     m_numOfQueued(0)
+{
+	// empty
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+	WaitForTasks();
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+	WaitForTasks();
+
+	std::exception_ptr exception;
+	{
+		mutex::scoped_lock lock(m_mutex);
+		exception.swap(m_exception);
+	}
+	if (exception)
+	{
+		std::rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::TaskGroup::Done(std::exception_ptr exception)
+{
+	// under the lock: once Wait sees zero the group may be gone
+	mutex::scoped_lock lock(m_mutex);
+	if (exception && !m_exception)
+	{
+		m_exception = exception;
+	}
+	if (0 == --m_numOfPending)
+	{
+		m_doneSignal.notify_all();
+	}
+}
+
+void ThreadPool::TaskGroup::WaitForTasks()
+{
+	for (;;)
+	{
+		size_t numOfQueued = 0;
+		{
+			mutex::scoped_lock lock(m_mutex);
+			if (0 == m_numOfPending)
+			{
+				return;
+			}
+			numOfQueued = m_numOfQueued;
+		}
+
+		if (!m_pool.RunQueuedTask())
+		{
+			// the rest of the group is running elsewhere. it wakes this
+			// thread once it is done, or has queued more to help with
+			mutex::scoped_lock lock(m_mutex);
+			while (0 != m_numOfPending && numOfQueued == m_numOfQueued)
+			{
+				m_doneSignal.wait(lock);
+			}
+		}
+	}
+}
+
+// ════════════════════════    ThreadPool::Strand    ═══════════════════════════
+ThreadPool::Strand::Strand(ThreadPool &pool, Task::priority priority)
+                    : m_pool(pool), m_priority(priority),
+                      m_state(boost::make_shared<OwnState>())
+{
+	// empty
+}
+
+bool ThreadPool::StrandState::Push(shared_ptr<Task> task)
+{
+	m_tasks.push_back(std::move(task));
+	if (m_isScheduled)
+	{
+		return false;
+	}
+	m_isScheduled = true;
+
+	return true;
+}
+
+shared_ptr<ThreadPool::Task> ThreadPool::StrandState::Pop()
+{
+	shared_ptr<Task> task;
+	if (m_tasks.empty())
+	{
+		m_isScheduled = false;
+		OnIdle();
+		return task;
+	}
+	task.swap(m_tasks.front());
+	m_tasks.pop_front();
+
+	return task;
+}
+
+void ThreadPool::StrandState::PopAll(std::vector<shared_ptr<Task> > &out)
+{
+	for (; !m_tasks.empty(); m_tasks.pop_front())
+	{
+		out.push_back(std::move(m_tasks.front()));
+	}
+	if (m_isScheduled)
+	{
+		m_isScheduled = false;
+		OnIdle();
+	}
+}
+
+void ThreadPool::StrandState::OnIdle()
+{
+	// empty
+}
+// ══════════════════════    ThreadPool::StrandTurn    ═════════════════════════
+ThreadPool::StrandTurn::StrandTurn(ThreadPool *pool,
+                                   shared_ptr<StrandState> state,
+                                   priority taskPriority)
+                : Task(taskPriority), m_pool(pool), m_state(std::move(state))
+{
+	m_isCarrier = true;
+	m_isWorkerOnly = true;
+}
+
+void ThreadPool::StrandTurn::Execute()
+{
+	for (size_t i = 0; i < TASKS_PER_STRAND_TURN; ++i)
+	{
+		shared_ptr<Task> task;
+		{
+			mutex::scoped_lock lock(m_state->GetMutex());
+			task = m_state->Pop();
+		}
+		if (!task)
+		{
+			return;
+		}
+		// a CallableTask, its future holds what it throws
+		m_pool->RunMeasured(*task);
+	}
+
+	// still scheduled: the next turn picks up where this one stopped
+	m_pool->EnqueueTask(m_pool->MakeTask<StrandTurn>(m_pool, m_state,
+	                                                 GetPriority()));
+}
+
+bool ThreadPool::StrandTurn::OnDropped(std::vector<shared_ptr<Task> > &dropped)
+{
+	mutex::scoped_lock lock(m_state->GetMutex());
+	m_state->PopAll(dropped);
+
+	return false;
+}
+// ════════════════════    ThreadPool::BlockingRegion    ═══════════════════════
+ThreadPool::BlockingRegion::BlockingRegion()
+{
+	BeginBlocking();
+}
+
+ThreadPool::BlockingRegion::~BlockingRegion()
+{
+	EndBlocking();
+}
+// ═════════════════════    ThreadPool::TaskLevels     ═════════════════════════
+size_t ThreadPool::TaskLevels::Level(const shared_ptr<Task> &task)
+{
+	int level = task->GetPriority() - (Task::LOW - 1);
+
+	return ((level < 0) ? 0 : (level >= NUM_LEVELS) ? NUM_LEVELS - 1 : level);
+}
+// ═════════════════════════    ThreadPool::Task     ═══════════════════════════
+ThreadPool::Task::Task(ThreadPool::Task::priority priority)
+                                : m_priority(priority), m_isControl(false),
+                                  m_isCarrier(false), m_isWorkerOnly(false),
+                                  m_deadline(steady_clock::time_point::max())
+{
+	// empty
+}
+
+ThreadPool::Task::~Task()
+{
+	// empty
+}
+
+bool ThreadPool::Task::operator<(const ThreadPool::Task &other) const noexcept
+{
+	return (m_priority < other.m_priority);
+}
+
+ThreadPool::Task::priority ThreadPool::Task::GetPriority() const noexcept
+{
+	return m_priority;
+}
+
+void ThreadPool::Task::SetDeadline(steady_clock::time_point deadline)
+{
+	m_deadline = deadline;
+}
+
+steady_clock::time_point ThreadPool::Task::GetDeadline() const noexcept
+{
+	return m_deadline;
+}
+
+void ThreadPool::Task::OnExpired()
+{
+	// empty
+}
+
+bool ThreadPool::Task::OnDropped(std::vector<shared_ptr<Task> > &)
+{
+	return false;
+}
+// ═══════════════════    ThreadPool::ThreadCloser     ═════════════════════════
+ThreadPool::ThreadCloser::ThreadCloser(shared_ptr<promise<thread::id> > prom)
+										: Task(SUPREME), m_threadToRemove(prom)
+{
+	m_isControl = true;
+}
+
+void ThreadPool::ThreadCloser::Execute()
+{
+	m_threadToRemove->set_value(get_id());
+	throw remove_me();
+}
+// ═══════════════════    ThreadPool::VoidTask     ═════════════════════════════
+ThreadPool::VoidTask::VoidTask() : Task(static_cast<priority>(LOW - 1))
+{
+	m_isControl = true;
+}
+
+
+void ThreadPool::VoidTask::Execute()
+{
+	throw remove_me();
+}
+// ═══════════════════    ThreadPool::PauseTask     ════════════════════════════
+ThreadPool::PauseTask::PauseTask() : Task(static_cast<priority>(SUPREME + 1))
+{
+	m_isControl = true;
+}
+
+void ThreadPool::PauseTask::Execute()
+{
+	// empty - popping it is all it takes to reach the pause gate
 }
 //╚═════════════════════════    ThreadPool(IMP)     ═══════════════════════════╝
 } // namespace project
@@ -8,7 +8,11 @@
 #define BOOST_THREAD_PROVIDES_FUTURE
 
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
 #include <boost/thread/future.hpp>
+#include <sched.h>                  // sched_getcpu
 
 #include "ca_test_util.hpp"
 #include "thread_pool.hpp"
@@ -65,10 +69,150 @@ private:
 
 };
 
+class GateTask : public ThreadPool::Task
+{
+public:
+	explicit GateTask(boost::shared_future<void> gate)
+	                                        : Task(SUPREME), m_gate(gate){}
+	virtual ~GateTask(){}
+
+private:
+	void Execute()
+	{
+		m_gate.wait();
+	}
+	boost::shared_future<void> m_gate;
+};
+
+class RecordTask : public ThreadPool::Task
+{
+public:
+	RecordTask(int id, vector<int> *record, priority p)
+	                                    : Task(p), m_id(id), m_record(record){}
+	virtual ~RecordTask(){}
+
+private:
+	void Execute()
+	{
+		m_record->push_back(m_id);
+	}
+	int m_id;
+	vector<int> *m_record;
+};
+
+class SpinUntilCancelledTask : public ThreadPool::Task
+{
+public:
+	enum state {QUEUED, SPINNING, CANCELLED};
+
+	explicit SpinUntilCancelledTask(boost::atomic<int> *state)
+	                                                        : m_state(state){}
+	virtual ~SpinUntilCancelledTask(){}
+
+private:
+	void Execute()
+	{
+		*m_state = SPINNING;
+		while (!ThreadPool::IsCancellationRequested())
+		{
+			boost::this_thread::yield();
+		}
+		*m_state = CANCELLED;
+	}
+	boost::atomic<int> *m_state;
+};
+
+class CountTask : public ThreadPool::Task
+{
+public:
+	explicit CountTask(boost::atomic<int> *counter) : m_counter(counter){}
+	virtual ~CountTask(){}
+
+private:
+	void Execute()
+	{
+		++(*m_counter);
+	}
+	boost::atomic<int> *m_counter;
+};
+
+// runs for 20ms, and counts the runs that found another one running
+class SlowTask : public ThreadPool::Task
+{
+public:
+	SlowTask(boost::atomic<int> *runs, boost::atomic<int> *overlapping)
+	                       : m_runs(runs), m_overlapping(overlapping), m_now(0){}
+	virtual ~SlowTask(){}
+
+private:
+	void Execute()
+	{
+		++(*m_runs);
+		if (0 != m_now++)
+		{
+			++(*m_overlapping);
+		}
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+		--m_now;
+	}
+	boost::atomic<int> *m_runs;
+	boost::atomic<int> *m_overlapping;
+	boost::atomic<int> m_now;
+};
+
+class ThrowingTask : public ThreadPool::Task
+{
+public:
+	ThrowingTask(){}
+	virtual ~ThrowingTask(){}
+
+private:
+	void Execute()
+	{
+		throw std::logic_error("thrown by the task");
+	}
+};
+
+// move-only callable
+class SquareOwned
+{
+public:
+	explicit SquareOwned(int num) : m_num(new int(num)){}
+	SquareOwned(SquareOwned &&other) = default;
+
+	int operator()()
+	{
+		return (*m_num) * (*m_num);
+	}
+private:
+	std::unique_ptr<int> m_num;
+};
+
 void SanityTest();
 void PromiseFutureTest();
 void StopTest();
 void PressureTest();
+void WorkStealingTest();
+void PriorityOrderTest();
+void BatchTest();
+void SubmitTest();
+void ArenaTest();
+void ShutdownTest();
+void PauseTest();
+void AutoScaleTest();
+void StatsTest();
+void PlacementTest();
+void TimerTest();
+void ContinuationTest();
+void TaskGroupTest();
+void ParallelTest();
+void CoroutineTest();
+void BackpressureTest();
+void StrandTest();
+void BlockingTest();
+void DeadlineTest();
+void ReservationTest();
+void TracingTest();
 
 int main()
 {
@@ -81,10 +225,29 @@ int main()
 
 	PromiseFutureTest();
 
-	// NOTE: this test might cause resource leak.
-	// this is an acceptable behaviour of the (risky) Stop method
 	StopTest();
 	PressureTest();
+	WorkStealingTest();
+	PriorityOrderTest();
+	BatchTest();
+	SubmitTest();
+	ArenaTest();
+	ShutdownTest();
+	PauseTest();
+	AutoScaleTest();
+	StatsTest();
+	PlacementTest();
+	TimerTest();
+	ContinuationTest();
+	TaskGroupTest();
+	ParallelTest();
+	CoroutineTest();
+	BackpressureTest();
+	StrandTest();
+	BlockingTest();
+	DeadlineTest();
+	ReservationTest();
+	TracingTest();
 
 	TestSummary();
 	return 0;
@@ -98,7 +261,7 @@ void PressureTest()
         cout << "Now Running Pressure Test: ";
 	    ThreadPool threadPool(10);
     }
-    catch (exception e)
+    catch (exception &)
     {
         has_crashed = true;
     }
@@ -220,3 +383,1475 @@ void SanityTest()
 	Test(threadPool.GetNumOfThreads(),(size_t)5);
 	//cout << "sanity test ended" << endl << endl;
 }
+
+void WorkStealingTest()
+{
+	ThreadPool::Options options;
+	options.schedulingMode = ThreadPool::WORK_STEALING;
+	ThreadPool threadPool(4, options);
+
+	const int numOfTasks = 200;
+	boost::shared_ptr<promise<int> > proms[numOfTasks];
+	boost::future<int> futures[numOfTasks];
+	for (int i = 0; i < numOfTasks; ++i)
+	{
+		proms[i].reset(new promise<int>());
+		futures[i] = proms[i]->get_future();
+		threadPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+		                          new MultiplyTask(i, 3, proms[i],
+		                                           ThreadPool::Task::MEDIUM)));
+		if (i == numOfTasks / 2)
+		{
+			threadPool.SetNumOfThreads(2);
+		}
+	}
+
+	int sum = 0;
+	for (int i = 0; i < numOfTasks; ++i)
+	{
+		sum += futures[i].get();
+	}
+	cout << "Now Running Work Stealing Test(all tasks ran): ";
+	Test(sum, 3 * (numOfTasks * (numOfTasks - 1) / 2));
+
+	threadPool.SetNumOfThreads(8);
+	cout << "Now Running Work Stealing Test(resize): ";
+	Test(threadPool.GetNumOfThreads(), (size_t)8);
+}
+
+void PriorityOrderTest()
+{
+	ThreadPool::Options options;
+	options.priorityAgingLimit = 0;
+	ThreadPool threadPool(1, options);
+
+	// keep the only worker busy until everything below is queued
+	promise<void> gate;
+	threadPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	                                new GateTask(gate.get_future().share())));
+
+	vector<int> record;
+	const ThreadPool::Task::priority priorities[] =
+	{
+		ThreadPool::Task::LOW, ThreadPool::Task::HIGH,
+		ThreadPool::Task::MEDIUM, ThreadPool::Task::SUPREME,
+		ThreadPool::Task::LOW, ThreadPool::Task::HIGH
+	};
+	for (int i = 0; i < 6; ++i)
+	{
+		threadPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+		                          new RecordTask(i, &record, priorities[i])));
+	}
+
+	boost::shared_ptr<promise<int> > done(new promise<int>());
+	boost::future<int> doneFuture = done->get_future();
+	threadPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	             new MultiplyTask(1, 1, done, static_cast<ThreadPool::Task::
+	                                                          priority>(0))));
+	gate.set_value();
+	doneFuture.get();
+
+	const int expected[] = {3, 1, 5, 2, 0, 4};
+	cout << "Now Running Priority Order Test: ";
+	BoolTest(vector<int>(expected, expected + 6) == record);
+}
+
+void BatchTest()
+{
+	const ThreadPool::scheduling modes[] =
+	{
+		ThreadPool::SHARED_QUEUE, ThreadPool::WORK_STEALING
+	};
+
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ThreadPool::Options options;
+		options.schedulingMode = modes[mode];
+		options.workerBatchSize = 8;
+		ThreadPool threadPool(3, options);
+
+		const int numOfTasks = 100;
+		vector<boost::shared_ptr<ThreadPool::Task> > tasks;
+		vector<boost::future<int> > futures;
+		for (int i = 0; i < numOfTasks; ++i)
+		{
+			boost::shared_ptr<promise<int> > prom(new promise<int>());
+			futures.push_back(prom->get_future());
+			tasks.push_back(boost::shared_ptr<ThreadPool::Task>(
+			            new MultiplyTask(i, 2, prom, ThreadPool::Task::LOW)));
+		}
+		threadPool.AddTasks(tasks.begin(), tasks.end());
+		threadPool.SetNumOfThreads(1);
+
+		int sum = 0;
+		for (int i = 0; i < numOfTasks; ++i)
+		{
+			sum += futures[i].get();
+		}
+		cout << "Now Running Batch Test(AddTasks): ";
+		Test(sum, numOfTasks * (numOfTasks - 1));
+	}
+}
+
+static int Triple(int num)
+{
+	return num * 3;
+}
+
+static void Throw()
+{
+	throw std::runtime_error("submitted task failed");
+}
+
+void SubmitTest()
+{
+	ThreadPool threadPool(2);
+
+	ThreadPool::Future<int> bound = threadPool.Submit(boost::bind(Triple, 14));
+	ThreadPool::Future<int> moveOnly = threadPool.Submit(SquareOwned(9),
+	                                                   ThreadPool::Task::HIGH);
+	boost::atomic<int> counter(0);
+	ThreadPool::Future<void> lambda = threadPool.Submit([&counter]()
+	{
+		++counter;
+	});
+	ThreadPool::Future<void> throwing = threadPool.Submit(&Throw);
+
+	cout << "Now Running Submit Test(bound function): ";
+	Test(bound.Get(), 42);
+	cout << "Now Running Submit Test(move-only callable): ";
+	Test(moveOnly.Get(), 81);
+
+	lambda.Wait();
+	cout << "Now Running Submit Test(void lambda): ";
+	Test(counter.load(), 1);
+
+	bool has_thrown = false;
+	try
+	{
+		throwing.Get();
+	}
+	catch (const std::runtime_error &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running Submit Test(exception): ";
+	Test(has_thrown, true);
+}
+
+static int Identity(int num)
+{
+	return num;
+}
+
+struct alignas(64) AlignedBlock
+{
+	char m_bytes[64];
+};
+
+void ArenaTest()
+{
+	ThreadPool threadPool(2);
+	const int numOfTasks = 100;
+	vector<ThreadPool::Future<int> > futures(numOfTasks);
+
+	// warm up the arena and the queue
+	for (int round = 0; round < 2; ++round)
+	{
+		for (int i = 0; i < numOfTasks; ++i)
+		{
+			futures[i] = threadPool.Submit(boost::bind(Identity, i));
+		}
+		for (int i = 0; i < numOfTasks; ++i)
+		{
+			futures[i].Get();
+		}
+	}
+	TaskArena::Stats warm = threadPool.GetAllocatorStats();
+
+	int sum = 0;
+	for (int i = 0; i < numOfTasks; ++i)
+	{
+		futures[i] = threadPool.Submit(boost::bind(Identity, i));
+	}
+	for (int i = 0; i < numOfTasks; ++i)
+	{
+		sum += futures[i].Get();
+	}
+	TaskArena::Stats steady = threadPool.GetAllocatorStats();
+
+	cout << "Now Running Arena Test(results): ";
+	Test(sum, numOfTasks * (numOfTasks - 1) / 2);
+	cout << "Now Running Arena Test(no new slabs): ";
+	Test(steady.slabAllocations, warm.slabAllocations);
+	cout << "Now Running Arena Test(blocks recycled): ";
+	Test(steady.allocations - warm.allocations, (size_t)numOfTasks);
+
+	// blocks keep the alignment of their type, stricter than operator new's
+	boost::shared_ptr<TaskArena> arena(new TaskArena(4));
+	vector<boost::shared_ptr<AlignedBlock> > blocks;
+	bool isAligned = true;
+	for (int i = 0; i < 10; ++i)
+	{
+		blocks.push_back(boost::allocate_shared<AlignedBlock>(
+		                                ArenaAllocator<AlignedBlock>(arena)));
+		isAligned = isAligned &&
+		        (0 == reinterpret_cast<size_t>(blocks.back().get()) %
+		              alignof(AlignedBlock));
+	}
+	cout << "Now Running Arena Test(aligned): ";
+	Test(isAligned, true);
+
+	// a thread gives back blocks another one took
+	thread([&blocks]{ blocks.clear(); }).join();
+	TaskArena::Stats freed = arena->GetStats();
+	cout << "Now Running Arena Test(freed by another thread): ";
+	Test(freed.allocations == 10 && freed.deallocations == 10, true);
+
+	// a thread's cache goes back as it exits, so short-lived threads one
+	// after the other share a single slab
+	boost::shared_ptr<TaskArena> shortLived(new TaskArena(4));
+	for (int i = 0; i < 10; ++i)
+	{
+		thread([shortLived]
+		{
+			boost::allocate_shared<AlignedBlock>(
+			                        ArenaAllocator<AlignedBlock>(shortLived));
+		}).join();
+	}
+	TaskArena::Stats released = shortLived->GetStats();
+	cout << "Now Running Arena Test(exited threads): ";
+	Test(released.slabAllocations == 1 && released.allocations == 10 &&
+	     released.deallocations == 10, true);
+}
+
+void ShutdownTest()
+{
+	ThreadPool drainPool(2);
+	boost::atomic<int> counter(0);
+	for (int i = 0; i < 20; ++i)
+	{
+		drainPool.Submit([&counter]{ ++counter; });
+	}
+	bool drained = drainPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Shutdown Test(drain): ";
+	Test(drained && 20 == counter, true);
+
+	// CANCEL: queued tasks come back, the running one is asked to stop
+	ThreadPool cancelPool(1);
+	boost::atomic<int> spinState(SpinUntilCancelledTask::QUEUED);
+	cancelPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	                                   new SpinUntilCancelledTask(&spinState)));
+	while (SpinUntilCancelledTask::QUEUED == spinState)
+	{
+		boost::this_thread::yield();
+	}
+	vector<int> record;
+	for (int i = 0; i < 10; ++i)
+	{
+		cancelPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+		                  new RecordTask(i, &record, ThreadPool::Task::LOW)));
+	}
+	ThreadPool::Future<int> dropped = cancelPool.Submit([]{ return 1; },
+	                                                ThreadPool::Task::LOW);
+	ThreadPool::Future<int> continued = dropped.Then(
+	                            [](ThreadPool::Future<int> input)
+	                            {
+	                                return input.Get();
+	                            });
+	ThreadPool::TaskGroup droppedGroup(cancelPool);
+	droppedGroup.Run([]{}, ThreadPool::Task::LOW);
+	vector<boost::shared_ptr<ThreadPool::Task> > unfinished =
+	  cancelPool.Shutdown(ThreadPool::CANCEL, steady_clock::now() + seconds(5));
+	cout << "Now Running Shutdown Test(cancel): ";
+	Test(unfinished.size() == 12 &&
+	     SpinUntilCancelledTask::CANCELLED == spinState, true);
+
+	// the futures of dropped tasks rethrow TaskCancelled, and so whatever
+	// waits on them
+	int numOfCancelled = 0;
+	try
+	{
+		dropped.Get();
+	}
+	catch (ThreadPool::TaskCancelled &)
+	{
+		++numOfCancelled;
+	}
+	try
+	{
+		continued.Get();
+	}
+	catch (ThreadPool::TaskCancelled &)
+	{
+		++numOfCancelled;
+	}
+	try
+	{
+		droppedGroup.Wait();
+	}
+	catch (ThreadPool::TaskCancelled &)
+	{
+		++numOfCancelled;
+	}
+	cout << "Now Running Shutdown Test(dropped futures): ";
+	Test(numOfCancelled, 3);
+	cout << "Now Running Shutdown Test(usable after): ";
+	Test(cancelPool.Submit([]{ return 7; }).Get(), 7);
+
+	// DRAIN past the deadline: the stuck task and the queue behind it
+	ThreadPool stuckPool(1);
+	boost::promise<void> gate;
+	stuckPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	                              new GateTask(gate.get_future().share())));
+	for (int i = 0; i < 3; ++i)
+	{
+		stuckPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+		                  new RecordTask(i, &record, ThreadPool::Task::LOW)));
+	}
+	unfinished = stuckPool.Shutdown(ThreadPool::DRAIN,
+	                                steady_clock::now() + milliseconds(20));
+	gate.set_value();
+	cout << "Now Running Shutdown Test(deadline): ";
+	Test(unfinished.size(), (size_t)4);
+}
+
+void PauseTest()
+{
+	ThreadPool::Options options;
+	options.schedulingMode = ThreadPool::WORK_STEALING;
+	options.workerBatchSize = 4;
+	ThreadPool threadPool(4, options);
+	boost::atomic<int> counter(0);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		threadPool.Submit([&counter]
+		{
+			boost::this_thread::sleep_for(milliseconds(20));
+			++counter;
+		});
+	}
+	bool isQuiescent = threadPool.Pause(steady_clock::now() + seconds(5));
+	int countAtPause = counter;
+	for (int i = 0; i < 8; ++i)
+	{
+		threadPool.Submit([&counter]{ ++counter; });
+	}
+	boost::this_thread::sleep_for(milliseconds(50));
+	cout << "Now Running Pause Test(quiescent): ";
+	Test(isQuiescent && countAtPause == counter, true);
+
+	threadPool.Resume();
+	threadPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Pause Test(resumed): ";
+	Test((int)counter, 16);
+}
+
+void AutoScaleTest()
+{
+	ThreadPool::Options options;
+	options.minThreads = 1;
+	options.maxThreads = 8;
+	options.scaleUpQueueDepth = 2;
+	options.keepAlive = milliseconds(100);
+	options.scalingInterval = milliseconds(10);
+	ThreadPool threadPool(1, options);
+
+	for (int i = 0; i < 64; ++i)
+	{
+		threadPool.Submit([]{ boost::this_thread::sleep_for(milliseconds(10)); });
+	}
+	size_t peak = 0;
+	while (!threadPool.Drain(steady_clock::now() + milliseconds(5)))
+	{
+		peak = std::max(peak, threadPool.GetNumOfThreads());
+	}
+	cout << "Now Running AutoScale Test(grows to max): ";
+	Test(peak, (size_t)8);
+
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (1 < threadPool.GetNumOfThreads() && steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(10));
+	}
+	cout << "Now Running AutoScale Test(shrinks to min): ";
+	Test(threadPool.GetNumOfThreads(), (size_t)1);
+}
+
+void StatsTest()
+{
+	ThreadPool threadPool(2);
+	for (int i = 0; i < 50; ++i)
+	{
+		threadPool.Submit([]{ boost::this_thread::sleep_for(microseconds(100)); },
+		                  ThreadPool::Task::HIGH);
+	}
+	threadPool.Drain(steady_clock::now() + seconds(5));
+	ThreadPool::Stats stats = threadPool.GetStats();
+
+	size_t histogramTotal = 0;
+	for (size_t b = 0; b < ThreadPool::Stats::NUM_OF_BUCKETS; ++b)
+	{
+		histogramTotal += stats.executionTimes[ThreadPool::Task::HIGH][b];
+	}
+	cout << "Now Running Stats Test(tasks counted): ";
+	Test(stats.tasksExecuted == 50 && histogramTotal == 50 &&
+	     0 == stats.pendingTasks && 0 == stats.queue.size, true);
+	cout << "Now Running Stats Test(times): ";
+	Test(stats.busyTime >= microseconds(5000) &&
+	     stats.queue.lockAcquisitions >= 100, true);
+
+	threadPool.SetNumOfThreads(1);
+	cout << "Now Running Stats Test(kept after removal): ";
+	Test(threadPool.GetStats().tasksExecuted, (size_t)50);
+}
+
+void PlacementTest()
+{
+	int expected[] = {0, 1, 2, 3, 8, 10, 11};
+	CpuTopology::cpu_list parsed = CpuTopology::ParseCpuList("0-3,8,10-11\n");
+	cout << "Now Running Placement Test(cpulist): ";
+	Test(parsed == CpuTopology::cpu_list(expected, expected + 7), true);
+
+	std::vector<CpuTopology::cpu_list> nodes(2);
+	nodes[0] = CpuTopology::ParseCpuList("0-1");
+	nodes[1] = CpuTopology::ParseCpuList("2-3");
+	CpuTopology twoNodes(nodes);
+	cout << "Now Running Placement Test(node of cpu): ";
+	Test(twoNodes.GetNodeOf(2) == 1 && twoNodes.GetNodeOf(9) == 2, true);
+
+	int cpu = CpuTopology::Detect().GetAllCpus().back();
+	ThreadPool::Options pinned;
+	pinned.placementPolicy = ThreadPool::PIN_TO_CPUS;
+	pinned.cpuSet.push_back(cpu);
+	ThreadPool pinnedPool(2, pinned);
+	cout << "Now Running Placement Test(pinned): ";
+	Test(pinnedPool.Submit([]{ return sched_getcpu(); }).Get(), cpu);
+
+	ThreadPool::Options perNode;
+	perNode.placementPolicy = ThreadPool::PIN_TO_NUMA_NODES;
+	perNode.schedulingMode = ThreadPool::WORK_STEALING;
+	ThreadPool nodePool(4, perNode);
+	boost::atomic<int> counter(0);
+	for (int i = 0; i < 100; ++i)
+	{
+		nodePool.Submit([&counter]{ ++counter; });
+	}
+	nodePool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Placement Test(per node): ";
+	Test((int)counter, 100);
+}
+
+void TimerTest()
+{
+	ThreadPool threadPool(2);
+	boost::atomic<int> delayed(0);
+	boost::atomic<int> cancelled(0);
+	boost::atomic<int> periodic(0);
+	boost::atomic<int> many(0);
+
+	threadPool.AddTaskAfter(milliseconds(30),
+	              boost::shared_ptr<ThreadPool::Task>(new CountTask(&delayed)));
+	ThreadPool::timer_id toCancel = threadPool.AddTaskAt(
+	                     steady_clock::now() + milliseconds(30),
+	             boost::shared_ptr<ThreadPool::Task>(new CountTask(&cancelled)));
+	steady_clock::time_point tickerStart = steady_clock::now();
+	ThreadPool::timer_id ticker = threadPool.AddPeriodic(milliseconds(10),
+	             boost::shared_ptr<ThreadPool::Task>(new CountTask(&periodic)));
+	bool isCancelled = threadPool.CancelTimer(toCancel);
+	int delayedEarly = delayed;
+
+	boost::shared_ptr<ThreadPool::Task> manyTask(new CountTask(&many));
+	for (int i = 0; i < 100000; ++i)
+	{
+		threadPool.AddTaskAfter(microseconds(i % 50000), manyTask);
+	}
+	boost::this_thread::sleep_for(milliseconds(150));
+	bool isTickerCancelled = threadPool.CancelTimer(ticker);
+	int periods = duration_cast<milliseconds>(steady_clock::now() -
+	                                          tickerStart).count() / 10;
+	threadPool.Drain(steady_clock::now() + seconds(5));
+	int periodicAtCancel = periodic;
+	boost::this_thread::sleep_for(milliseconds(50));
+
+	cout << "Now Running Timer Test(after delay): ";
+	Test(0 == delayedEarly && 1 == delayed, true);
+	cout << "Now Running Timer Test(cancel one-shot): ";
+	Test(isCancelled && 0 == cancelled && !threadPool.CancelTimer(toCancel),
+	     true);
+	cout << "Now Running Timer Test(periodic): ";
+	// never early, and (loosely) on time
+	Test(isTickerCancelled && periodicAtCancel <= periods &&
+	     periods / 2 <= periodicAtCancel && periodicAtCancel == periodic, true);
+	cout << "Now Running Timer Test(many timers): ";
+	Test((int)many, 100000);
+
+	// a periodic task that runs longer than its interval never overlaps
+	// itself, the ticks that find it running are skipped
+	boost::atomic<int> slowRuns(0);
+	boost::atomic<int> overlapping(0);
+	ThreadPool::timer_id slowTicker = threadPool.AddPeriodic(milliseconds(2),
+	                  boost::shared_ptr<ThreadPool::Task>(new SlowTask(&slowRuns,
+	                                                   &overlapping)));
+	boost::this_thread::sleep_for(milliseconds(100));
+	threadPool.CancelTimer(slowTicker);
+	bool isDrained = threadPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Timer Test(slow periodic): ";
+	Test(isDrained && 0 == overlapping && 0 < slowRuns && slowRuns <= 6, true);
+
+	// a periodic task Shutdown dropped from the queue fires again after it
+	ThreadPool gatedPool(1);
+	boost::promise<void> gate;
+	gatedPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	                                new GateTask(gate.get_future().share())));
+	boost::atomic<int> ticks(0);
+	ThreadPool::timer_id gatedTicker = gatedPool.AddPeriodic(milliseconds(2),
+	                boost::shared_ptr<ThreadPool::Task>(new CountTask(&ticks)));
+	boost::this_thread::sleep_for(milliseconds(20));
+	gatedPool.Shutdown(ThreadPool::CANCEL,
+	                   steady_clock::now() + milliseconds(20));
+	int ticksAtShutdown = ticks;
+	gate.set_value();
+	boost::this_thread::sleep_for(milliseconds(50));
+	gatedPool.CancelTimer(gatedTicker);
+	gatedPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Timer Test(dropped periodic): ";
+	Test(0 == ticksAtShutdown && 0 < ticks, true);
+}
+
+static int Double(ThreadPool::Future<int> input)
+{
+	return input.Get() * 2;
+}
+
+void ContinuationTest()
+{
+	ThreadPool threadPool(4, ThreadPool::Options());
+
+	ThreadPool::Future<int> chained = threadPool.Submit([]{ return 3; })
+	        .Then(&Double)
+	        .Then([](ThreadPool::Future<int> input){ return input.Get() + 1; });
+	cout << "Now Running Continuation Test(chain): ";
+	Test(chained.Get(), 7);
+
+	ThreadPool::Future<int> recovered = threadPool.Submit(&Throw)
+	        .Then([](ThreadPool::Future<void> input)
+	{
+		try
+		{
+			input.Get();
+		}
+		catch (std::exception &)
+		{
+			return -1;
+		}
+		return 0;
+	});
+	cout << "Now Running Continuation Test(exception): ";
+	Test(recovered.Get(), -1);
+
+	ThreadPool::Future<int> ready = threadPool.Submit([]{ return 5; });
+	ready.Wait();
+	cout << "Now Running Continuation Test(already ready): ";
+	Test(ready.Then(&Double).Get(), 10);
+
+	// a diamond: a -> (b, c) -> d
+	boost::atomic<int> order(0);
+	ThreadPool::Future<int> a = threadPool.Submit([&order]{ return ++order; });
+	vector<ThreadPool::Future<int> > middle;
+	middle.push_back(a.Then([&order](ThreadPool::Future<int> input)
+	                        { input.Wait(); return ++order; }));
+	middle.push_back(a.Then([&order](ThreadPool::Future<int> input)
+	                        { input.Wait(); return ++order; }));
+	ThreadPool::Future<int> d = threadPool.WhenAll(middle.begin(),
+	                                               middle.end())
+	        .Then([&order](ThreadPool::Future<void>){ return ++order; });
+	cout << "Now Running Continuation Test(diamond): ";
+	Test(d.Get() == 4 && middle[0].Get() + middle[1].Get() == 5, true);
+
+	boost::atomic<int> counter(0);
+	vector<ThreadPool::Future<void> > many;
+	for (int i = 0; i < 1000; ++i)
+	{
+		many.push_back(threadPool.Submit([&counter]{ ++counter; }));
+	}
+	ThreadPool::Future<void> all = threadPool.WhenAll(many.begin(), many.end());
+	ThreadPool::Future<void> none = threadPool.WhenAll(many.end(), many.end());
+	all.Wait();
+	cout << "Now Running Continuation Test(when all): ";
+	Test((int)counter == 1000 && none.IsReady(), true);
+
+	boost::promise<void> gate;
+	vector<ThreadPool::Future<int> > racers;
+	boost::shared_future<void> opened = gate.get_future().share();
+	racers.push_back(threadPool.Submit([opened]{ opened.wait(); return 0; }));
+	racers.push_back(threadPool.Submit([]{ return 1; }));
+	ThreadPool::Future<size_t> first = threadPool.WhenAny(racers.begin(),
+	                                                      racers.end());
+	cout << "Now Running Continuation Test(when any): ";
+	Test((int)first.Get(), 1);
+	gate.set_value();
+}
+
+void TaskGroupTest()
+{
+	// a single worker: the parent waits for its children on that worker, so
+	// they only run if the wait helps
+	ThreadPool threadPool(1);
+	boost::atomic<int> counter(0);
+
+	ThreadPool::Future<int> parent = threadPool.Submit([&threadPool, &counter]
+	{
+		ThreadPool::TaskGroup children(threadPool);
+		for (int i = 0; i < 10; ++i)
+		{
+			children.Run([&counter]{ ++counter; });
+		}
+		children.Wait();
+		return (int)counter;
+	});
+	cout << "Now Running TaskGroup Test(nested wait): ";
+	Test(parent.WaitFor(milliseconds(5000)) && 10 == parent.Get(), true);
+
+	ThreadPool::TaskGroup group(threadPool);
+	group.Run([&counter]{ ++counter; });
+	group.Run(&Throw);
+	group.Run([&counter]{ ++counter; });
+	bool has_thrown = false;
+	try
+	{
+		group.Wait();
+	}
+	catch (std::exception &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running TaskGroup Test(exception): ";
+	Test(has_thrown && 12 == counter, true);
+
+	// a helped task that throws is still counted done, nothing waits for it
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+	boost::atomic<bool> isGated(false);
+	threadPool.Submit([opened, &isGated]
+	{
+		isGated = true;
+		opened.wait();
+	});
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (!isGated && steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+	threadPool.AddTask(boost::shared_ptr<ThreadPool::Task>(new ThrowingTask()));
+	ThreadPool::TaskGroup helping(threadPool);
+	helping.Run([&counter]{ ++counter; }, ThreadPool::Task::LOW);
+	bool has_helped = false;
+	try
+	{
+		helping.Wait();
+	}
+	catch (std::logic_error &)
+	{
+		has_helped = true;
+	}
+	helping.Wait();
+	size_t busy = threadPool.GetStats().busyThreads;
+	gate.set_value();
+	cout << "Now Running TaskGroup Test(throwing helped task): ";
+	Test(has_helped && 13 == counter && 1 == busy &&
+	     threadPool.Drain(steady_clock::now() + seconds(5)), true);
+}
+
+void ParallelTest()
+{
+	ThreadPool threadPool(4);
+	const int size = 100000;
+
+	vector<int> squares(size);
+	threadPool.ParallelFor(0, size, [&squares](int i){ squares[i] = i * i; });
+	bool isSquared = true;
+	for (int i = 0; i < size; ++i)
+	{
+		isSquared = isSquared && (i * i == squares[i]);
+	}
+	cout << "Now Running Parallel Test(for): ";
+	Test(isSquared, true);
+
+	long long sum = threadPool.ParallelReduce(0, size, 0LL,
+	                            [](int i){ return (long long)i; },
+	                            [](long long a, long long b){ return a + b; });
+	cout << "Now Running Parallel Test(reduce): ";
+	Test(sum == (long long)size * (size - 1) / 2, true);
+
+	// concatenation is associative only, the order must hold
+	string digits = threadPool.ParallelReduce(0, 1000, string(),
+	                        [](int i){ return string(1, char('0' + i % 10)); },
+	                        [](string a, const string &b){ return a + b; }, 7);
+	bool isOrdered = (1000 == digits.size());
+	for (size_t i = 0; isOrdered && i < digits.size(); ++i)
+	{
+		isOrdered = (char('0' + i % 10) == digits[i]);
+	}
+	cout << "Now Running Parallel Test(reduce order): ";
+	Test(isOrdered, true);
+
+	vector<int> halves(size);
+	vector<int>::iterator end = threadPool.ParallelTransform(squares.begin(),
+	                    squares.end(), halves.begin(), [](int x){ return x / 2; });
+	cout << "Now Running Parallel Test(transform): ";
+	Test(end == halves.end() && halves[size - 1] == squares[size - 1] / 2,
+	     true);
+
+	// nested on a single worker, where only the helping callers make progress
+	ThreadPool single(1);
+	boost::atomic<int> counter(0);
+	single.ParallelFor(0, 8, [&single, &counter](int)
+	{
+		single.ParallelFor(0, 100, [&counter](int){ ++counter; }, 10);
+	}, 1);
+	bool has_thrown = false;
+	try
+	{
+		single.ParallelFor(0, 100, [](int i)
+		{
+			if (50 == i)
+			{
+				throw std::runtime_error("chunk failed");
+			}
+		});
+	}
+	catch (std::exception &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running Parallel Test(nested, exception): ";
+	Test(800 == counter && has_thrown, true);
+}
+
+static void AddCountTask(ThreadPool *pool, boost::atomic<int> *counter,
+                         boost::atomic<bool> *isAdded)
+{
+	pool->AddTask(boost::shared_ptr<ThreadPool::Task>(new CountTask(counter)));
+	*isAdded = true;
+}
+
+void BackpressureTest()
+{
+	ThreadPool::Options options;
+	options.maxPendingTasks = 2;
+
+	// a gated worker, and one more task queued: the pool is full
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+	boost::atomic<int> counter(0);
+	boost::shared_ptr<ThreadPool::Task> countTask(new CountTask(&counter));
+
+	options.overflowPolicy = ThreadPool::REJECT;
+	ThreadPool rejecting(1, options);
+	rejecting.AddTask(boost::shared_ptr<ThreadPool::Task>(new GateTask(opened)));
+	rejecting.AddTask(countTask);
+	bool has_thrown = false;
+	try
+	{
+		rejecting.AddTask(countTask);
+	}
+	catch (ThreadPool::QueueFull &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running Backpressure Test(reject): ";
+	Test(has_thrown, true);
+
+	// a group task the full pool rejected is not waited for
+	has_thrown = false;
+	{
+		ThreadPool::TaskGroup group(rejecting);
+		try
+		{
+			group.Run([&counter]{ ++counter; });
+		}
+		catch (ThreadPool::QueueFull &)
+		{
+			has_thrown = true;
+		}
+		group.Wait();
+	}
+	cout << "Now Running Backpressure Test(reject, group): ";
+	Test(has_thrown && 0 == counter, true);
+
+	options.overflowPolicy = ThreadPool::CALLER_RUNS;
+	ThreadPool callerRuns(1, options);
+	callerRuns.AddTask(boost::shared_ptr<ThreadPool::Task>(new GateTask(opened)));
+	callerRuns.AddTask(countTask);
+	boost::thread::id runner = callerRuns.Submit([]
+	{
+		return boost::this_thread::get_id();
+	}).Get();
+	cout << "Now Running Backpressure Test(caller runs): ";
+	Test(boost::this_thread::get_id() == runner, true);
+
+	// tasks the caller runs expire, and count, like the pool's own. one that
+	// throws does not keep the rest of the batch from running
+	boost::atomic<int> callerCounter(0);
+	std::vector<boost::shared_ptr<ThreadPool::Task> > callerBatch;
+	callerBatch.push_back(boost::shared_ptr<ThreadPool::Task>(
+	                                                      new ThrowingTask()));
+	callerBatch.push_back(boost::shared_ptr<ThreadPool::Task>(
+	                                            new CountTask(&callerCounter)));
+	callerBatch.push_back(boost::shared_ptr<ThreadPool::Task>(
+	                                            new CountTask(&callerCounter)));
+	callerBatch.back()->SetDeadline(steady_clock::now() - milliseconds(1));
+	ThreadPool::Stats before = callerRuns.GetStats();
+	has_thrown = false;
+	try
+	{
+		callerRuns.AddTasks(callerBatch.begin(), callerBatch.end());
+	}
+	catch (std::logic_error &)
+	{
+		has_thrown = true;
+	}
+	ThreadPool::Stats after = callerRuns.GetStats();
+	cout << "Now Running Backpressure Test(caller runs, batch): ";
+	Test(has_thrown && 1 == callerCounter &&
+	     2 == after.tasksExecuted - before.tasksExecuted &&
+	     1 == after.tasksExpired - before.tasksExpired &&
+	     before.pendingTasks == after.pendingTasks, true);
+
+	options.overflowPolicy = ThreadPool::BLOCK;
+	ThreadPool blocking(1, options);
+	blocking.AddTask(boost::shared_ptr<ThreadPool::Task>(new GateTask(opened)));
+	blocking.AddTask(countTask);
+	boost::atomic<bool> isAdded(false);
+	boost::thread producer(AddCountTask, &blocking, &counter, &isAdded);
+	boost::this_thread::sleep_for(milliseconds(50));
+	bool wasBlocked = !isAdded;
+
+	gate.set_value();
+	producer.join();
+	blocking.Drain(steady_clock::now() + seconds(5));
+	rejecting.Drain(steady_clock::now() + seconds(5));
+	callerRuns.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Backpressure Test(block): ";
+	Test(wasBlocked && isAdded && 4 == counter, true);
+}
+
+#if defined(__cpp_impl_coroutine)
+static CoTask<int> AddOnPool(ThreadPool &pool, int a, int b)
+{
+	co_await pool.Schedule(ThreadPool::Task::HIGH);
+	co_return a + b;
+}
+
+static CoTask<int> SumOfSums(ThreadPool &pool, int n)
+{
+	int sum = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		sum += co_await AddOnPool(pool, i, 1);
+	}
+	co_return sum;
+}
+
+static CoTask<void> AwaitGatedFuture(ThreadPool &pool,
+                                     boost::shared_future<void> gate,
+                                     boost::atomic<int> *done)
+{
+	ThreadPool::Future<int> gated = pool.Submit([gate]{ gate.wait(); return 1; });
+	*done += co_await gated;
+}
+
+static CoTask<void> RecordAfterAwait(ThreadPool::Future<void> gated,
+                                     vector<int> *order)
+{
+	co_await gated;
+	order->push_back(ThreadPool::Task::HIGH);
+}
+
+static bool WaitForPending(ThreadPool &pool, size_t pending)
+{
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (pending != pool.GetStats().pendingTasks)
+	{
+		if (steady_clock::now() > deadline)
+		{
+			return false;
+		}
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+
+	return true;
+}
+
+static CoTask<int> ThrowAfterSchedule(ThreadPool &pool)
+{
+	co_await pool.Schedule();
+	throw std::runtime_error("coroutine failed");
+}
+
+void CoroutineTest()
+{
+	ThreadPool threadPool(2);
+
+	cout << "Now Running Coroutine Test(await chain): ";
+	Test(threadPool.Spawn(SumOfSums(threadPool, 100)).Get(), 5050);
+
+	// far more logical operations than workers, every one suspended at once
+	const int numOfWaiters = 10000;
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+	ThreadPool gatePool(1);
+	boost::atomic<int> done(0);
+	vector<ThreadPool::Future<void> > waiters;
+	for (int i = 0; i < numOfWaiters; ++i)
+	{
+		waiters.push_back(threadPool.Spawn(AwaitGatedFuture(gatePool, opened,
+		                                                    &done)));
+	}
+	int doneBeforeGate = done;
+	gate.set_value();
+	for (int i = 0; i < numOfWaiters; ++i)
+	{
+		waiters[i].Wait();
+	}
+	cout << "Now Running Coroutine Test(suspended waiters): ";
+	Test(0 == doneBeforeGate && numOfWaiters == done, true);
+
+	bool has_thrown = false;
+	try
+	{
+		threadPool.Spawn(ThrowAfterSchedule(threadPool)).Get();
+	}
+	catch (std::exception &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running Coroutine Test(exception): ";
+	Test(has_thrown, true);
+
+	// a HIGH coroutine comes back from co_await ahead of a queued MEDIUM task:
+	// one worker runs the awaited task, the other one a blocking task
+	ThreadPool pairPool(2);
+	boost::promise<void> awaited;
+	boost::shared_future<void> isAwaitedReady = awaited.get_future().share();
+	ThreadPool::Future<void> gated = pairPool.Submit([isAwaitedReady]
+	{
+		isAwaitedReady.wait();
+	});
+	vector<int> order;
+	ThreadPool::Future<void> high = pairPool.Spawn(
+	                RecordAfterAwait(gated, &order), ThreadPool::Task::HIGH);
+	bool isSuspended = WaitForPending(pairPool, 1);
+	boost::promise<void> busy;
+	boost::shared_future<void> released = busy.get_future().share();
+	pairPool.Submit([released]{ released.wait(); });
+	pairPool.Submit([&order]{ order.push_back(ThreadPool::Task::MEDIUM); });
+	awaited.set_value();
+	high.Wait();
+	busy.set_value();
+	pairPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Coroutine Test(resume priority): ";
+	Test(isSuspended && 2 == order.size() &&
+	     ThreadPool::Task::HIGH == order[0], true);
+
+	// a spawn dropped before it started unwinds, its future throws
+	ThreadPool singlePool(1);
+	boost::promise<void> blocked;
+	boost::shared_future<void> unblocked = blocked.get_future().share();
+	singlePool.Submit([unblocked]{ unblocked.wait(); });
+	ThreadPool::Future<int> dropped = singlePool.Spawn(SumOfSums(singlePool,
+	                                                             10));
+	std::vector<boost::shared_ptr<ThreadPool::Task> > unfinished =
+	                                    singlePool.Shutdown(ThreadPool::CANCEL,
+	                                    steady_clock::now() + milliseconds(10));
+	blocked.set_value();
+	unfinished.clear();
+	has_thrown = false;
+	try
+	{
+		dropped.Get();
+	}
+	catch (ThreadPool::TaskCancelled &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running Coroutine Test(dropped resume): ";
+	Test(has_thrown, true);
+}
+#else
+void CoroutineTest()
+{
+	// coroutines need C++20
+}
+#endif
+
+void StrandTest()
+{
+	ThreadPool threadPool(4);
+
+	// in order, one at a time, though four workers are free
+	const int numOfTasks = 1000;
+	ThreadPool::Strand strand(threadPool);
+	vector<int> order;
+	boost::atomic<int> inside(0);
+	boost::atomic<bool> overlapped(false);
+	vector<ThreadPool::Future<void> > posted;
+	for (int i = 0; i < numOfTasks; ++i)
+	{
+		posted.push_back(strand.Post([i, &order, &inside, &overlapped]
+		{
+			overlapped = overlapped || (0 != inside++);
+			order.push_back(i);
+			--inside;
+		}));
+	}
+	posted.back().Wait();
+	bool isInOrder = (numOfTasks == (int)order.size());
+	for (int i = 0; isInOrder && i < numOfTasks; ++i)
+	{
+		isInOrder = (i == order[i]);
+	}
+	cout << "Now Running Strand Test(serial order): ";
+	Test(isInOrder && !overlapped, true);
+
+	// different strands run in parallel: the second releases the first
+	ThreadPool::Strand other(threadPool);
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+	ThreadPool::Future<int> waiting = strand.Post([opened]
+	{
+		opened.wait();
+		return 1;
+	});
+	other.Post([&gate]{ gate.set_value(); });
+	cout << "Now Running Strand Test(parallel strands): ";
+	Test(waiting.WaitFor(milliseconds(5000)) && 1 == waiting.Get(), true);
+
+	// keyed strands: each key in order, and gone once idle
+	const int numOfKeys = 200;
+	const int tasksPerKey = 50;
+	ThreadPool::StrandMap<int> strands(threadPool);
+	vector<int> lastSeen(numOfKeys, -1);
+	boost::atomic<int> outOfOrder(0);
+	for (int i = 0; i < tasksPerKey; ++i)
+	{
+		for (int key = 0; key < numOfKeys; ++key)
+		{
+			strands.Post(key, [i, key, &lastSeen, &outOfOrder]
+			{
+				outOfOrder += (i - 1 != lastSeen[key]);
+				lastSeen[key] = i;
+			});
+		}
+	}
+	ThreadPool::Future<void> failed = strands.Post(0, &Throw);
+	bool has_thrown = false;
+	try
+	{
+		failed.Get();
+	}
+	catch (std::exception &)
+	{
+		has_thrown = true;
+	}
+	bool isDrained = threadPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Strand Test(keyed): ";
+	Test(isDrained && has_thrown && 0 == outOfOrder &&
+	     tasksPerKey - 1 == lastSeen[numOfKeys - 1] &&
+	     0 == strands.GetNumOfActiveStrands(), true);
+
+	// Shutdown hands back the tasks of a queued turn, and the strands
+	// schedule again afterwards
+	ThreadPool gatedPool(1);
+	boost::promise<void> shutGate;
+	gatedPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	                            new GateTask(shutGate.get_future().share())));
+	ThreadPool::Strand gatedStrand(gatedPool);
+	ThreadPool::StrandMap<int> gatedStrands(gatedPool);
+	ThreadPool::Future<int> cancelled = gatedStrand.Post([]{ return 1; });
+	gatedStrand.Post([]{ return 2; });
+	gatedStrands.Post(5, []{ return 3; });
+	vector<boost::shared_ptr<ThreadPool::Task> > unfinished =
+	                gatedPool.Shutdown(ThreadPool::CANCEL,
+	                                   steady_clock::now() + milliseconds(20));
+	size_t numOfActive = gatedStrands.GetNumOfActiveStrands();
+	shutGate.set_value();
+	has_thrown = false;
+	try
+	{
+		cancelled.Get();
+	}
+	catch (ThreadPool::TaskCancelled &)
+	{
+		has_thrown = true;
+	}
+	ThreadPool::Future<int> again = gatedStrand.Post([]{ return 4; });
+	ThreadPool::Future<int> keyedAgain = gatedStrands.Post(5, []{ return 5; });
+	cout << "Now Running Strand Test(dropped turn): ";
+	Test(4 == unfinished.size() && 0 == numOfActive && has_thrown &&
+	     again.WaitFor(milliseconds(5000)) && 4 == again.Get() &&
+	     keyedAgain.WaitFor(milliseconds(5000)) && 5 == keyedAgain.Get(),
+	     true);
+
+	// a thread that is no worker helps a group past a queued turn, and
+	// leaves the turn to the workers
+	ThreadPool helpedPool(1);
+	boost::promise<void> helpGate;
+	helpedPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+	                            new GateTask(helpGate.get_future().share())));
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (0 == helpedPool.GetStats().busyThreads &&
+	       steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+	ThreadPool::Strand helpedStrand(helpedPool);
+	boost::thread::id callerId = boost::this_thread::get_id();
+	ThreadPool::Future<bool> onWorker = helpedStrand.Post([callerId]
+	{
+		return (callerId != boost::this_thread::get_id());
+	});
+	ThreadPool::TaskGroup helpedGroup(helpedPool);
+	bool isHelped = false;
+	helpedGroup.Run([&isHelped]{ isHelped = true; });
+	helpedGroup.Wait();
+	bool isTurnQueued = !onWorker.IsReady();
+	helpGate.set_value();
+	cout << "Now Running Strand Test(helper skips turn): ";
+	Test(isHelped && isTurnQueued && onWorker.WaitFor(milliseconds(5000)) &&
+	     onWorker.Get(), true);
+
+	// each strand task is run, and counted, as a task of its own
+	ThreadPool countedPool(2);
+	ThreadPool::Strand counted(countedPool);
+	for (int i = 0; i < 5; ++i)
+	{
+		counted.Post([]{});
+	}
+	counted.Post([]{}).Wait();
+	countedPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Strand Test(stats): ";
+	Test(countedPool.GetStats().tasksExecuted, (size_t)6);
+}
+
+static bool WaitForBlocked(ThreadPool &pool, size_t blocked)
+{
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (blocked != pool.GetStats().blockedThreads)
+	{
+		if (steady_clock::now() > deadline)
+		{
+			return false;
+		}
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+
+	return true;
+}
+
+void BlockingTest()
+{
+	ThreadPool::Options options;
+	options.maxSpareThreads = 1;
+	options.keepAlive = milliseconds(20);
+	ThreadPool threadPool(1, options);
+	ThreadPool gatePool(1);
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+
+	// the only worker blocks, a spare takes over
+	ThreadPool::Future<void> first = threadPool.Submit([opened]
+	{
+		ThreadPool::RunBlocking([&opened]{ opened.wait(); });
+	});
+	bool isBlocked = WaitForBlocked(threadPool, 1);
+	ThreadPool::Future<int> meanwhile = threadPool.Submit([]{ return 7; });
+	cout << "Now Running Blocking Test(spare): ";
+	Test(isBlocked && meanwhile.WaitFor(milliseconds(5000)) &&
+	     7 == meanwhile.Get() && 1 == threadPool.GetStats().spareThreads &&
+	     1 == threadPool.GetNumOfThreads(), true);
+
+	// a wait on a future blocks too, but the cap leaves no spare for it
+	ThreadPool::Future<void> gated = gatePool.Submit([opened]
+	{
+		opened.wait();
+	});
+	ThreadPool::Future<void> second = threadPool.Submit([gated]
+	{
+		gated.Wait();
+	});
+	isBlocked = WaitForBlocked(threadPool, 2);
+	ThreadPool::Future<int> stalled = threadPool.Submit([]{ return 8; });
+	bool isStalled = !stalled.WaitFor(milliseconds(20));
+	gate.set_value();
+	cout << "Now Running Blocking Test(cap): ";
+	Test(isBlocked && isStalled && stalled.WaitFor(milliseconds(5000)) &&
+	     8 == stalled.Get() && 1 == threadPool.GetStats().spareThreads, true);
+
+	// once nobody blocks, the spare parks and leaves after keepAlive
+	first.Wait();
+	second.Wait();
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (0 != threadPool.GetStats().spareThreads &&
+	       steady_clock::now() < deadline)
+	{
+		threadPool.Submit([]{}).Wait(); // a worker checks between tasks
+		boost::this_thread::sleep_for(milliseconds(5));
+	}
+	ThreadPool::Stats stats = threadPool.GetStats();
+	cout << "Now Running Blocking Test(retire): ";
+	Test(0 == stats.spareThreads && 0 == stats.blockedThreads &&
+	     1 == stats.numOfThreads, true);
+}
+
+class ExpiringTask : public ThreadPool::Task
+{
+public:
+	ExpiringTask(boost::atomic<int> *executed, boost::atomic<int> *expired)
+	                            : m_executed(executed), m_expired(expired) {}
+
+private:
+	void Execute()
+	{
+		++(*m_executed);
+	}
+	void OnExpired()
+	{
+		++(*m_expired);
+	}
+	boost::atomic<int> *m_executed;
+	boost::atomic<int> *m_expired;
+};
+
+static void SleepFor(milliseconds duration)
+{
+	boost::this_thread::sleep_for(duration);
+}
+
+void DeadlineTest()
+{
+	ThreadPool threadPool(1);
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+	threadPool.Submit([opened]{ opened.wait(); });
+
+	// both wait behind the gate past their deadline
+	boost::atomic<int> executed(0);
+	boost::atomic<int> expired(0);
+	boost::shared_ptr<ThreadPool::Task> task(new ExpiringTask(&executed, &expired));
+	task->SetDeadline(steady_clock::now() + milliseconds(10));
+	threadPool.AddTask(task);
+	ThreadPool::Future<int> late = threadPool.Submit([]{ return 1; },
+	                                   steady_clock::now() + milliseconds(10));
+	ThreadPool::Future<int> onTime = threadPool.Submit([]{ return 2; },
+	                                   steady_clock::now() + seconds(60));
+	SleepFor(milliseconds(20));
+	gate.set_value();
+
+	bool has_thrown = false;
+	try
+	{
+		late.Get();
+	}
+	catch (ThreadPool::TaskExpired &)
+	{
+		has_thrown = true;
+	}
+	cout << "Now Running Deadline Test(expired): ";
+	Test(has_thrown && 2 == onTime.Get() && 0 == executed && 1 == expired &&
+	     2 == threadPool.GetStats().tasksExpired, true);
+
+	// tasks of 5ms: past two queued, a new one would wait over 10ms
+	ThreadPool::Options options;
+	options.maxQueueWait = milliseconds(10);
+	ThreadPool sheddingPool(1, options);
+	for (int i = 0; i < 8; ++i)
+	{
+		sheddingPool.Submit(boost::bind(SleepFor, milliseconds(5))).Wait();
+	}
+	boost::promise<void> busy;
+	boost::shared_future<void> released = busy.get_future().share();
+	sheddingPool.Submit([released]{ released.wait(); });
+	int admitted = 0;
+	int shed = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		try
+		{
+			sheddingPool.Submit(boost::bind(SleepFor, milliseconds(5)));
+			++admitted;
+		}
+		catch (ThreadPool::Overloaded &)
+		{
+			++shed;
+		}
+	}
+	busy.set_value();
+	bool isDrained = sheddingPool.Drain(steady_clock::now() + seconds(5));
+	bool isAdmittedAgain = true;
+	try
+	{
+		sheddingPool.Submit([]{}).Wait();
+	}
+	catch (ThreadPool::Overloaded &)
+	{
+		isAdmittedAgain = false;
+	}
+	cout << "Now Running Deadline Test(load shedding): ";
+	Test(isDrained && isAdmittedAgain && 0 < admitted && 0 < shed &&
+	     shed == (int)sheddingPool.GetStats().tasksShed, true);
+}
+
+static void RunGated(boost::shared_future<void> opened,
+                     boost::atomic<int> *running, boost::atomic<int> *most)
+{
+	int now = ++(*running);
+	int seen = *most;
+	while (seen < now && !most->compare_exchange_weak(seen, now))
+	{
+		// another task raised it meanwhile
+	}
+	opened.wait();
+	--(*running);
+}
+
+void ReservationTest()
+{
+	// of 3 workers, 2 are kept for HIGH and SUPREME
+	ThreadPool::Options options;
+	options.reservedThreads.resize(ThreadPool::Task::SUPREME + 1);
+	options.reservedThreads[ThreadPool::Task::HIGH] = 2;
+	ThreadPool threadPool(3, options);
+	boost::promise<void> gate;
+	boost::shared_future<void> opened = gate.get_future().share();
+	boost::atomic<int> running(0);
+	boost::atomic<int> most(0);
+
+	std::vector<ThreadPool::Future<void> > lows;
+	for (int i = 0; i < 4; ++i)
+	{
+		lows.push_back(threadPool.Submit(boost::bind(RunGated, opened,
+		                                             &running, &most),
+		                                 ThreadPool::Task::LOW));
+	}
+	ThreadPool::Future<int> urgent = threadPool.Submit([]{ return 3; },
+	                                                ThreadPool::Task::SUPREME);
+	bool isServed = urgent.WaitFor(milliseconds(5000)) && 3 == urgent.Get();
+	steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+	while (3 != threadPool.GetStats().heldTasks &&
+	       steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+	size_t held = threadPool.GetStats().heldTasks;
+	bool mostWasOne = (1 == most);
+
+	// 2 more workers leave 3 unreserved, 2 of the held tasks start at once
+	threadPool.SetNumOfThreads(5);
+	deadline = steady_clock::now() + seconds(5);
+	while (3 != most && steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+	size_t heldAfterGrowth = threadPool.GetStats().heldTasks;
+	gate.set_value();
+	bool isDrained = threadPool.Drain(steady_clock::now() + seconds(5));
+	cout << "Now Running Reservation Test(reserved): ";
+	Test(isServed && 3 == held && mostWasOne && 3 == most &&
+	     1 == heldAfterGrowth && isDrained &&
+	     0 == threadPool.GetStats().heldTasks, true);
+
+	// LOW tasks borrow the reserved workers once they are known to run short
+	options.maxBorrowingRunTime = milliseconds(100);
+	ThreadPool borrowingPool(3, options);
+	boost::promise<void> borrowGate;
+	boost::shared_future<void> borrowOpened = borrowGate.get_future().share();
+	running = 0;
+	most = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		borrowingPool.Submit(boost::bind(RunGated, borrowOpened, &running,
+		                                 &most), ThreadPool::Task::LOW);
+	}
+	deadline = steady_clock::now() + seconds(5);
+	while (2 != borrowingPool.GetStats().heldTasks &&
+	       steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+	bool isUnsampledHeld = (1 == most &&
+	                        2 == borrowingPool.GetStats().heldTasks);
+	borrowGate.set_value();
+	borrowingPool.Drain(steady_clock::now() + seconds(5));
+
+	boost::promise<void> secondGate;
+	borrowOpened = secondGate.get_future().share();
+	running = 0;
+	most = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		borrowingPool.Submit(boost::bind(RunGated, borrowOpened, &running,
+		                                 &most), ThreadPool::Task::LOW);
+	}
+	deadline = steady_clock::now() + seconds(5);
+	while (3 != most && steady_clock::now() < deadline)
+	{
+		boost::this_thread::sleep_for(milliseconds(1));
+	}
+	secondGate.set_value();
+	cout << "Now Running Reservation Test(borrowing): ";
+	Test(isUnsampledHeld && 3 == most &&
+	     borrowingPool.Drain(steady_clock::now() + seconds(5)), true);
+}
+
+static size_t CountOf(const string &text, const string &pattern)
+{
+	size_t count = 0;
+	for (size_t at = text.find(pattern); string::npos != at;
+	     at = text.find(pattern, at + 1))
+	{
+		++count;
+	}
+
+	return count;
+}
+
+void TracingTest()
+{
+	Tracer tracer;
+	ThreadPool::Options options;
+	options.tracer = &tracer;
+	ThreadPool threadPool(2, options);
+
+	// disabled, it records nothing
+	threadPool.Submit([]{}).Wait();
+	threadPool.Drain(steady_clock::now() + seconds(5));
+	bool isQuiet = (0 == tracer.GetNumOfEvents());
+
+	tracer.Enable();
+	for (int i = 0; i < 5; ++i)
+	{
+		threadPool.Submit([]{}, ThreadPool::Task::HIGH);
+		threadPool.AddTask(boost::shared_ptr<ThreadPool::Task>(
+		                                                    new BasicTask()));
+	}
+	bool isDrained = threadPool.Drain(steady_clock::now() + seconds(5));
+	tracer.Disable();
+	std::stringstream json;
+	tracer.WriteChromeTrace(json);
+	string trace = json.str();
+
+	cout << "Now Running Tracing Test: ";
+	Test(isQuiet && isDrained &&
+	     10 == CountOf(trace, "\"cat\":\"enqueue\"") &&
+	     10 == CountOf(trace, "\"cat\":\"dequeue\"") &&
+	     10 == CountOf(trace, "\"ph\":\"B\"") &&
+	     10 == CountOf(trace, "\"ph\":\"E\"") &&
+	     10 == CountOf(trace, "\"ph\":\"f\"") &&
+	     20 == CountOf(trace, "\"name\":\"BasicTask\"") &&
+	     20 == CountOf(trace, "\"priority\":2") &&
+	     0 != CountOf(trace, "\"name\":\"worker ") &&
+	     0 != CountOf(trace, "\"name\":\"task queue\""), true);
+}
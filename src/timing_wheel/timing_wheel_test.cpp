@@ -0,0 +1,101 @@
+/* welcome to timing_wheel_test.cpp */
+/******************************************************************************
+ * 																			  *
+ *							CREATED BY: Gil						              *
+ * 																		      *
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <iterator>
+
+#include "ca_test_util.hpp"
+#include "timing_wheel.hpp"
+
+using namespace GHS::project;
+using namespace ca_test_util;
+
+size_t g_numOfChecks = 0;
+const int g_numOfTests = 1;
+// array of function pointers
+bool (*g_testFunc[g_numOfTests])() = {0};
+// array of function names as string
+std::string g_testNames[g_numOfTests];
+
+static void _SetUpTables();
+static void RunTest(const char *name, bool (*test)(), int);
+static void PrintYellow(const char *str);
+bool TimingWheelTest();
+
+int main()
+{
+    int randNum = (rand() % 23) + g_numOfTests;
+
+    _SetUpTables();
+
+    for (int i = 0; randNum > i; ++i, ++g_numOfChecks)
+    {
+        RunTest(g_testNames[i % g_numOfTests].c_str(),
+                               g_testFunc[i % g_numOfTests], 1);
+    }
+
+    for (int i = 0; g_numOfTests > i; ++i, ++g_numOfChecks)
+    {
+        RunTest(g_testNames[i].c_str(),
+                               g_testFunc[i], 1);
+    }
+
+    char buffer[BUFSIZ] = {0};
+    sprintf(buffer, "number of tests success: %ld\n", g_numOfChecks);
+    PrintYellow(buffer);
+
+    return 0;
+}
+
+static void _SetUpTables()
+{
+    g_testFunc[0]=&TimingWheelTest;
+    g_testNames[0]="TimingWheelTest";
+}
+
+static void RunTest(const char *name, bool (*test)(), int)
+{
+    std::cout << "Now Running " << name << ": ";
+    BoolTest(test());
+}
+
+static void PrintYellow(const char *str)
+{
+    std::cout << YELLOW << str << DEFUALT_COLOR;
+}
+
+bool TimingWheelTest()
+{
+    // due ticks on every wheel, the first one also "in the past"
+    const TimingWheel<int>::tick_t dueTicks[] = {0, 5, 255, 256, 300, 70000,
+                                                 70001, 16777300};
+    const size_t numOfItems = sizeof(dueTicks) / sizeof(*dueTicks);
+
+    TimingWheel<int> wheel(0);
+    for (size_t i = numOfItems; 0 < i; --i)
+    {
+        wheel.Schedule(static_cast<int>(i - 1), dueTicks[i - 1]);
+    }
+
+    bool isCorrect = (numOfItems == wheel.size());
+    std::vector<int> expired;
+    for (size_t i = 0; i < numOfItems; ++i)
+    {
+        TimingWheel<int>::tick_t due = (0 == dueTicks[i]) ? 1 : dueTicks[i];
+
+        // nothing comes out a tick early, and the item comes out on time
+        wheel.Advance(due - 1, std::back_inserter(expired));
+        isCorrect = isCorrect && (i == expired.size());
+        wheel.Advance(due, std::back_inserter(expired));
+        isCorrect = isCorrect && (i + 1 == expired.size()) &&
+                    (static_cast<int>(i) == expired.back());
+    }
+
+    return (isCorrect && wheel.empty());
+}
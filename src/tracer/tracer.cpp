@@ -0,0 +1,321 @@
+/* welcome to tracer.cpp */
+/******************************************************************************
+ * 																			  *
+ *							CREATED BY: Gil						              *
+ * 																		      *
+ ******************************************************************************/
+
+#include <ios>                      // ios_base::fmtflags
+#include <algorithm>                // min
+#include <utility>                  // make_pair
+#include <cstdlib>                  // free
+#include <boost/noncopyable.hpp>    // noncopyable
+
+#ifdef __GNUG__
+#include <cxxabi.h>                 // __cxa_demangle
+#endif
+
+#include "tracer.hpp"
+
+using std::string;
+using std::vector;
+using boost::mutex;
+using boost::chrono::nanoseconds;
+using boost::chrono::steady_clock;
+
+//╔═══════════════════════   static utils and defs   ══════════════════════════╗
+// the trace shows one process, the pool's
+static const int TRACE_PID = 1;
+
+static boost::atomic<boost::uint64_t> s_nextTracerId(1);
+// the ring of the tracer the calling thread recorded into last
+static thread_local boost::uint64_t tls_tracerId = 0;
+static thread_local void *tls_ring = NULL;
+
+static void WriteQuoted(std::ostream &out, const string &text)
+{
+	out << '"';
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(text[i]);
+		if ('"' == c || '\\' == c)
+		{
+			out << '\\' << c;
+		}
+		else if (c < 0x20)
+		{
+			out << ' '; // names hold no control characters worth keeping
+		}
+		else
+		{
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+// "ph", "ts", "pid" and "tid", the fields every event of a thread has
+static void WriteHeader(std::ostream &out, const char *phase,
+                        boost::int64_t time, size_t tid)
+{
+	out << ",\n{\"ph\":\"" << phase << "\",\"ts\":" << time / 1000 << '.';
+	out.width(3);
+	out.fill('0');
+	out << time % 1000 << ",\"pid\":" << TRACE_PID << ",\"tid\":" << tid;
+}
+//╚═══════════════════════   static utils and defs   ══════════════════════════╝
+
+namespace GHS
+{
+namespace project
+{
+// ═════════════════════════      Tracer::Ring      ════════════════════════════
+// written by its own thread only. the writer announces a slot in m_begun
+// before it writes it, and publishes it in m_done after, so a reader can
+// tell which of the slots it copied were overwritten meanwhile
+class Tracer::Ring : private boost::noncopyable
+{
+public:
+	Ring(size_t capacity, size_t threadIndex);
+
+	void Push(const Event &event);
+	// appends the events held, oldest first
+	void CopyTo(vector<Event> &out) const;
+	size_t GetSize() const;
+	size_t GetThreadIndex() const;
+
+private:
+	vector<Event> m_events;
+	const size_t m_threadIndex;
+	boost::atomic<size_t> m_begun;
+	boost::atomic<size_t> m_done;
+};
+
+//╔═════════════════════════      Tracer(API)       ═══════════════════════════╗
+Tracer::Tracer(size_t eventsPerThread)
+                    : m_eventsPerThread(eventsPerThread ? eventsPerThread : 1),
+                      m_id(s_nextTracerId++),
+                      m_epoch(steady_clock::now()),
+                      m_isEnabled(false)
+{
+	// empty
+}
+
+void Tracer::Enable()
+{
+	m_isEnabled.store(true, boost::memory_order_relaxed);
+}
+
+void Tracer::Disable()
+{
+	m_isEnabled.store(false, boost::memory_order_relaxed);
+}
+
+void Tracer::Record(event_type type, const void *id, const char *name,
+                    size_t value)
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	Event event;
+	event.m_time = nanoseconds(steady_clock::now() - m_epoch).count();
+	event.m_id = id;
+	event.m_name = name;
+	event.m_value = value;
+	event.m_type = type;
+	GetRing().Push(event);
+}
+
+void Tracer::SetThreadName(const string &name)
+{
+	mutex::scoped_lock lock(m_mutex);
+	m_threadNames[boost::this_thread::get_id()] = name;
+}
+
+size_t Tracer::GetNumOfEvents() const
+{
+	mutex::scoped_lock lock(m_mutex);
+	size_t numOfEvents = 0;
+	for (ring_map::const_iterator it = m_rings.begin(); it != m_rings.end();
+	     ++it)
+	{
+		numOfEvents += it->second->GetSize();
+	}
+
+	return numOfEvents;
+}
+
+void Tracer::WriteChromeTrace(std::ostream &out) const
+{
+	vector<boost::shared_ptr<Ring> > rings;
+	vector<string> threadNames;
+	{
+		mutex::scoped_lock lock(m_mutex);
+		for (ring_map::const_iterator it = m_rings.begin();
+		     it != m_rings.end(); ++it)
+		{
+			rings.push_back(it->second);
+			name_map::const_iterator name = m_threadNames.find(it->first);
+			threadNames.push_back((m_threadNames.end() == name)
+			                      ? string() : name->second);
+		}
+	}
+
+	std::ios_base::fmtflags flags = out.flags();
+	char fill = out.fill();
+	out << std::dec << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+	    << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << TRACE_PID
+	    << ",\"args\":{\"name\":\"thread pool\"}}";
+
+	std::map<const char *, string> typeNames; // demangled once per type
+	vector<Event> events;
+	for (size_t i = 0; i < rings.size(); ++i)
+	{
+		size_t tid = rings[i]->GetThreadIndex();
+		if (!threadNames[i].empty())
+		{
+			out << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":"
+			    << TRACE_PID << ",\"tid\":" << tid << ",\"args\":{\"name\":";
+			WriteQuoted(out, threadNames[i]);
+			out << "}}";
+		}
+
+		events.clear();
+		rings[i]->CopyTo(events);
+		for (size_t j = 0; j < events.size(); ++j)
+		{
+			const Event &event = events[j];
+			if (COUNTER == event.m_type)
+			{
+				WriteHeader(out, "C", event.m_time, tid);
+				out << ",\"name\":";
+				WriteQuoted(out, event.m_name);
+				out << ",\"id\":\"" << event.m_id << "\",\"args\":{\"size\":"
+				    << event.m_value << "}}";
+				continue;
+			}
+
+			std::map<const char *, string>::iterator name =
+			                                    typeNames.find(event.m_name);
+			if (typeNames.end() == name)
+			{
+				name = typeNames.insert(std::make_pair(event.m_name,
+				                               TypeName(event.m_name))).first;
+			}
+			static const char *const PHASES[] = { "i", "i", "B", "E" };
+			static const char *const CATEGORIES[] = { "enqueue", "dequeue",
+			                                          "task", "task" };
+			WriteHeader(out, PHASES[event.m_type], event.m_time, tid);
+			out << ",\"cat\":\"" << CATEGORIES[event.m_type] << "\",\"name\":";
+			WriteQuoted(out, name->second);
+			out << ",\"args\":{\"task\":\"" << event.m_id
+			    << "\",\"priority\":" << event.m_value << '}'
+			    << ((START > event.m_type) ? ",\"s\":\"t\"}" : "}");
+
+			// an arrow from where the task was queued to where it ran
+			if (ENQUEUE == event.m_type || START == event.m_type)
+			{
+				WriteHeader(out, (ENQUEUE == event.m_type) ? "s" : "f",
+				            event.m_time, tid);
+				out << ",\"cat\":\"queued\",\"name\":\"queued\",\"id\":\""
+				    << event.m_id << "\",\"bp\":\"e\"}";
+			}
+		}
+	}
+
+	out << "\n]}\n";
+	out.flags(flags);
+	out.fill(fill);
+}
+//╚═════════════════════════      Tracer(API)       ═══════════════════════════╝
+
+//╔═════════════════════════      Tracer(IMP)       ═══════════════════════════╗
+Tracer::Ring &Tracer::GetRing()
+{
+	if (m_id == tls_tracerId)
+	{
+		return *static_cast<Ring *>(tls_ring);
+	}
+
+	mutex::scoped_lock lock(m_mutex);
+	boost::shared_ptr<Ring> &ring = m_rings[boost::this_thread::get_id()];
+	if (!ring)
+	{
+		ring.reset(new Ring(m_eventsPerThread, m_rings.size()));
+	}
+	tls_tracerId = m_id;
+	tls_ring = ring.get();
+
+	return *ring;
+}
+
+string Tracer::TypeName(const char *mangled)
+{
+#ifdef __GNUG__
+	int status = 0;
+	char *demangled = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+	if (0 == status)
+	{
+		string name(demangled);
+		std::free(demangled);
+		return name;
+	}
+#endif
+
+	return mangled; // not a type name after all, or not a GNU compiler
+}
+// ═════════════════════════      Tracer::Ring      ════════════════════════════
+Tracer::Ring::Ring(size_t capacity, size_t threadIndex)
+                                                : m_events(capacity),
+                                                  m_threadIndex(threadIndex),
+                                                  m_begun(0),
+                                                  m_done(0)
+{
+	// empty
+}
+
+void Tracer::Ring::Push(const Event &event)
+{
+	size_t index = m_begun.load(boost::memory_order_relaxed);
+	m_begun.store(index + 1, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	m_events[index % m_events.size()] = event;
+	m_done.store(index + 1, boost::memory_order_release);
+}
+
+void Tracer::Ring::CopyTo(vector<Event> &out) const
+{
+	size_t capacity = m_events.size();
+	size_t done = m_done.load(boost::memory_order_acquire);
+	size_t first = (done > capacity) ? done - capacity : 0;
+	size_t start = out.size();
+	for (size_t i = first; i < done; ++i)
+	{
+		out.push_back(m_events[i % capacity]);
+	}
+
+	// whatever the writer announced by now may have overwritten a copied slot
+	boost::atomic_thread_fence(boost::memory_order_acquire);
+	size_t begun = m_begun.load(boost::memory_order_relaxed);
+	size_t firstIntact = (begun > capacity) ? begun - capacity : 0;
+	if (firstIntact > first)
+	{
+		size_t numOfTorn = std::min(firstIntact - first, done - first);
+		out.erase(out.begin() + start, out.begin() + start + numOfTorn);
+	}
+}
+
+size_t Tracer::Ring::GetSize() const
+{
+	return std::min(m_done.load(boost::memory_order_acquire), m_events.size());
+}
+
+size_t Tracer::Ring::GetThreadIndex() const
+{
+	return m_threadIndex;
+}
+//╚═════════════════════════      Tracer(IMP)       ═══════════════════════════╝
+} // namespace project
+} // namespace GHS
@@ -8,11 +8,18 @@
 
 #include <boost/thread.hpp>     // boost::thread
 #include <cstdio>
+#include <vector>
+#include <memory>
+#include <sstream>
 
+#include "ca_test_util.hpp"
 #include "waitable_queue.hpp"
+#include "bucket_queue.hpp"
+#include "work_stealing_queue.hpp"
+#include "tracer.hpp"
 
-using namespace ilrd;
-using namespace project;
+using namespace GHS::project;
+using namespace ca_test_util;
 
 const static int S_NUM = 5000;
 
@@ -20,20 +27,48 @@ void TryPop(WaitableQueue<int> *wq);
 void TryPopTimeout(WaitableQueue<int> *wq, bool *result);
 void TryPush(WaitableQueue<int> *wq);
 
+typedef WaitableQueue<int, MPMCRingBuffer<int> > ring_queue;
+void RingProduce(ring_queue *wq, int amount);
+void RingConsume(ring_queue *wq, int amount, long *sum);
+
+// items are (level * 100 + serial); level 0 is a sentinel level
+struct IntLevels
+{
+    enum { NUM_LEVELS = 4, FIRST_AGING_LEVEL = 1 };
+    static size_t Level(int item) { return item / 100; }
+};
+typedef BucketQueue<int, IntLevels> int_buckets;
+
 size_t g_numOfChecks = 0;
-const int g_numOfTests = 6;
+const int g_numOfTests = 20;
 // array of function pointers
 bool (*g_testFunc[g_numOfTests])() = {0};
 // array of function names as string
 std::string g_testNames[g_numOfTests];
 
 static void _SetUpTables();
+static void RunTest(const char *name, bool (*test)(), int);
+static void PrintYellow(const char *str);
 bool CtorDtorTest();
 bool PushTest();
 bool PopBeforePushTest();
 bool PopAfterPushTest();
 bool PopWithTimeoutWithPushTest();
 bool PopWithTimeoutWithoutPushTest();
+bool RingQueueProducersConsumersTest();
+bool RingQueueTimeoutTest();
+bool BucketQueueOrderTest();
+bool BucketQueueAgingTest();
+bool PushRangePopBatchTest();
+bool MoveOnlyItemsTest();
+bool StatsTest();
+bool WaitStrategyTest();
+bool BoundedQueueTest();
+bool CloseTest();
+bool SelectTest();
+bool TraceTest();
+bool RingQueueCloseTest();
+bool LanePriorityTest();
 
 int main()
 {
@@ -74,6 +109,45 @@ static void _SetUpTables()
     g_testNames[4]="PopWithTimeoutWithPushTest";
     g_testFunc[5]=&PopWithTimeoutWithoutPushTest;
     g_testNames[5]="PopWithTimeoutWithoutPushTest";
+    g_testFunc[6]=&RingQueueProducersConsumersTest;
+    g_testNames[6]="RingQueueProducersConsumersTest";
+    g_testFunc[7]=&RingQueueTimeoutTest;
+    g_testNames[7]="RingQueueTimeoutTest";
+    g_testFunc[8]=&BucketQueueOrderTest;
+    g_testNames[8]="BucketQueueOrderTest";
+    g_testFunc[9]=&BucketQueueAgingTest;
+    g_testNames[9]="BucketQueueAgingTest";
+    g_testFunc[10]=&PushRangePopBatchTest;
+    g_testNames[10]="PushRangePopBatchTest";
+    g_testFunc[11]=&MoveOnlyItemsTest;
+    g_testNames[11]="MoveOnlyItemsTest";
+    g_testFunc[12]=&StatsTest;
+    g_testNames[12]="StatsTest";
+    g_testFunc[13]=&WaitStrategyTest;
+    g_testNames[13]="WaitStrategyTest";
+    g_testFunc[14]=&BoundedQueueTest;
+    g_testNames[14]="BoundedQueueTest";
+    g_testFunc[15]=&CloseTest;
+    g_testNames[15]="CloseTest";
+    g_testFunc[16]=&SelectTest;
+    g_testNames[16]="SelectTest";
+    g_testFunc[17]=&TraceTest;
+    g_testNames[17]="TraceTest";
+    g_testFunc[18]=&RingQueueCloseTest;
+    g_testNames[18]="RingQueueCloseTest";
+    g_testFunc[19]=&LanePriorityTest;
+    g_testNames[19]="LanePriorityTest";
+}
+
+static void RunTest(const char *name, bool (*test)(), int)
+{
+    std::cout << "Now Running " << name << ": ";
+    BoolTest(test());
+}
+
+static void PrintYellow(const char *str)
+{
+    std::cout << YELLOW << str << DEFUALT_COLOR;
 }
 
 void TryPop(WaitableQueue<int> *wq)
@@ -236,3 +310,577 @@ bool PopWithTimeoutWithoutPushTest()
 
     return wq.IsEmpty();
 }
+
+void RingProduce(ring_queue *wq, int amount)
+{
+    for (int i = 1; amount >= i; ++i)
+    {
+        wq->Push(i);
+    }
+}
+
+void RingConsume(ring_queue *wq, int amount, long *sum)
+{
+    for (int i = 0; amount > i; ++i)
+    {
+        int value = 0;
+        wq->Pop(value);
+        *sum += value;
+    }
+}
+
+bool RingQueueProducersConsumersTest()
+{
+    // a small ring forces both producers and consumers to park
+    ring_queue wq(8);
+
+    boost::thread producers[4];
+    boost::thread consumers[4];
+    long sums[4] = {0};
+
+    for (int i = 0; 4 > i; ++i)
+    {
+        consumers[i] = boost::thread(RingConsume, &wq, S_NUM, sums + i);
+    }
+
+    for (int i = 0; 4 > i; ++i)
+    {
+        producers[i] = boost::thread(RingProduce, &wq, S_NUM);
+    }
+
+    for (int i = 0; 4 > i; ++i)
+    {
+        producers[i].join();
+        consumers[i].join();
+    }
+
+    long expected = 4L * S_NUM * (S_NUM + 1) / 2;
+    return (wq.IsEmpty() &&
+            expected == sums[0] + sums[1] + sums[2] + sums[3]);
+}
+
+bool RingQueueTimeoutTest()
+{
+    ring_queue wq(2);
+    int out = 0;
+
+    if (wq.Pop(out, boost::chrono::nanoseconds(1000)))
+    {
+        return false;
+    }
+
+    bool filled = wq.TryPush(1) && wq.TryPush(2) && !wq.TryPush(3);
+
+    return (filled && wq.Pop(out, boost::chrono::nanoseconds(1000)) &&
+            1 == out && wq.TryPop(out) && 2 == out && wq.IsEmpty());
+}
+
+bool BucketQueueOrderTest()
+{
+    WaitableQueue<int, int_buckets> wq;
+    const int pushed[] = {101, 301, 1, 201, 102, 302, 2, 202};
+    const int expected[] = {301, 302, 201, 202, 101, 102, 1, 2};
+
+    for (int i = 0; 8 > i; ++i)
+    {
+        wq.Push(pushed[i]);
+    }
+
+    for (int i = 0; 8 > i; ++i)
+    {
+        int out = 0;
+        wq.Pop(out);
+        if (expected[i] != out)
+        {
+            return false;
+        }
+    }
+
+    return wq.IsEmpty();
+}
+
+bool BucketQueueAgingTest()
+{
+    int_buckets buckets(3);
+
+    buckets.push(1);
+    buckets.push(101);
+    for (int i = 0; 10 > i; ++i)
+    {
+        buckets.push(300 + i);
+    }
+
+    // level 1 is passed over three times and then served, the sentinel
+    // level never ages and waits for everything else
+    const int expected[] = {300, 301, 302, 101, 303};
+    for (int i = 0; 5 > i; ++i)
+    {
+        if (expected[i] != buckets.front())
+        {
+            return false;
+        }
+        buckets.pop();
+    }
+
+    for (int i = 0; 6 > i; ++i)
+    {
+        buckets.pop();
+    }
+
+    return (1 == buckets.front() && 1 == buckets.size());
+}
+
+bool PushRangePopBatchTest()
+{
+    WaitableQueue<int> wq;
+    const int items[] = {1, 2, 3, 4, 5, 6, 7};
+    wq.PushRange(items, items + 7);
+
+    std::vector<int> out;
+    size_t first = wq.PopBatch(std::back_inserter(out), 4);
+    size_t second = wq.PopBatch(std::back_inserter(out), 4);
+    size_t third = wq.PopBatch(std::back_inserter(out), 4,
+                               boost::chrono::nanoseconds(1000));
+
+    // batches smaller than the lanes start where the previous one stopped
+    WorkStealingQueue<int> lanes(3);
+    lanes.PushRange(items, items + 1);
+    lanes.PushRange(items + 1, items + 2);
+    lanes.PushRange(items + 2, items + 3);
+    std::vector<int> perLane;
+    bool isSpread = true;
+    for (size_t lane = 0; 3 > lane; ++lane)
+    {
+        isSpread = isSpread &&
+                   (1 == lanes.PopBatch(std::back_inserter(perLane), 4, lane));
+    }
+
+    return (4 == first && 3 == second && 0 == third &&
+            std::vector<int>(items, items + 7) == out && wq.IsEmpty() &&
+            isSpread && std::vector<int>(items, items + 3) == perLane);
+}
+
+bool MoveOnlyItemsTest()
+{
+    typedef std::unique_ptr<int> owned;
+
+    WaitableQueue<owned> fifo;
+    fifo.Push(owned(new int(1)));
+    fifo.Emplace(new int(2));
+
+    PriorityQueue<int> heap;
+    heap.emplace(3);
+    heap.push(7);
+    heap.push(5);
+
+    WaitableQueue<owned, MPMCRingBuffer<owned> > ring(4);
+    ring.Emplace(new int(4));
+
+    owned first, second, fromRing;
+    fifo.Pop(first);
+    fifo.Pop(second);
+    ring.Pop(fromRing);
+
+    int top = 0;
+    heap.pop(top);
+
+    return (1 == *first && 2 == *second && 4 == *fromRing && 7 == top &&
+            5 == heap.front() && fifo.IsEmpty() && ring.IsEmpty());
+}
+
+bool StatsTest()
+{
+    WaitableQueue<int> fifo;
+    fifo.Push(1);
+    fifo.Push(2);
+    fifo.Push(3);
+    int out = 0;
+    fifo.Pop(out);
+    QueueStats fifoStats = fifo.GetStats();
+
+    WorkStealingQueue<int> lanes(2);
+    lanes.Push(1, 0);
+    lanes.Push(2, 1);
+    lanes.Pop(out, 0);
+    QueueStats lanesStats = lanes.GetStats();
+
+    return (2 == fifoStats.size && 4 == fifoStats.lockAcquisitions &&
+            0 == fifoStats.contendedLocks &&
+            1 == lanesStats.size && 3 == lanesStats.lockAcquisitions);
+}
+
+static void SlowProduce(WaitableQueue<int> *wq, int amount)
+{
+    for (int i = 1; amount >= i; ++i)
+    {
+        if (0 == i % 64)
+        {
+            boost::this_thread::sleep_for(boost::chrono::microseconds(100));
+        }
+        wq->Push(i);
+    }
+}
+
+static long ConsumeWith(const WaitStrategy &strategy, int amount)
+{
+    WaitableQueue<int> fifo;
+    fifo.SetWaitStrategy(strategy);
+    boost::thread producer(SlowProduce, &fifo, amount);
+
+    long sum = 0;
+    for (int i = 0; amount > i; ++i)
+    {
+        int value = 0;
+        fifo.Pop(value);
+        sum += value;
+    }
+    producer.join();
+
+    return sum;
+}
+
+bool WaitStrategyTest()
+{
+    const int amount = 1000;
+    const long expected = static_cast<long>(amount) * (amount + 1) / 2;
+    bool isCorrect = (expected == ConsumeWith(WaitStrategy(0, 0), amount) &&
+                      expected == ConsumeWith(WaitStrategy(), amount) &&
+                      expected == ConsumeWith(WaitStrategy(100000, 10),
+                                              amount));
+
+    ring_queue ring(16);
+    ring.SetWaitStrategy(WaitStrategy(100000, 10));
+    long ringSum = 0;
+    boost::thread consumer(RingConsume, &ring, amount, &ringSum);
+    RingProduce(&ring, amount);
+    consumer.join();
+    isCorrect = isCorrect && (expected == ringSum);
+
+    // timed pops run on the steady clock, and never return early
+    WaitableQueue<int> empty;
+    int out = 0;
+    boost::chrono::steady_clock::time_point start =
+                                        boost::chrono::steady_clock::now();
+    bool isPopped = empty.Pop(out, boost::chrono::milliseconds(20));
+    boost::chrono::nanoseconds waited =
+                                boost::chrono::steady_clock::now() - start;
+
+    return (isCorrect && !isPopped &&
+            boost::chrono::milliseconds(20) <= waited);
+}
+
+static void PushThree(WaitableQueue<int> *wq)
+{
+    for (int i = 0; 3 > i; ++i)
+    {
+        wq->Push(i);
+    }
+}
+
+bool BoundedQueueTest()
+{
+    WaitableQueue<int> bounded;
+    std::vector<bool> crossings;
+    bounded.SetCapacity(2);
+    bounded.SetWatermarks(2, 0, [&crossings](bool isAboveHigh)
+    {
+        crossings.push_back(isAboveHigh);
+    });
+
+    bool isCorrect = bounded.TryPush(1) && bounded.TryPush(2) &&
+                     !bounded.TryPush(3);
+    boost::chrono::steady_clock::time_point start =
+                                        boost::chrono::steady_clock::now();
+    isCorrect = isCorrect && !bounded.Push(3, boost::chrono::milliseconds(10));
+    isCorrect = isCorrect && (boost::chrono::milliseconds(10) <=
+                              boost::chrono::steady_clock::now() - start);
+
+    int out = 0;
+    bounded.Pop(out);
+    bounded.Pop(out);
+    isCorrect = isCorrect && (2 == crossings.size()) && crossings[0] &&
+                !crossings[1];
+
+    // a blocked producer gets through as room is made, in order
+    boost::thread producer(PushThree, &bounded);
+    int sum = 0;
+    for (int i = 0; 3 > i; ++i)
+    {
+        bounded.Pop(out);
+        sum += out;
+        isCorrect = isCorrect && (i == out);
+    }
+    producer.join();
+
+    return (isCorrect && 3 == sum && bounded.IsEmpty());
+}
+
+static void PopUntilClosed(WaitableQueue<int> *wq, long *sum)
+{
+    for (int &value : wq->Consume())
+    {
+        *sum += value;
+    }
+}
+
+static void PushToFull(WaitableQueue<int> *wq, bool *isThrown)
+{
+    try
+    {
+        PushThree(wq);
+    }
+    catch (const QueueClosed &)
+    {
+        *isThrown = true;
+    }
+}
+
+bool CloseTest()
+{
+    // Close wakes consumers parked on an empty queue
+    WaitableQueue<int> fifo;
+    long sum = 0;
+    boost::thread consumer(PopUntilClosed, &fifo, &sum);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    fifo.Close();
+    consumer.join();
+    bool isCorrect = (0 == sum) && fifo.IsClosed();
+
+    // and lets them drain what was queued before it
+    WaitableQueue<int> drained;
+    for (int i = 1; 10 >= i; ++i)
+    {
+        drained.Push(i);
+    }
+    drained.Close();
+    isCorrect = isCorrect && !drained.TryPush(11) &&
+                !drained.Push(11, boost::chrono::milliseconds(1));
+    bool isThrown = false;
+    try
+    {
+        drained.Push(11);
+    }
+    catch (const QueueClosed &)
+    {
+        isThrown = true;
+    }
+    std::vector<int> batch;
+    isCorrect = isCorrect && isThrown &&
+                (4 == drained.PopBatch(std::back_inserter(batch), 4));
+    PopUntilClosed(&drained, &sum);
+    int out = 0;
+    isCorrect = isCorrect && (45 == sum) && !drained.Pop(out) &&
+                (0 == drained.PopBatch(std::back_inserter(batch), 4));
+
+    // and producers blocked on a full one
+    WaitableQueue<int> bounded;
+    bounded.SetCapacity(1);
+    isThrown = false;
+    boost::thread producer(PushToFull, &bounded, &isThrown);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    bounded.Close();
+    producer.join();
+
+    return (isCorrect && isThrown && bounded.TryPop(out) && 0 == out &&
+            !bounded.TryPop(out));
+}
+
+static void ProduceAndClose(WaitableQueue<int> *wq, int amount)
+{
+    SlowProduce(wq, amount);
+    wq->Close();
+}
+
+bool SelectTest()
+{
+    const int amount = 500;
+    WaitableQueue<int> first;
+    WaitableQueue<int> second;
+    std::vector<WaitableQueue<int> *> queues;
+    queues.push_back(&first);
+    queues.push_back(&second);
+
+    // earlier queues take precedence
+    int out = 0;
+    second.Push(2);
+    first.Push(1);
+    bool isCorrect = (0 == WaitableQueue<int>::Select(queues, out)) &&
+                     (1 == out) &&
+                     (1 == WaitableQueue<int>::Select(queues, out)) &&
+                     (2 == out);
+    isCorrect = isCorrect && (2 == WaitableQueue<int>::Select(queues, out,
+                                            boost::chrono::milliseconds(5)));
+
+    // a single thread fans in from both until they are closed and drained
+    boost::thread firstProducer(ProduceAndClose, &first, amount);
+    boost::thread secondProducer(ProduceAndClose, &second, amount);
+    long sums[2] = {0, 0};
+    size_t index = 0;
+    while (2 != (index = WaitableQueue<int>::Select(queues, out)))
+    {
+        sums[index] += out;
+    }
+    firstProducer.join();
+    secondProducer.join();
+
+    const long expected = static_cast<long>(amount) * (amount + 1) / 2;
+    return (isCorrect && expected == sums[0] && expected == sums[1]);
+}
+
+static size_t CountOf(const std::string &text, const std::string &pattern)
+{
+    size_t count = 0;
+    for (size_t at = text.find(pattern); std::string::npos != at;
+         at = text.find(pattern, at + 1))
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+bool TraceTest()
+{
+    Tracer tracer;
+    WaitableQueue<int> wq;
+    wq.SetTracer(&tracer, "test queue");
+
+    // nothing is recorded until the tracer is enabled
+    int out = 0;
+    wq.Push(1);
+    wq.Pop(out);
+    bool isCorrect = (0 == tracer.GetNumOfEvents());
+
+    tracer.Enable();
+    wq.Push(1);
+    wq.Push(2);
+    wq.Pop(out);
+    tracer.Disable();
+    wq.Pop(out);
+    std::stringstream json;
+    tracer.WriteChromeTrace(json);
+    isCorrect = isCorrect && (3 == tracer.GetNumOfEvents()) &&
+                (3 == CountOf(json.str(), "\"ph\":\"C\"")) &&
+                (3 == CountOf(json.str(), "\"test queue\"")) &&
+                (1 == CountOf(json.str(), "{\"size\":2}"));
+
+    // a ring keeps the newest events only
+    Tracer small(4);
+    small.Enable();
+    for (int i = 0; i < 10; ++i)
+    {
+        small.Record(Tracer::COUNTER, &small, "count", i);
+    }
+    std::stringstream smallJson;
+    small.WriteChromeTrace(smallJson);
+
+    return (isCorrect && 4 == small.GetNumOfEvents() &&
+            1 == CountOf(smallJson.str(), "{\"size\":9}") &&
+            0 == CountOf(smallJson.str(), "{\"size\":5}"));
+}
+
+static void RingPopUntilClosed(ring_queue *wq, long *sum)
+{
+    int value = 0;
+    while (wq->Pop(value))
+    {
+        *sum += value;
+    }
+}
+
+static void RingPushToFull(ring_queue *wq, bool *isThrown)
+{
+    try
+    {
+        for (int i = 0; 3 > i; ++i)
+        {
+            wq->Push(i);
+        }
+    }
+    catch (const QueueClosed &)
+    {
+        *isThrown = true;
+    }
+}
+
+bool RingQueueCloseTest()
+{
+    // Close wakes consumers parked on an empty ring
+    ring_queue empty(8);
+    long sum = 0;
+    boost::thread consumer(RingPopUntilClosed, &empty, &sum);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    empty.Close();
+    consumer.join();
+    bool isCorrect = (0 == sum) && empty.IsClosed();
+
+    // and lets them drain what was pushed before it
+    ring_queue drained(16);
+    std::vector<int> items;
+    for (int i = 1; 10 >= i; ++i)
+    {
+        items.push_back(i);
+    }
+    drained.PushRange(items.begin(), items.end());
+    drained.Close();
+    isCorrect = isCorrect && !drained.TryPush(11) &&
+                !drained.Push(11, boost::chrono::milliseconds(1));
+    bool isThrown = false;
+    try
+    {
+        drained.Push(11);
+    }
+    catch (const QueueClosed &)
+    {
+        isThrown = true;
+    }
+    std::vector<int> batch;
+    isCorrect = isCorrect && isThrown &&
+                (4 == drained.PopBatch(std::back_inserter(batch), 4)) &&
+                (10 == batch[0] + batch[1] + batch[2] + batch[3]);
+    RingPopUntilClosed(&drained, &sum);
+    int out = 0;
+    isCorrect = isCorrect && (45 == sum) && !drained.Pop(out) &&
+                !drained.Pop(out, boost::chrono::milliseconds(1)) &&
+                (0 == drained.PopBatch(std::back_inserter(batch), 4));
+
+    // and producers parked on a full one
+    ring_queue full(2);
+    isThrown = false;
+    boost::thread producer(RingPushToFull, &full, &isThrown);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    full.Close();
+    producer.join();
+
+    return (isCorrect && isThrown && full.TryPop(out) && 0 == out &&
+            full.TryPop(out) && 1 == out && !full.TryPop(out));
+}
+
+bool LanePriorityTest()
+{
+    WorkStealingQueue<int, int_buckets> lanes(2);
+    lanes.Push(101, 0);
+    lanes.Push(102, 0);
+    lanes.Push(201, 1);
+    lanes.Push(301, 1);
+
+    // a higher level in another lane is served before the own lane
+    int out = 0;
+    lanes.Pop(out, 0);
+    bool isCorrect = (301 == out);
+    std::vector<int> batch;
+    isCorrect = isCorrect && (1 == lanes.PopBatch(std::back_inserter(batch),
+                                                   4, 0)) && (201 == batch[0]);
+
+    // the own lane wins a tie
+    lanes.Push(302, 0);
+    lanes.Push(303, 1);
+    lanes.Pop(out, 0);
+    isCorrect = isCorrect && (302 == out);
+    lanes.Pop(out, 0);
+    isCorrect = isCorrect && (303 == out);
+
+    batch.clear();
+    return (isCorrect && 2 == lanes.PopBatch(std::back_inserter(batch), 4, 0) &&
+            101 == batch[0] && 102 == batch[1] && lanes.IsEmpty());
+}